@@ -11,6 +11,12 @@
 /*** Private Global Variables ------------------------------------------------*/
 /*! \privatesection */
 
+/* Prescaler division factors indexed by the `PDIV` bit field value, 0 marks
+ * the reserved encodings 0x6, 0x7 and 0xD to 0xF. */
+static const uint8_t prescaleDivisor[16] = {
+    2, 4, 8, 16, 32, 64, 0, 0, 6, 10, 12, 24, 48, 0, 0, 0
+};
+
 
 /*** Public Global Variables -------------------------------------------------*/
 /*! \publicsection */
@@ -125,3 +131,107 @@ void clockDisableXOsc32k(void)
     CPU_CCP = CCP_IOREG_gc;
     CLKCTRL.XOSC32KCTRLA = mask;
 }
+
+/*! Get the nominal system clock frequency for a clock source and prescaler.
+ * The internal oscillator runs at 16MHz or 20MHz depending on the `FREQSEL`
+ * fuse. An external clock is assumed to run at `CLOCK_EXTCLK_FREQUENCY`.
+ * @param source The clock source.
+ * @param ps The prescale factor.
+ * @return The nominal system clock frequency in Hz.
+ */
+uint32_t clockGetFrequency(enum sysClockSource_e source, enum sysClockPrescaler_e ps)
+{
+    uint32_t f;
+    switch (source) {
+        case SYS_CLOCK_INT_OSC:
+            f = (FUSE.OSCCFG & FUSE_FREQSEL_gm) == FUSE_FREQSEL_16MHZ_gc ?
+                    16000000UL : 20000000UL;
+            break;
+        case SYS_CLOCK_ULP_32K:
+        case SYS_CLOCK_EXT_32K:
+            f = 32768UL;
+            break;
+        default:
+            f = CLOCK_EXTCLK_FREQUENCY;
+            break;
+    }
+    if (ps != SYS_CLOCK_PRESCALE_DIV1) {
+        f /= prescaleDivisor[(ps & CLKCTRL_PDIV_gm) >> CLKCTRL_PDIV_gp];
+    }
+    return f;
+}
+
+/*! Get the current nominal system (and peripheral) clock frequency, computed
+ * from the selected clock source and prescaler.
+ * @return The system clock frequency in Hz.
+ */
+uint32_t clockGetSysClockFrequency(void)
+{
+    uint8_t ctrlb = CLKCTRL.MCLKCTRLB;
+    return clockGetFrequency(CLKCTRL.MCLKCTRLA & CLKCTRL_CLKSEL_gm,
+            (ctrlb & CLKCTRL_PEN_bm) ? (ctrlb & CLKCTRL_PDIV_gm) : SYS_CLOCK_PRESCALE_DIV1);
+}
+
+/*! Compute `a * b / c` rounded down with 32-bit arithmetic, by long
+ * multiplication over the bits of `b`. Unlike scaling the operands down, the
+ * result is exact for any operands.
+ * @param a The first factor.
+ * @param b The second factor.
+ * @param c The divisor, must not be 0.
+ * @return The quotient, which must fit 32 bits.
+ */
+uint32_t clockMulDiv(uint32_t a, uint32_t b, uint32_t c)
+{
+    const uint32_t qa = a / c;
+    const uint32_t ra = a % c;
+    uint32_t q = 0;
+    uint32_t r = 0;
+    // invariant: q * c + r = a * (bits of b handled so far), r < c
+    for (uint32_t bit = 0x80000000UL; bit != 0; bit >>= 1) {
+        q <<= 1;
+        if (r >= c - r) {
+            r -= c - r;
+            q++;
+        } else {
+            r <<= 1;
+        }
+        if (b & bit) {
+            q += qa;
+            if (r >= c - ra) {
+                r -= c - ra;
+                q++;
+            } else {
+                r += ra;
+            }
+        }
+    }
+    return q;
+}
+
+/*! Scale a 16-bit clock divisor or period value proportionally to a clock
+ * frequency change, rounding to nearest. The result saturates at 0xFFFF.
+ * The scaling is exact, see `clockMulDiv()`.
+ * @param value The value valid at clock frequency `from`.
+ * @param from The clock frequency the value was computed for. If 0, `value`
+ * is returned unchanged.
+ * @param to The new clock frequency.
+ * @return The scaled value.
+ */
+uint16_t clockScale16(uint16_t value, uint32_t from, uint32_t to)
+{
+    if (from == 0) {
+        return value;
+    }
+    if ((to >> 16) >= from) {
+        // ratio of 65536 or more, any non-zero value saturates
+        return value == 0 ? 0 : 0xFFFF;
+    }
+    // the quotient is below 2^32 and the remainder below `from`, so the
+    // remainder is exact in wrapping 32-bit arithmetic
+    uint32_t q = clockMulDiv(value, to, from);
+    uint32_t r = (uint32_t)value * to - q * from;
+    if (r >= from - r) {
+        q++;
+    }
+    return q > 0xFFFF ? 0xFFFF : (uint16_t)q;
+}
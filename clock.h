@@ -58,6 +58,13 @@ enum xOsc32kSourceType_e {
     XOSC_32K_SRC_CLK        = CLKCTRL_SEL_bm,   ///< External clock source on TOSC1 pin
 };
 
+/*! Frequency of an external clock on the EXTCLK pin, used when computing the
+ * system clock frequency. Override if the external clock differs from `F_CPU`.
+ */
+#ifndef CLOCK_EXTCLK_FREQUENCY
+#define CLOCK_EXTCLK_FREQUENCY  F_CPU
+#endif
+
 /*** Public Functions --------------------------------------------------------*/
 /*! \publicsection */
 
@@ -68,3 +75,7 @@ void clockConfigXOsc32k(enum xOsc32kStartupTime_e sut,
                         bool runStdby);
 void clockEnableXOsc32k(void);
 void clockDisableXOsc32k(void);
+uint32_t clockGetFrequency(enum sysClockSource_e source, enum sysClockPrescaler_e ps);
+uint32_t clockGetSysClockFrequency(void);
+uint32_t clockMulDiv(uint32_t a, uint32_t b, uint32_t c);
+uint16_t clockScale16(uint16_t value, uint32_t from, uint32_t to);
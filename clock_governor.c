@@ -0,0 +1,147 @@
+/*! \file
+ *  clock_governor.c
+ *  xenon-lib-tiny
+ *  Copyright (c) 2020 Martin Clemons
+ */
+#include "clock_governor.h"
+#include <stddef.h>
+
+
+/*** Private Global Variables ------------------------------------------------*/
+/*! \privatesection */
+
+/* Clock source and prescaler of each performance level. */
+static struct {
+    enum sysClockSource_e source;
+    enum sysClockPrescaler_e ps;
+} levels[CLOCK_GOV_LEVEL_COUNT] = {
+    [CLOCK_GOV_LEVEL_HIGH]      = { SYS_CLOCK_INT_OSC, SYS_CLOCK_PRESCALE_DIV1 },
+    [CLOCK_GOV_LEVEL_MEDIUM]    = { SYS_CLOCK_INT_OSC, SYS_CLOCK_PRESCALE_DIV4 },
+    [CLOCK_GOV_LEVEL_LOW]       = { SYS_CLOCK_ULP_32K, SYS_CLOCK_PRESCALE_DIV1 },
+};
+
+// The current performance level, `CLOCK_GOV_LEVEL_COUNT` until a level is set
+static enum clockGovLevel_e currentLevel = CLOCK_GOV_LEVEL_COUNT;
+
+// Linked list of registered clients
+static struct clockGovClient_s *clients;
+
+
+/*** Public Global Variables -------------------------------------------------*/
+/*! \publicsection */
+
+
+/*** Private Function Prototypes ---------------------------------------------*/
+/*! \privatesection */
+
+
+/*** Interrupt Service Routines (ISR) ----------------------------------------*/
+/*! \privatesection */
+
+
+/*** Private Functions -------------------------------------------------------*/
+/*! \privatesection */
+
+
+/*** Public Functions --------------------------------------------------------*/
+/*! \publicsection */
+
+/*! Change the clock source and prescaler of a performance level. If `level`
+ * is the current level, the change takes effect on the next call to
+ * `clockGovSetLevel()`.
+ * @param level The performance level to configure.
+ * @param source The clock source for this level.
+ * @param ps The prescaler for this level.
+ * Note: Any clock source other than the internal oscillators must be
+ * configured and enabled before switching to the level.
+ */
+void clockGovConfigLevel(enum clockGovLevel_e level, enum sysClockSource_e source,
+                         enum sysClockPrescaler_e ps)
+{
+    if (level >= CLOCK_GOV_LEVEL_COUNT) {
+        return;
+    }
+    levels[level].source = source;
+    levels[level].ps = ps;
+}
+
+/*! Register a clock change client.
+ * @param client Pointer to data structure where client is stored.
+ * @param cb Function called after each clock change.
+ * @param param The parameter passed to `cb` when it is called.
+ * @return returns `TASK_INIT_OK` if client was added, `TASK_INIT_ERROR` otherwise.
+ */
+enum addStatus_e clockGovAddClient(struct clockGovClient_s *client, clockGovCb_t *cb,
+                                   cbParam_t *param)
+{
+    if (client == NULL || cb == NULL) {
+        return TASK_INIT_ERROR;
+    }
+    client->cb = cb;
+    client->param = param;
+    client->next = clients;
+    clients = client;
+    return TASK_INIT_OK;
+}
+
+/*! Remove a clock change client. Must not be called from a client callback.
+ * @param client Pointer to the client to remove.
+ */
+void clockGovRemoveClient(struct clockGovClient_s *client)
+{
+    struct clockGovClient_s **c = &clients;
+    while (*c != NULL) {
+        if (*c == client) {
+            *c = client->next;
+            return;
+        }
+        c = &(*c)->next;
+    }
+}
+
+/*! Switch the system clock to a performance level and call all registered
+ * clients with the old and new peripheral clock frequency. **Not reentrant**
+ * Clock source and prescaler are changed in the order which keeps the
+ * transient clock frequency lowest.
+ * Note: Characters or transfers in progress while the clock changes are
+ * corrupted, wait for peripherals to be idle before changing level.
+ * @param level The performance level to switch to.
+ */
+void clockGovSetLevel(enum clockGovLevel_e level)
+{
+    if (level >= CLOCK_GOV_LEVEL_COUNT) {
+        return;
+    }
+    uint32_t from = clockGetSysClockFrequency();
+    enum sysClockSource_e source = levels[level].source;
+    enum sysClockPrescaler_e ps = levels[level].ps;
+    enum sysClockSource_e oldSource = CLKCTRL.MCLKCTRLA & CLKCTRL_CLKSEL_gm;
+    enum sysClockPrescaler_e oldPs = (CLKCTRL.MCLKCTRLB & CLKCTRL_PEN_bm) ?
+            (CLKCTRL.MCLKCTRLB & CLKCTRL_PDIV_gm) : SYS_CLOCK_PRESCALE_DIV1;
+    // change the prescaler first if the old source with the new prescaler is
+    // slower than the new source with the old prescaler
+    if (clockGetFrequency(oldSource, ps) <= clockGetFrequency(source, oldPs)) {
+        clockSetSysClockPrescaler(ps);
+        clockSetSysClockSource(source);
+    } else {
+        clockSetSysClockSource(source);
+        clockSetSysClockPrescaler(ps);
+    }
+    currentLevel = level;
+    uint32_t to = clockGetSysClockFrequency();
+    if (to == from) {
+        return;
+    }
+    for (struct clockGovClient_s *c = clients; c != NULL; c = c->next) {
+        c->cb(from, to, c->param);
+    }
+}
+
+/*! Get the current performance level.
+ * @return The performance level last set with `clockGovSetLevel()`, or
+ * `CLOCK_GOV_LEVEL_COUNT` if no level has been set since reset.
+ */
+enum clockGovLevel_e clockGovGetLevel(void)
+{
+    return currentLevel;
+}
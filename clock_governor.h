@@ -0,0 +1,57 @@
+/*! \file
+ *  clock_governor.h
+ *  xenon-lib-tiny
+ *  Copyright (c) 2020 Martin Clemons
+ *
+ *  Frequency governor which switches the system clock between named
+ *  performance levels. Peripheral drivers and the application register a
+ *  client callback which is called after each clock change, so divisors and
+ *  periods which depend on the peripheral clock can be recomputed.
+ */
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <avr/io.h>
+#include "clock.h"
+#include "task_scheduler.h"
+
+
+/*** Public Variables --------------------------------------------------------*/
+/*! \publicsection */
+
+/*! Named performance levels. The clock source and prescaler of each level can
+ * be changed with `clockGovConfigLevel()`.
+ */
+enum clockGovLevel_e {
+    CLOCK_GOV_LEVEL_HIGH    = 0,    ///< Internal oscillator, no prescaler (20MHz / 16MHz)
+    CLOCK_GOV_LEVEL_MEDIUM,         ///< Internal oscillator, prescale factor 4 (5MHz / 4MHz)
+    CLOCK_GOV_LEVEL_LOW,            ///< Internal ULP 32kHz oscillator
+    CLOCK_GOV_LEVEL_COUNT,          ///< Number of performance levels
+};
+
+/*! Clock change callback function.
+ * The first parameter is the old and the second parameter the new peripheral
+ * clock frequency in Hz, the third parameter is the client's parameter.
+ */
+typedef void (clockGovCb_t)(uint32_t, uint32_t, cbParam_t *);
+
+/*! Data structure for a clock governor client. Allocated by the caller.
+ */
+struct clockGovClient_s {
+    clockGovCb_t *cb;                   ///< Called after each clock change
+    cbParam_t *param;                   ///< Parameter passed to `cb`
+    struct clockGovClient_s *next;      ///< Next client in list
+};
+
+
+/*** Public Functions --------------------------------------------------------*/
+/*! \publicsection */
+
+void clockGovConfigLevel(enum clockGovLevel_e level, enum sysClockSource_e source,
+                         enum sysClockPrescaler_e ps);
+enum addStatus_e clockGovAddClient(struct clockGovClient_s *client, clockGovCb_t *cb,
+                                   cbParam_t *param);
+void clockGovRemoveClient(struct clockGovClient_s *client);
+void clockGovSetLevel(enum clockGovLevel_e level);
+enum clockGovLevel_e clockGovGetLevel(void);
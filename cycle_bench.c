@@ -0,0 +1,63 @@
+/*! \file
+ *  cycle_bench.c
+ *  xenon-lib-tiny
+ *  Copyright (c) 2020 Martin Clemons
+ */
+#include "cycle_bench.h"
+#include "timer_counter_b.h"
+
+
+/*** Private Global Variables ------------------------------------------------*/
+/*! \privatesection */
+
+
+/*** Public Global Variables -------------------------------------------------*/
+/*! \publicsection */
+
+uint16_t cycleBenchOverhead;
+
+
+/*** Private Function Prototypes ---------------------------------------------*/
+/*! \privatesection */
+
+
+/*** Interrupt Service Routines (ISR) ----------------------------------------*/
+/*! \privatesection */
+
+
+/*** Private Functions -------------------------------------------------------*/
+/*! \privatesection */
+
+
+/*** Public Functions --------------------------------------------------------*/
+/*! \publicsection */
+
+/*! Start the cycle counter TCB from the peripheral clock and measure the
+ * cost of an empty `CYCLE_BENCH()`.
+ * Note: `CYCLE_BENCH()` counts peripheral clocks, which are CPU cycles only
+ * while the main clock prescaler is disabled.
+ */
+void cycleBenchStart(void)
+{
+    const struct timerCounterBConfig_s config = {
+        .clockSource = TCB_CLOCK_SOURCE_PER,
+        .mode = TCB_MODE_PERIODIC_INTERRUPT,
+    };
+    timerCounterBDisable(&CYCLE_BENCH_TCB);
+    timerCounterBConfig(&CYCLE_BENCH_TCB, &config);
+    timerCounterBConfigInterrupts(&CYCLE_BENCH_TCB, false);
+    timerCounterBSetCompare(&CYCLE_BENCH_TCB, 0xFFFF);
+    timerCounterBSetCounter(&CYCLE_BENCH_TCB, 0);
+    timerCounterBEnable(&CYCLE_BENCH_TCB);
+    cycleBenchOverhead = 0;
+    uint16_t overhead;
+    CYCLE_BENCH(overhead, __asm__ __volatile__ ("" ::: "memory"));
+    cycleBenchOverhead = overhead;
+}
+
+/*! Stop the cycle counter TCB.
+ */
+void cycleBenchStop(void)
+{
+    timerCounterBDisable(&CYCLE_BENCH_TCB);
+}
@@ -0,0 +1,54 @@
+/*! \file
+ *  cycle_bench.h
+ *  xenon-lib-tiny
+ *  Copyright (c) 2020 Martin Clemons
+ *
+ *  Cycle counting for measuring code on target. A TCB runs from the
+ *  peripheral clock with a period of 65536 clocks, `CYCLE_BENCH()` reads
+ *  `CNT` before and after a statement with interrupts disabled and subtracts
+ *  the cost of an empty measurement. With the main clock prescaler disabled
+ *  the result is in CPU cycles. Statements taking 65536 cycles or more wrap.
+ *  The TCB is not available to other drivers between `cycleBenchStart()` and
+ *  `cycleBenchStop()`.
+ */
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <avr/io.h>
+#include "util/atomic.h"
+
+
+/*** Public Variables --------------------------------------------------------*/
+/*! \publicsection */
+
+/*! TCB peripheral used for cycle counting.
+ */
+#ifndef CYCLE_BENCH_TCB
+#define CYCLE_BENCH_TCB         TCB0
+#endif
+
+/*! Measure the CPU cycles taken by `stmt` and store them in `cycles`. The
+ * statement runs with interrupts disabled.
+ * @param cycles `uint16_t` lvalue receiving the number of cycles.
+ * @param stmt The statement to measure, e.g. a function call.
+ */
+#define CYCLE_BENCH(cycles, stmt) \
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { \
+        uint16_t cycleBenchStart_ = CYCLE_BENCH_TCB.CNT; \
+        stmt; \
+        uint16_t cycleBenchEnd_ = CYCLE_BENCH_TCB.CNT; \
+        (cycles) = cycleBenchEnd_ - cycleBenchStart_ - cycleBenchOverhead; \
+    }
+
+/*! Cycles of an empty measurement, subtracted by `CYCLE_BENCH()`. Set by
+ * `cycleBenchStart()`.
+ */
+extern uint16_t cycleBenchOverhead;
+
+
+/*** Public Functions --------------------------------------------------------*/
+/*! \publicsection */
+
+void cycleBenchStart(void);
+void cycleBenchStop(void);
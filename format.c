@@ -0,0 +1,329 @@
+/*! \file
+ *  format.c
+ *  xenon-lib-tiny
+ *  Copyright (c) 2020 Martin Clemons
+ */
+#include "format.h"
+#include <stdarg.h>
+#include <avr/pgmspace.h>
+#include "sleep_manager.h"
+#include "usart_buffered.h"
+
+// Digits of a 32-bit value, sign and decimal point
+#define DIGITS_MAX      12
+
+
+/*** Private Global Variables ------------------------------------------------*/
+/*! \privatesection */
+
+/* Two ASCII digits for each value 0 - 99. */
+static const char digitPairs[200] PROGMEM =
+        "00010203040506070809"
+        "10111213141516171819"
+        "20212223242526272829"
+        "30313233343536373839"
+        "40414243444546474849"
+        "50515253545556575859"
+        "60616263646566676869"
+        "70717273747576777879"
+        "80818283848586878889"
+        "90919293949596979899";
+
+static const char hexDigits[16] PROGMEM = "0123456789ABCDEF";
+
+
+/*** Public Global Variables -------------------------------------------------*/
+/*! \publicsection */
+
+
+/*** Private Function Prototypes ---------------------------------------------*/
+/*! \privatesection */
+static void put(const char *data, uint8_t length);
+static inline char *putPair(char *p, uint8_t value);
+static char *u16ToDigits(uint16_t value, char *end);
+static char *u32ToDigits(uint32_t value, char *end);
+static void hex(uint32_t value, uint8_t digits);
+
+
+/*** Interrupt Service Routines (ISR) ----------------------------------------*/
+/*! \privatesection */
+
+
+/*** Private Functions -------------------------------------------------------*/
+/*! \privatesection */
+
+/*! Write characters to the transmit ring, sleeping while it is full.
+ * @param data The characters to write.
+ * @param length Number of characters.
+ */
+static void put(const char *data, uint8_t length)
+{
+    while (length > 0) {
+        uint8_t n = usartWrite((const uint8_t *)data, length);
+        data += n;
+        length -= n;
+        if (length > 0) {
+            sleepMgrSleep();
+        }
+    }
+}
+
+/*! Store the two digits of a value 0 - 99 before `p`.
+ * @return Pointer to the first digit.
+ */
+static inline char *putPair(char *p, uint8_t value)
+{
+    const char *pair = &digitPairs[2 * value];
+    *--p = pgm_read_byte(pair + 1);
+    *--p = pgm_read_byte(pair);
+    return p;
+}
+
+/*! Convert a 16-bit value to decimal digits, stored backwards from `end`.
+ * @param value The value to convert.
+ * @param end Pointer past the last digit.
+ * @return Pointer to the first digit.
+ */
+static char *u16ToDigits(uint16_t value, char *end)
+{
+    char *p = end;
+    while (value >= 100) {
+        // value / 100 == (value / 4) * 5243 >> 17 for all 16-bit values
+        uint16_t q = ((uint32_t)(value >> 2) * 5243) >> 17;
+        p = putPair(p, value - q * 100);
+        value = q;
+    }
+    if (value >= 10) {
+        return putPair(p, value);
+    }
+    *--p = '0' + value;
+    return p;
+}
+
+/*! Convert a 32-bit value to decimal digits, stored backwards from `end`.
+ * Only the upper digits of values above 65535 need 32-bit divisions.
+ * @param value The value to convert.
+ * @param end Pointer past the last digit.
+ * @return Pointer to the first digit.
+ */
+static char *u32ToDigits(uint32_t value, char *end)
+{
+    char *p = end;
+    while (value > UINT16_MAX) {
+        uint32_t q = value / 100;
+        p = putPair(p, value - q * 100);
+        value = q;
+    }
+    return u16ToDigits(value, p);
+}
+
+/*! Write a value as fixed width upper case hexadecimal.
+ * @param value The value.
+ * @param digits Number of digits, at most 8.
+ */
+static void hex(uint32_t value, uint8_t digits)
+{
+    char buffer[8];
+    for (uint8_t i = digits; i > 0; i--) {
+        buffer[i - 1] = pgm_read_byte(&hexDigits[value & 0x0F]);
+        value >>= 4;
+    }
+    put(buffer, digits);
+}
+
+
+/*** Public Functions --------------------------------------------------------*/
+/*! \publicsection */
+
+/*! Write a character.
+ */
+void formatChar(char c)
+{
+    put(&c, 1);
+}
+
+/*! Write a string from RAM.
+ */
+void formatStr(const char *s)
+{
+    while (*s != '\0') {
+        put(s++, 1);
+    }
+}
+
+/*! Write a string from flash (`PSTR()` or `PROGMEM`).
+ */
+void formatStr_P(const char *s)
+{
+    char c;
+    while ((c = pgm_read_byte(s++)) != '\0') {
+        put(&c, 1);
+    }
+}
+
+/*! Write an unsigned 16-bit value in decimal.
+ */
+void formatU16(uint16_t value)
+{
+    char buffer[DIGITS_MAX];
+    char *end = buffer + sizeof(buffer);
+    char *p = u16ToDigits(value, end);
+    put(p, end - p);
+}
+
+/*! Write a signed 16-bit value in decimal.
+ */
+void formatI16(int16_t value)
+{
+    char buffer[DIGITS_MAX];
+    char *end = buffer + sizeof(buffer);
+    char *p = u16ToDigits(value < 0 ? -(uint16_t)value : (uint16_t)value, end);
+    if (value < 0) {
+        *--p = '-';
+    }
+    put(p, end - p);
+}
+
+/*! Write an unsigned 32-bit value in decimal.
+ */
+void formatU32(uint32_t value)
+{
+    char buffer[DIGITS_MAX];
+    char *end = buffer + sizeof(buffer);
+    char *p = u32ToDigits(value, end);
+    put(p, end - p);
+}
+
+/*! Write a signed 32-bit value in decimal.
+ */
+void formatI32(int32_t value)
+{
+    formatFixed(value, 0);
+}
+
+/*! Write an 8-bit value as two hexadecimal digits.
+ */
+void formatHex8(uint8_t value)
+{
+    hex(value, 2);
+}
+
+/*! Write a 16-bit value as four hexadecimal digits.
+ */
+void formatHex16(uint16_t value)
+{
+    hex(value, 4);
+}
+
+/*! Write a 32-bit value as eight hexadecimal digits.
+ */
+void formatHex32(uint32_t value)
+{
+    hex(value, 8);
+}
+
+/*! Write a decimal fixed-point value, e.g. `formatFixed(-1234, 2)` writes
+ * "-12.34" and `formatFixed(5, 3)` writes "0.005".
+ * @param value The value scaled by 10^`decimals`.
+ * @param decimals Number of decimal places, at most 9.
+ */
+void formatFixed(int32_t value, uint8_t decimals)
+{
+    char buffer[DIGITS_MAX];
+    char *end = buffer + sizeof(buffer);
+    if (decimals > 9) {
+        decimals = 9;
+    }
+    char *p = u32ToDigits(value < 0 ? -(uint32_t)value : (uint32_t)value, end);
+    // pad with leading zeros so there is at least one integer digit
+    while (end - p <= decimals) {
+        *--p = '0';
+    }
+    if (decimals > 0) {
+        // move the integer digits one place down to insert the point
+        char *point = end - decimals - 1;
+        for (char *q = p - 1; q < point; q++) {
+            q[0] = q[1];
+        }
+        *point = '.';
+        p--;
+    }
+    if (value < 0) {
+        *--p = '-';
+    }
+    put(p, end - p);
+}
+
+/*! Formatted output with a format string in flash, supporting a small subset
+ * of `printf()`: `%c`, `%s` (RAM string), `%S` (flash string), `%u`, `%d`,
+ * `%x` (16-bit, `%x` writes four digits), `%lu`, `%ld`, `%lx` (32-bit, eight
+ * digits), `%.Nq` and `%.Nlq` (16/32-bit fixed-point with N decimals, see
+ * `formatFixed()`) and `%%`. Width and flags are not supported.
+ * @param fmt The format string in flash (`PSTR()`).
+ */
+void formatPrintf_P(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    char c;
+    while ((c = pgm_read_byte(fmt++)) != '\0') {
+        if (c != '%') {
+            put(&c, 1);
+            continue;
+        }
+        uint8_t decimals = 0;
+        bool isLong = false;
+        c = pgm_read_byte(fmt++);
+        if (c == '.') {
+            while ((c = pgm_read_byte(fmt++)) >= '0' && c <= '9') {
+                decimals = decimals * 10 + c - '0';
+            }
+        }
+        if (c == 'l') {
+            isLong = true;
+            c = pgm_read_byte(fmt++);
+        }
+        switch (c) {
+            case 'c':
+                formatChar(va_arg(ap, int));
+                break;
+            case 's':
+                formatStr(va_arg(ap, const char *));
+                break;
+            case 'S':
+                formatStr_P(va_arg(ap, const char *));
+                break;
+            case 'u':
+                if (isLong) {
+                    formatU32(va_arg(ap, uint32_t));
+                } else {
+                    formatU16(va_arg(ap, unsigned int));
+                }
+                break;
+            case 'd':
+                if (isLong) {
+                    formatI32(va_arg(ap, int32_t));
+                } else {
+                    formatI16(va_arg(ap, int));
+                }
+                break;
+            case 'x':
+                if (isLong) {
+                    formatHex32(va_arg(ap, uint32_t));
+                } else {
+                    formatHex16(va_arg(ap, unsigned int));
+                }
+                break;
+            case 'q':
+                formatFixed(isLong ? va_arg(ap, int32_t) : va_arg(ap, int), decimals);
+                break;
+            case '\0':
+                va_end(ap);
+                return;
+            default:
+                put(&c, 1);
+                break;
+        }
+    }
+    va_end(ap);
+}
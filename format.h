@@ -0,0 +1,46 @@
+/*! \file
+ *  format.h
+ *  xenon-lib-tiny
+ *  Copyright (c) 2020 Martin Clemons
+ *
+ *  Small, fast number formatting for logging, written directly into the
+ *  USART0 transmit ring of `usart_buffered.h` (sleeping while the ring is
+ *  full). Decimal conversion produces two digits per step from a digit-pair
+ *  table in flash, 16-bit values are divided by 100 with a multiply and
+ *  shift instead of a division. Digits are generated into a few bytes on the
+ *  stack and copied to the ring, there is no line buffer.
+ *  When the format is known at compile time, call the individual functions
+ *  (`formatStr_P()`, `formatU16()`, ...) in sequence and no format string is
+ *  parsed at all. `formatPrintf_P()` accepts a small `printf` subset for
+ *  convenience.
+ *
+ *  Compared with `printf_P()`, no format string is parsed from flash by the
+ *  individual functions and `vfprintf()` is not linked. Measure the cost of
+ *  both on target with `formatBench()` of `format_bench.h`.
+ */
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <avr/io.h>
+
+
+/*** Public Variables --------------------------------------------------------*/
+/*! \publicsection */
+
+
+/*** Public Functions --------------------------------------------------------*/
+/*! \publicsection */
+
+void formatChar(char c);
+void formatStr(const char *s);
+void formatStr_P(const char *s);
+void formatU16(uint16_t value);
+void formatI16(int16_t value);
+void formatU32(uint32_t value);
+void formatI32(int32_t value);
+void formatHex8(uint8_t value);
+void formatHex16(uint16_t value);
+void formatHex32(uint32_t value);
+void formatFixed(int32_t value, uint8_t decimals);
+void formatPrintf_P(const char *fmt, ...);
@@ -0,0 +1,54 @@
+/*! \file
+ *  format_bench.c
+ *  xenon-lib-tiny
+ *  Copyright (c) 2020 Martin Clemons
+ */
+#include "format_bench.h"
+#include <stdio.h>
+#include <avr/pgmspace.h>
+#include "cycle_bench.h"
+#include "format.h"
+#include "usart_buffered.h"
+
+
+/*** Private Global Variables ------------------------------------------------*/
+/*! \privatesection */
+
+/* Stream writing to the transmit ring, as used with `printf_P()`. */
+static FILE benchStream = FDEV_SETUP_STREAM(usartPutCharBuffered, NULL, _FDEV_SETUP_WRITE);
+
+
+/*** Public Global Variables -------------------------------------------------*/
+/*! \publicsection */
+
+
+/*** Private Function Prototypes ---------------------------------------------*/
+/*! \privatesection */
+
+
+/*** Interrupt Service Routines (ISR) ----------------------------------------*/
+/*! \privatesection */
+
+
+/*** Private Functions -------------------------------------------------------*/
+/*! \privatesection */
+
+
+/*** Public Functions --------------------------------------------------------*/
+/*! \publicsection */
+
+/*! Measure `formatU16()`, `formatPrintf_P()` and `fprintf_P()` writing
+ * 65535 to the transmit ring.
+ * @param result Receives the cycles taken by each call.
+ */
+void formatBench(struct formatBench_s *result)
+{
+    const uint16_t value = 65535;
+    usartTxWaitDrained();
+    CYCLE_BENCH(result->formatU16, formatU16(value));
+    usartTxWaitDrained();
+    CYCLE_BENCH(result->formatPrintf, formatPrintf_P(PSTR("%u"), value));
+    usartTxWaitDrained();
+    CYCLE_BENCH(result->printf, fprintf_P(&benchStream, PSTR("%u"), value));
+    usartTxWaitDrained();
+}
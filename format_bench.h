@@ -0,0 +1,34 @@
+/*! \file
+ *  format_bench.h
+ *  xenon-lib-tiny
+ *  Copyright (c) 2020 Martin Clemons
+ *
+ *  Compare the formatter of `format.h` with `printf_P()` on target using
+ *  `cycle_bench.h`. USART0 must be configured for buffered transmit and
+ *  `cycleBenchStart()` must have been called. The transmit ring is drained
+ *  before each measurement, so no call blocks and only the conversion and the
+ *  ring writes are counted. The output goes out on the USART.
+ */
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <avr/io.h>
+
+
+/*** Public Variables --------------------------------------------------------*/
+/*! \publicsection */
+
+/*! CPU cycles taken to write the value 65535 in decimal.
+ */
+struct formatBench_s {
+    uint16_t formatU16;         ///< `formatU16(65535)`
+    uint16_t formatPrintf;      ///< `formatPrintf_P(PSTR("%u"), 65535)`
+    uint16_t printf;            ///< `fprintf_P()` with `"%u"` to a stream on `usartPutCharBuffered()`
+};
+
+
+/*** Public Functions --------------------------------------------------------*/
+/*! \publicsection */
+
+void formatBench(struct formatBench_s *result);
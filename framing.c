@@ -0,0 +1,451 @@
+/*! \file
+ *  framing.c
+ *  xenon-lib-tiny
+ *  Copyright (c) 2020 Martin Clemons
+ */
+#include "framing.h"
+#include <stddef.h>
+#include "util/atomic.h"
+#include "util/crc16.h"
+
+#define CRC_INIT                0xFFFF
+#define CRC_LENGTH              2
+
+#define COBS_DELIMITER          0x00
+#define COBS_MAX_CODE           0xFF
+#define COBS_SCAN_STEP          16      // stream bytes scanned per call
+
+#define SLIP_END                0xC0
+#define SLIP_ESC                0xDB
+#define SLIP_ESC_END            0xDC
+#define SLIP_ESC_ESC            0xDD
+
+/* Encoder states. */
+enum {
+    ENC_START = 0,              // COBS: output block code, SLIP: output leading END
+    ENC_DATA,                   // output data bytes and frame delimiter
+    ENC_DONE,                   // frame complete
+};
+
+
+/*** Private Global Variables ------------------------------------------------*/
+/*! \privatesection */
+
+
+/*** Public Global Variables -------------------------------------------------*/
+/*! \publicsection */
+
+
+/*** Private Function Prototypes ---------------------------------------------*/
+/*! \privatesection */
+static inline uint8_t streamByte(const struct framingEncoder_s *enc, uint16_t i);
+static int16_t encodeCobs(struct framingEncoder_s *enc);
+static int16_t encodeSlip(struct framingEncoder_s *enc);
+static void countError(uint16_t *counter);
+static void put(struct framingDecoder_s *dec, uint8_t data);
+static enum framingStatus_e endFrame(struct framingDecoder_s *dec, bool valid);
+static int16_t usartGenerator(void *ctx);
+static void usartSink(uint8_t data, void *ctx);
+
+
+/*** Interrupt Service Routines (ISR) ----------------------------------------*/
+/*! \privatesection */
+
+
+/*** Private Functions -------------------------------------------------------*/
+/*! \privatesection */
+
+/*! Get a byte of the unencoded stream, which is the payload followed by the
+ * CRC high and low byte.
+ * @param enc Pointer to encoder.
+ * @param i Stream index, less than payload length + `CRC_LENGTH`.
+ * @return The stream byte.
+ */
+static inline uint8_t streamByte(const struct framingEncoder_s *enc, uint16_t i)
+{
+    if (i < enc->length) {
+        return enc->payload[i];
+    }
+    return i == enc->length ? enc->crc >> 8 : enc->crc & 0xFF;
+}
+
+/*! Produce the next COBS encoded byte. A block code is the distance to the
+ * next zero, so the encoder scans ahead up to 254 bytes each time a block
+ * starts. The scan covers at most `COBS_SCAN_STEP` bytes per call and returns
+ * `USART_TX_YIELD` until the block end is found, all other calls take
+ * constant time. The stream is treated as if it were followed by a zero
+ * which isn't transmitted, as in the COBS paper.
+ * @param enc Pointer to encoder.
+ * @return The next encoded byte, `USART_TX_YIELD`, or -1 when the frame is
+ * complete.
+ */
+static int16_t encodeCobs(struct framingEncoder_s *enc)
+{
+    const uint16_t total = enc->length + CRC_LENGTH;
+    switch (enc->state) {
+        case ENC_START: {
+            uint16_t limit = enc->pos + COBS_MAX_CODE - 1;
+            if (limit > total) {
+                limit = total;
+            }
+            uint16_t i = enc->blockEnd;
+            for (uint8_t n = COBS_SCAN_STEP; i < limit && streamByte(enc, i) != 0; i++) {
+                if (--n == 0) {
+                    enc->blockEnd = i + 1;
+                    return USART_TX_YIELD;
+                }
+            }
+            enc->blockEnd = i;
+            enc->pending = i - enc->pos + 1;
+            enc->state = ENC_DATA;
+            return enc->pending;
+        }
+        case ENC_DATA:
+            if (enc->pos < enc->blockEnd) {
+                return streamByte(enc, enc->pos++);
+            }
+            if (enc->pending == COBS_MAX_CODE) {
+                // block without zero, next block starts right away
+                enc->state = ENC_START;
+            } else if (enc->pos < total) {
+                // skip the zero which ended this block
+                enc->pos++;
+                enc->blockEnd = enc->pos;
+                enc->state = ENC_START;
+            } else {
+                enc->state = ENC_DONE;
+                return COBS_DELIMITER;
+            }
+            return encodeCobs(enc);
+        default:
+            return -1;
+    }
+}
+
+/*! Produce the next SLIP encoded byte.
+ * @param enc Pointer to encoder.
+ * @return The next encoded byte, or -1 when the frame is complete.
+ */
+static int16_t encodeSlip(struct framingEncoder_s *enc)
+{
+    switch (enc->state) {
+        case ENC_START:
+            enc->state = ENC_DATA;
+            return SLIP_END;
+        case ENC_DATA: {
+            if (enc->pending != 0) {
+                uint8_t data = enc->pending;
+                enc->pending = 0;
+                return data;
+            }
+            if (enc->pos == enc->length + CRC_LENGTH) {
+                enc->state = ENC_DONE;
+                return SLIP_END;
+            }
+            uint8_t data = streamByte(enc, enc->pos++);
+            if (data == SLIP_END) {
+                enc->pending = SLIP_ESC_END;
+                return SLIP_ESC;
+            }
+            if (data == SLIP_ESC) {
+                enc->pending = SLIP_ESC_ESC;
+                return SLIP_ESC;
+            }
+            return data;
+        }
+        default:
+            return -1;
+    }
+}
+
+/*! Increment an error counter, saturating at its maximum value.
+ * @param counter Pointer to the counter.
+ */
+static void countError(uint16_t *counter)
+{
+    if (*counter != UINT16_MAX) {
+        (*counter)++;
+    }
+}
+
+/*! Store a decoded byte in the decoder buffer and update the CRC. If the last
+ * frame hasn't been released or the buffer is full, the current frame is
+ * discarded.
+ * @param dec Pointer to decoder.
+ * @param data The decoded byte.
+ */
+static void put(struct framingDecoder_s *dec, uint8_t data)
+{
+    if (dec->ready) {
+        countError(&dec->errors.dropped);
+        dec->discard = true;
+        return;
+    }
+    if (dec->length >= dec->size) {
+        countError(&dec->errors.overflow);
+        dec->discard = true;
+        return;
+    }
+    dec->buffer[dec->length++] = data;
+    dec->crc = _crc_xmodem_update(dec->crc, data);
+}
+
+/*! Complete a frame on a frame delimiter and reset the decoder for the next
+ * frame. Empty frames (consecutive delimiters) are ignored.
+ * The CRC of a valid frame including its CRC bytes is zero.
+ * @param dec Pointer to decoder.
+ * @param valid Set to `false` if the frame ended in the middle of a COBS
+ * block or SLIP escape sequence.
+ * @return The decoder status.
+ */
+static enum framingStatus_e endFrame(struct framingDecoder_s *dec, bool valid)
+{
+    enum framingStatus_e status = FRAMING_IN_PROGRESS;
+    if (dec->discard) {
+        status = FRAMING_FRAME_ERROR;
+    } else if (dec->length != 0 || !valid) {
+        if (valid && dec->length >= CRC_LENGTH && dec->crc == 0) {
+            dec->frameLength = dec->length - CRC_LENGTH;
+            dec->ready = true;
+            status = FRAMING_FRAME_READY;
+        } else {
+            countError(&dec->errors.invalid);
+            status = FRAMING_FRAME_ERROR;
+        }
+    }
+    dec->length = 0;
+    dec->crc = CRC_INIT;
+    dec->discard = false;
+    dec->flag = false;
+    dec->remaining = 0;
+    return status;
+}
+
+/*! Transmit generator for `framingUsartStart()`.
+ */
+static int16_t usartGenerator(void *ctx)
+{
+    return framingEncodeByte(ctx);
+}
+
+/*! Receive sink for `framingUsartReceive()`.
+ */
+static void usartSink(uint8_t data, void *ctx)
+{
+    framingDecodeByte(ctx, data);
+}
+
+
+/*** Public Functions --------------------------------------------------------*/
+/*! \publicsection */
+
+/*! Initialize an encoder for a frame and compute the payload CRC. Call from
+ * task context, the time taken is proportional to the payload length. The
+ * payload must not be changed until the frame is completely encoded.
+ * @param enc Pointer to encoder.
+ * @param type The framing type.
+ * @param payload Pointer to the payload.
+ * @param length Payload length in bytes.
+ */
+void framingEncoderInit(struct framingEncoder_s *enc, enum framingType_e type,
+                        const uint8_t *payload, uint16_t length)
+{
+    enc->payload = payload;
+    enc->length = length;
+    enc->pos = 0;
+    enc->blockEnd = 0;
+    enc->crc = CRC_INIT;
+    for (uint16_t i = 0; i < length; i++) {
+        enc->crc = _crc_xmodem_update(enc->crc, payload[i]);
+    }
+    enc->state = ENC_START;
+    enc->pending = 0;
+    enc->type = type;
+}
+
+/*! Produce the next encoded byte of a frame, including the CRC and frame
+ * delimiters. May be called from ISR.
+ * @param enc Pointer to encoder.
+ * @return The next encoded byte, `USART_TX_YIELD` if the encoder needs
+ * another call before the next byte, or -1 when the frame is complete.
+ */
+int16_t framingEncodeByte(struct framingEncoder_s *enc)
+{
+    if (enc->type == FRAMING_SLIP) {
+        return encodeSlip(enc);
+    }
+    return encodeCobs(enc);
+}
+
+/*! Initialize a decoder.
+ * @param dec Pointer to decoder.
+ * @param type The framing type.
+ * @param buffer Buffer for decoded frames. Must hold the largest payload plus
+ * two CRC bytes.
+ * @param size Size of `buffer` in bytes.
+ */
+void framingDecoderInit(struct framingDecoder_s *dec, enum framingType_e type,
+                        uint8_t *buffer, uint16_t size)
+{
+    dec->buffer = buffer;
+    dec->size = size;
+    dec->type = type;
+    dec->ready = false;
+    dec->errors = (struct framingErrors_s){ 0 };
+    dec->length = 0;
+    dec->crc = CRC_INIT;
+    dec->flag = false;
+    dec->remaining = 0;
+    // discard any partial frame received before the first delimiter
+    dec->discard = true;
+}
+
+/*! Consume a received byte. May be called from ISR.
+ * Once a valid frame is complete its payload is in the decoder buffer and
+ * `framingFrameReady()` returns `true`. The buffer belongs to the application
+ * until the frame is released with `framingFrameRelease()`, frames received in
+ * the meantime are dropped.
+ * Bytes received before the first frame delimiter are discarded.
+ * @param dec Pointer to decoder.
+ * @param data The received byte.
+ * @return The decoder status.
+ */
+enum framingStatus_e framingDecodeByte(struct framingDecoder_s *dec, uint8_t data)
+{
+    if (dec->type == FRAMING_SLIP) {
+        if (data == SLIP_END) {
+            return endFrame(dec, !dec->flag);
+        }
+        if (dec->discard) {
+            return FRAMING_IN_PROGRESS;
+        }
+        if (dec->flag) {
+            dec->flag = false;
+            if (data == SLIP_ESC_END) {
+                data = SLIP_END;
+            } else if (data == SLIP_ESC_ESC) {
+                data = SLIP_ESC;
+            } else {
+                countError(&dec->errors.invalid);
+                dec->discard = true;
+                return FRAMING_IN_PROGRESS;
+            }
+        } else if (data == SLIP_ESC) {
+            dec->flag = true;
+            return FRAMING_IN_PROGRESS;
+        }
+        put(dec, data);
+        return FRAMING_IN_PROGRESS;
+    }
+    if (data == COBS_DELIMITER) {
+        return endFrame(dec, dec->remaining == 0);
+    }
+    if (dec->discard) {
+        return FRAMING_IN_PROGRESS;
+    }
+    if (dec->remaining == 0) {
+        // block code, output the zero which ended the previous block
+        if (dec->flag) {
+            put(dec, 0);
+        }
+        dec->flag = data != COBS_MAX_CODE;
+        dec->remaining = data - 1;
+    } else {
+        put(dec, data);
+        dec->remaining--;
+    }
+    return FRAMING_IN_PROGRESS;
+}
+
+/*! Check if a decoded frame is ready.
+ * Use as a conditional task check to process frames in a task.
+ * @param param `param->void_ptr` points to the decoder.
+ * @return Returns `true` if a frame is ready.
+ */
+bool framingFrameReady(cbParam_t *param)
+{
+    struct framingDecoder_s *dec = param->void_ptr;
+    return dec->ready;
+}
+
+/*! Get the payload length of the ready frame. The payload starts at the
+ * beginning of the decoder buffer.
+ * @param dec Pointer to decoder.
+ * @return The payload length in bytes, 0 if no frame is ready.
+ */
+uint16_t framingFrameLength(struct framingDecoder_s *dec)
+{
+    return dec->ready ? dec->frameLength : 0;
+}
+
+/*! Release the ready frame, so the decoder buffer can be reused for the next
+ * frame.
+ * @param dec Pointer to decoder.
+ */
+void framingFrameRelease(struct framingDecoder_s *dec)
+{
+    dec->ready = false;
+}
+
+/*! Get the decoder error counters.
+ * @param dec Pointer to decoder.
+ * @param errors Pointer to data structure where counters are copied.
+ * @param clear Set to `true` to reset the counters after copying.
+ */
+void framingGetErrors(struct framingDecoder_s *dec, struct framingErrors_s *errors, bool clear)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        *errors = dec->errors;
+        if (clear) {
+            dec->errors = (struct framingErrors_s){ 0 };
+        }
+    }
+}
+
+/*! Transmit a frame on USART0. The frame is encoded from the DRE ISR as bytes
+ * are transmitted, see `usartTxGeneratorStart()`. Call from task context, the
+ * payload CRC is computed by `framingEncoderInit()` before the transmit
+ * starts.
+ * @param enc Pointer to encoder, must remain valid until the frame is sent
+ * and must not be used by a frame still being sent.
+ * @param type The framing type.
+ * @param payload Pointer to the payload, must not be changed until the frame
+ * is sent.
+ * @param length Payload length in bytes.
+ * @param done Callback called from ISR once the frame is encoded, or `NULL`.
+ * The parameter is the number of encoded bytes.
+ * @return Returns `true` if transmit was started, `false` if a transmit job is
+ * already active.
+ */
+bool framingUsartSend(struct framingEncoder_s *enc, enum framingType_e type,
+                      const uint8_t *payload, uint16_t length, usartJobCb_t *done)
+{
+    framingEncoderInit(enc, type, payload, length);
+    return framingUsartStart(enc, done);
+}
+
+/*! Transmit a frame on USART0 from an encoder initialized with
+ * `framingEncoderInit()`. Unlike `framingUsartSend()` this takes constant
+ * time and may be called with interrupts disabled.
+ * @param enc Pointer to an initialized encoder, must remain valid until the
+ * frame is sent.
+ * @param done Callback called from ISR once the frame is encoded, or `NULL`.
+ * The parameter is the number of encoded bytes.
+ * @return Returns `true` if transmit was started, `false` if a transmit job is
+ * already active.
+ */
+bool framingUsartStart(struct framingEncoder_s *enc, usartJobCb_t *done)
+{
+    return usartTxGeneratorStart(usartGenerator, enc, done);
+}
+
+/*! Decode frames received on USART0. Each received byte is passed to the
+ * decoder from the RXC ISR, see `usartRxSinkStart()`. Stop with
+ * `usartRxSinkStop()`.
+ * Process frames in a conditional task with `framingFrameReady()` as check.
+ * @param dec Pointer to an initialized decoder.
+ */
+void framingUsartReceive(struct framingDecoder_s *dec)
+{
+    usartRxSinkStart(usartSink, dec);
+}
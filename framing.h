@@ -0,0 +1,102 @@
+/*! \file
+ *  framing.h
+ *  xenon-lib-tiny
+ *  Copyright (c) 2020 Martin Clemons
+ *
+ *  Streaming packet framing with COBS (Consistent Overhead Byte Stuffing) or
+ *  SLIP (RFC 1055) and a CRC-16 frame check sequence.
+ *  `framingEncoderInit()` computes the CRC over the whole payload, so it runs
+ *  in task context and takes time proportional to the payload length. After
+ *  that the encoder produces at most one encoded byte per call and splits the
+ *  COBS block scan into short steps (`USART_TX_YIELD`), so each call takes
+ *  bounded time and it can run from the USART DRE interrupt without an
+ *  output buffer. The decoder consumes one
+ *  received byte per call, so it can run from the USART RXC interrupt and
+ *  updates the CRC incrementally as bytes pass through.
+ *  A frame on the wire is the encoded payload followed by the CRC-16/CCITT
+ *  (polynomial 0x1021, initial value 0xFFFF) of the payload, high byte first.
+ *  COBS frames are terminated by a 0x00 delimiter, SLIP frames are enclosed in
+ *  END (0xC0) characters.
+ */
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <avr/io.h>
+#include "task_scheduler.h"
+#include "usart_buffered.h"
+
+
+/*** Public Variables --------------------------------------------------------*/
+/*! \publicsection */
+
+/*! Framing types.
+ */
+enum framingType_e {
+    FRAMING_COBS = 0,           ///< COBS, frames terminated by 0x00
+    FRAMING_SLIP,               ///< SLIP, frames enclosed in 0xC0
+};
+
+/*! Decoder status returned for each decoded byte.
+ */
+enum framingStatus_e {
+    FRAMING_IN_PROGRESS = 0,    ///< Byte consumed, no frame end
+    FRAMING_FRAME_READY,        ///< A valid frame was received and is ready
+    FRAMING_FRAME_ERROR,        ///< A frame ended but was invalid or discarded
+};
+
+/*! Encoder state, allocated by the caller. Members are private.
+ */
+struct framingEncoder_s {
+    const uint8_t *payload;     ///< Payload to encode
+    uint16_t length;            ///< Payload length in bytes
+    uint16_t pos;               ///< Next byte of payload and CRC to output
+    uint16_t blockEnd;          ///< COBS: end of the current block, scan position while it starts
+    uint16_t crc;               ///< CRC of the payload
+    uint8_t state;              ///< Encoder state
+    uint8_t pending;            ///< COBS: block code, SLIP: escaped byte to output
+    enum framingType_e type;    ///< Framing type
+};
+
+/*! Decoder error counters. Counters saturate at their maximum value.
+ */
+struct framingErrors_s {
+    uint16_t invalid;           ///< Frames with a CRC or encoding error
+    uint16_t overflow;          ///< Frames longer than the decoder buffer
+    uint16_t dropped;           ///< Frames dropped because the last frame wasn't released
+};
+
+/*! Decoder state, allocated by the caller. Members are private.
+ */
+struct framingDecoder_s {
+    uint8_t *buffer;            ///< Buffer for the decoded payload and CRC
+    uint16_t size;              ///< Size of `buffer` in bytes
+    uint16_t length;            ///< Number of bytes decoded into `buffer`
+    uint16_t crc;               ///< Running CRC of the decoded bytes
+    uint16_t frameLength;       ///< Payload length of the ready frame
+    volatile bool ready;        ///< Set while a frame is ready
+    bool discard;               ///< Discard bytes until the next frame delimiter
+    bool flag;                  ///< COBS: zero pending, SLIP: escape pending
+    uint8_t remaining;          ///< COBS: remaining data bytes in block
+    enum framingType_e type;    ///< Framing type
+    struct framingErrors_s errors;  ///< Error counters
+};
+
+
+/*** Public Functions --------------------------------------------------------*/
+/*! \publicsection */
+
+void framingEncoderInit(struct framingEncoder_s *enc, enum framingType_e type,
+                        const uint8_t *payload, uint16_t length);
+int16_t framingEncodeByte(struct framingEncoder_s *enc);
+void framingDecoderInit(struct framingDecoder_s *dec, enum framingType_e type,
+                        uint8_t *buffer, uint16_t size);
+enum framingStatus_e framingDecodeByte(struct framingDecoder_s *dec, uint8_t data);
+bool framingFrameReady(cbParam_t *param);
+uint16_t framingFrameLength(struct framingDecoder_s *dec);
+void framingFrameRelease(struct framingDecoder_s *dec);
+void framingGetErrors(struct framingDecoder_s *dec, struct framingErrors_s *errors, bool clear);
+bool framingUsartSend(struct framingEncoder_s *enc, enum framingType_e type,
+                      const uint8_t *payload, uint16_t length, usartJobCb_t *done);
+bool framingUsartStart(struct framingEncoder_s *enc, usartJobCb_t *done);
+void framingUsartReceive(struct framingDecoder_s *dec);
@@ -0,0 +1,505 @@
+/*! \file
+ *  log_store.c
+ *  xenon-lib-tiny
+ *  Copyright (c) 2020 Martin Clemons
+ */
+#include "log_store.h"
+#include <stddef.h>
+#include <string.h>
+#ifdef __AVR__
+#include "util/crc16.h"
+#endif
+
+#define MAGIC_0         0x4C    // 'L'
+#define MAGIC_1         0x47    // 'G'
+#define LENGTH_ERASED   0xFF
+
+// Flash bytes read at once when checking a record CRC
+#define CRC_CHUNK       32
+
+
+/*** Private Global Variables ------------------------------------------------*/
+/*! \privatesection */
+
+
+/*** Public Global Variables -------------------------------------------------*/
+/*! \publicsection */
+
+
+/*** Private Function Prototypes ---------------------------------------------*/
+/*! \privatesection */
+static inline uint16_t crcUpdate(uint16_t crc, uint8_t data);
+static uint16_t crcBuffer(uint16_t crc, const uint8_t *data, uint16_t length);
+static void putU32(uint8_t *p, uint32_t value);
+static uint32_t getU32(const uint8_t *p);
+static inline bool busy(const struct logStore_s *store);
+static uint32_t nextSector(const struct logStore_s *store, uint32_t sector);
+static bool headerValid(const uint8_t *h);
+static bool readHeader(struct logStore_s *store, uint32_t sector, uint32_t *sectorSeq,
+                       uint32_t *recordSeq);
+static bool recordValid(const struct logStore_s *store, uint32_t address, uint8_t length);
+static void scanSector(struct logStore_s *store, uint32_t recordSeq);
+static void stageBytes(struct logStore_s *store, uint16_t offset, const uint8_t *data,
+                       uint16_t length);
+static bool commitBytes(struct logStore_s *store, uint16_t length);
+static bool programPage(struct logStore_s *store);
+static enum logStoreStatus_e openNextSector(struct logStore_s *store);
+
+
+/*** Interrupt Service Routines (ISR) ----------------------------------------*/
+/*! \privatesection */
+
+
+/*** Private Functions -------------------------------------------------------*/
+/*! \privatesection */
+
+/*! CRC-16/CCITT (polynomial 0x1021), `_crc_xmodem_update()` on AVR.
+ */
+static inline uint16_t crcUpdate(uint16_t crc, uint8_t data)
+{
+#ifdef __AVR__
+    return _crc_xmodem_update(crc, data);
+#else
+    crc ^= (uint16_t)data << 8;
+    for (uint8_t i = 0; i < 8; i++) {
+        crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+#endif
+}
+
+static uint16_t crcBuffer(uint16_t crc, const uint8_t *data, uint16_t length)
+{
+    while (length-- > 0) {
+        crc = crcUpdate(crc, *data++);
+    }
+    return crc;
+}
+
+static void putU32(uint8_t *p, uint32_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+static uint32_t getU32(const uint8_t *p)
+{
+    return (uint32_t)p[3] << 24 | (uint32_t)p[2] << 16 | (uint32_t)p[1] << 8 | p[0];
+}
+
+static inline bool busy(const struct logStore_s *store)
+{
+    return store->flash->busy(store->flash->ctx);
+}
+
+/*! The sector following `sector` in the ring.
+ */
+static uint32_t nextSector(const struct logStore_s *store, uint32_t sector)
+{
+    sector += LOG_STORE_SECTOR_SIZE;
+    return sector >= store->flash->size ? 0 : sector;
+}
+
+static bool headerValid(const uint8_t *h)
+{
+    return h[0] == MAGIC_0 && h[1] == MAGIC_1 &&
+            crcBuffer(0xFFFF, h, LOG_STORE_HEADER_SIZE) == 0;
+}
+
+/*! Read and check a sector header.
+ * @return Returns `true` if the header is valid, erased and torn headers are
+ * invalid.
+ */
+static bool readHeader(struct logStore_s *store, uint32_t sector, uint32_t *sectorSeq,
+                       uint32_t *recordSeq)
+{
+    uint8_t h[LOG_STORE_HEADER_SIZE];
+    store->flash->read(store->flash->ctx, sector, h, sizeof(h));
+    store->headerReads++;
+    if (!headerValid(h)) {
+        return false;
+    }
+    *sectorSeq = getU32(&h[2]);
+    *recordSeq = getU32(&h[6]);
+    return true;
+}
+
+/*! Check the CRC of the record at `address`, reading it in chunks.
+ */
+static bool recordValid(const struct logStore_s *store, uint32_t address, uint8_t length)
+{
+    uint8_t buf[CRC_CHUNK];
+    uint16_t remaining = length + LOG_STORE_RECORD_OVERHEAD;
+    uint16_t crc = 0xFFFF;
+    while (remaining > 0) {
+        uint16_t n = remaining < sizeof(buf) ? remaining : sizeof(buf);
+        store->flash->read(store->flash->ctx, address, buf, n);
+        crc = crcBuffer(crc, buf, n);
+        address += n;
+        remaining -= n;
+    }
+    return crc == 0;
+}
+
+/*! Find the write position and next sequence number in the newest sector.
+ * Torn records are skipped, a record with an invalid length closes the
+ * sector.
+ * @param recordSeq The first record sequence number from the sector header.
+ */
+static void scanSector(struct logStore_s *store, uint32_t recordSeq)
+{
+    const uint32_t end = store->sector + LOG_STORE_SECTOR_SIZE;
+    uint32_t address = store->sector + LOG_STORE_HEADER_SIZE;
+    store->seq = recordSeq;
+    while (address + LOG_STORE_RECORD_OVERHEAD <= end) {
+        uint8_t h[5];
+        store->flash->read(store->flash->ctx, address, h, sizeof(h));
+        if (h[0] == LENGTH_ERASED) {
+            break;
+        }
+        if (h[0] > store->recordMax || address + h[0] + LOG_STORE_RECORD_OVERHEAD > end) {
+            address = end;
+            break;
+        }
+        if (recordValid(store, address, h[0])) {
+            store->seq = getU32(&h[1]) + 1;
+        }
+        address += h[0] + LOG_STORE_RECORD_OVERHEAD;
+    }
+    if (end - address < LOG_STORE_RECORD_OVERHEAD) {
+        address = end;
+    }
+    // programmed bytes before the write position are never programmed again
+    store->pageAddress = address & ~(uint32_t)(store->flash->pageSize - 1);
+    store->fill = address - store->pageAddress;
+    store->flushed = store->fill;
+}
+
+/*! Copy bytes into the page buffer, `offset` bytes past the write position.
+ * Bytes past the end of the page go to the start of the other buffer. The
+ * write position is only moved by `commitBytes()`.
+ */
+static void stageBytes(struct logStore_s *store, uint16_t offset, const uint8_t *data,
+                       uint16_t length)
+{
+    const uint16_t pageSize = store->flash->pageSize;
+    uint16_t pos = store->fill + offset;
+    if (pos < pageSize) {
+        uint16_t n = pageSize - pos;
+        if (n > length) {
+            n = length;
+        }
+        memcpy(store->page[store->cur] + pos, data, n);
+        data += n;
+        length -= n;
+        pos += n;
+    }
+    memcpy(store->page[store->cur ^ 1] + pos - pageSize, data, length);
+}
+
+/*! Move the write position past staged bytes. A full page is programmed and
+ * handed over to the flash, filling continues in the other buffer. The
+ * caller makes sure the flash is not busy if a page is filled.
+ * @return Returns `false` if programming failed to start, the write position
+ * is unchanged.
+ */
+static bool commitBytes(struct logStore_s *store, uint16_t length)
+{
+    const struct logStoreFlash_s *flash = store->flash;
+    uint16_t fill = store->fill + length;
+    if (fill < flash->pageSize) {
+        store->fill = fill;
+        return true;
+    }
+    if (!flash->program(flash->ctx, store->pageAddress + store->flushed,
+                        store->page[store->cur] + store->flushed,
+                        flash->pageSize - store->flushed)) {
+        return false;
+    }
+    store->cur ^= 1;
+    store->pageAddress += flash->pageSize;
+    store->fill = fill - flash->pageSize;
+    store->flushed = 0;
+    return true;
+}
+
+/*! Program the unprogrammed part of the current page buffer, which is never
+ * full.
+ * @return Returns `false` if programming failed to start, nothing is marked
+ * as programmed.
+ */
+static bool programPage(struct logStore_s *store)
+{
+    const struct logStoreFlash_s *flash = store->flash;
+    if (store->fill > store->flushed &&
+            !flash->program(flash->ctx, store->pageAddress + store->flushed,
+                            store->page[store->cur] + store->flushed,
+                            store->fill - store->flushed)) {
+        return false;
+    }
+    store->flushed = store->fill;
+    return true;
+}
+
+/*! Close the newest sector and open the next one in the ring: program the
+ * rest of the current page, erase the next sector and put its header into
+ * the page buffer. Takes several calls while the flash is busy.
+ */
+static enum logStoreStatus_e openNextSector(struct logStore_s *store)
+{
+    const struct logStoreFlash_s *flash = store->flash;
+    if (busy(store)) {
+        return LOG_STORE_BUSY;
+    }
+    uint32_t next = store->sector == LOG_STORE_NO_SECTOR ? 0 : nextSector(store, store->sector);
+    if (!store->erasing) {
+        if (store->fill > store->flushed) {
+            return programPage(store) ? LOG_STORE_BUSY : LOG_STORE_ERROR;
+        }
+        if (!flash->erase(flash->ctx, next)) {
+            return LOG_STORE_ERROR;
+        }
+        store->erasing = true;
+        return LOG_STORE_BUSY;
+    }
+    // erase complete, the oldest records are gone
+    store->erasing = false;
+    if (store->sector == LOG_STORE_NO_SECTOR) {
+        store->oldest = next;
+    } else if (next == store->oldest) {
+        store->oldest = nextSector(store, next);
+    }
+    store->sector = next;
+    store->sectorSeq++;
+    store->pageAddress = next;
+    store->fill = 0;
+    store->flushed = 0;
+    uint8_t h[LOG_STORE_HEADER_SIZE];
+    h[0] = MAGIC_0;
+    h[1] = MAGIC_1;
+    putU32(&h[2], store->sectorSeq);
+    putU32(&h[6], store->seq);
+    uint16_t crc = crcBuffer(0xFFFF, h, LOG_STORE_HEADER_SIZE - 2);
+    h[10] = crc >> 8;
+    h[11] = crc;
+    // the header doesn't fill a page, so nothing is programmed
+    stageBytes(store, 0, h, sizeof(h));
+    commitBytes(store, sizeof(h));
+    return LOG_STORE_OK;
+}
+
+
+/*** Public Functions --------------------------------------------------------*/
+/*! \publicsection */
+
+/*! Mount the log: find the newest sector with a binary search over the
+ * sector headers, then the write position in it. An erased flash mounts as
+ * an empty log.
+ * @param store Pointer to the log store.
+ * @param flash Pointer to the flash functions and geometry, must stay valid.
+ * @param pages Buffer of two pages (`2 * pageSize` bytes).
+ * @return `LOG_STORE_OK`, `LOG_STORE_BUSY` if the flash is busy or
+ * `LOG_STORE_ERROR` if the geometry is invalid (fewer than two sectors,
+ * page size not a power of two from 16 to 256).
+ */
+enum logStoreStatus_e logStoreMount(struct logStore_s *store, const struct logStoreFlash_s *flash,
+                                    uint8_t *pages)
+{
+    const uint32_t sectors = flash->size / LOG_STORE_SECTOR_SIZE;
+    if (sectors < 2 || flash->pageSize < 16 || flash->pageSize > 256 ||
+            (flash->pageSize & (flash->pageSize - 1)) != 0) {
+        return LOG_STORE_ERROR;
+    }
+    memset(store, 0, sizeof(*store));
+    store->flash = flash;
+    store->page[0] = pages;
+    store->page[1] = pages + flash->pageSize;
+    // a record fits in two pages, so appending programs at most one page
+    store->recordMax = flash->pageSize - LOG_STORE_RECORD_OVERHEAD;
+    store->sector = LOG_STORE_NO_SECTOR;
+    if (busy(store)) {
+        return LOG_STORE_BUSY;
+    }
+    uint32_t seq0, recordSeq, seq, rs;
+    uint32_t newest;
+    if (readHeader(store, 0, &seq0, &recordSeq)) {
+        // sectors 0 .. newest are valid with sequence >= seq0, all after are
+        // erased, torn or older: find the last sector of the first run
+        uint32_t lo = 0, hi = sectors;
+        while (hi - lo > 1) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (readHeader(store, mid * LOG_STORE_SECTOR_SIZE, &seq, &rs) &&
+                    (int32_t)(seq - seq0) >= 0) {
+                lo = mid;
+            } else {
+                hi = mid;
+            }
+        }
+        newest = lo;
+    } else if (readHeader(store, (sectors - 1) * LOG_STORE_SECTOR_SIZE, &seq0, &recordSeq)) {
+        // reset while sector 0 was being opened after a wrap
+        newest = sectors - 1;
+    } else {
+        return LOG_STORE_OK;
+    }
+    // re-read the newest header for its sequence numbers
+    readHeader(store, newest * LOG_STORE_SECTOR_SIZE, &store->sectorSeq, &recordSeq);
+    store->sector = newest * LOG_STORE_SECTOR_SIZE;
+    scanSector(store, recordSeq);
+    // the oldest sector follows the newest, possibly after one torn sector,
+    // sector 0 if the ring has not wrapped yet
+    store->oldest = 0;
+    uint32_t s = nextSector(store, store->sector);
+    for (uint8_t i = 0; i < 2 && s != store->sector; i++) {
+        if (readHeader(store, s, &seq, &rs)) {
+            store->oldest = s;
+            break;
+        }
+        s = nextSector(store, s);
+    }
+    return LOG_STORE_OK;
+}
+
+/*! Append a record. The record is copied to the page buffer, full pages are
+ * programmed in the background.
+ * @param store Pointer to the log store.
+ * @param data Record data.
+ * @param length Record length, at most `logStoreRecordMax()`, may be 0.
+ * @return `LOG_STORE_OK` if the record was added, `LOG_STORE_BUSY` if the
+ * flash is busy (nothing added, call again), `LOG_STORE_TOO_LONG` or
+ * `LOG_STORE_ERROR` if a program or erase failed to start (nothing added,
+ * may be retried).
+ */
+enum logStoreStatus_e logStoreAppend(struct logStore_s *store, const void *data, uint8_t length)
+{
+    if (length > store->recordMax) {
+        return LOG_STORE_TOO_LONG;
+    }
+    const uint16_t size = length + LOG_STORE_RECORD_OVERHEAD;
+    if (store->sector == LOG_STORE_NO_SECTOR || store->erasing ||
+            store->pageAddress + store->fill + size > store->sector + LOG_STORE_SECTOR_SIZE) {
+        enum logStoreStatus_e status = openNextSector(store);
+        if (status != LOG_STORE_OK) {
+            return status;
+        }
+    }
+    // filling the page programs it, which needs the flash
+    if (store->fill + size >= store->flash->pageSize && busy(store)) {
+        return LOG_STORE_BUSY;
+    }
+    uint8_t h[5];
+    h[0] = length;
+    putU32(&h[1], store->seq);
+    uint16_t crc = crcBuffer(0xFFFF, h, sizeof(h));
+    crc = crcBuffer(crc, data, length);
+    uint8_t c[2] = { crc >> 8, crc };
+    stageBytes(store, 0, h, sizeof(h));
+    stageBytes(store, sizeof(h), data, length);
+    stageBytes(store, sizeof(h) + length, c, sizeof(c));
+    if (!commitBytes(store, size)) {
+        return LOG_STORE_ERROR;
+    }
+    store->seq++;
+    return LOG_STORE_OK;
+}
+
+/*! Program the records collected in the page buffer. The page is programmed
+ * again when more records are added (NOR flash permits programming the
+ * erased part of a page).
+ * @param store Pointer to the log store.
+ * @return `LOG_STORE_OK` if programming started or nothing was pending,
+ * `LOG_STORE_BUSY` if the flash is busy, `LOG_STORE_ERROR` if programming
+ * failed to start (the records stay pending, may be retried).
+ */
+enum logStoreStatus_e logStoreFlush(struct logStore_s *store)
+{
+    if (store->fill == store->flushed) {
+        return LOG_STORE_OK;
+    }
+    if (busy(store)) {
+        return LOG_STORE_BUSY;
+    }
+    return programPage(store) ? LOG_STORE_OK : LOG_STORE_ERROR;
+}
+
+/*! Get the largest record length.
+ */
+uint8_t logStoreRecordMax(const struct logStore_s *store)
+{
+    return store->recordMax;
+}
+
+/*! Get the sequence number of the next record appended.
+ */
+uint32_t logStoreNextSequence(const struct logStore_s *store)
+{
+    return store->seq;
+}
+
+/*! Set a cursor to the oldest record.
+ */
+void logStoreRewind(const struct logStore_s *store, struct logStoreCursor_s *cursor)
+{
+    cursor->sector = store->oldest;
+    cursor->address = store->oldest + LOG_STORE_HEADER_SIZE;
+}
+
+/*! Read the record at the cursor and advance the cursor. Records with a CRC
+ * error are skipped. Records still in the page buffer are not returned until
+ * they are flushed.
+ * @param store Pointer to the log store.
+ * @param cursor Pointer to the cursor, see `logStoreRewind()`.
+ * @param buf Buffer of at least `logStoreRecordMax()` bytes.
+ * @param length Pointer where the record length is stored.
+ * @param seq Pointer where the record sequence number is stored.
+ * @return `LOG_STORE_OK`, `LOG_STORE_END` after the newest record or
+ * `LOG_STORE_BUSY` if the flash is busy (cursor not changed).
+ */
+enum logStoreStatus_e logStoreRead(const struct logStore_s *store, struct logStoreCursor_s *cursor,
+                                   uint8_t *buf, uint8_t *length, uint32_t *seq)
+{
+    const struct logStoreFlash_s *flash = store->flash;
+    if (store->sector == LOG_STORE_NO_SECTOR) {
+        return LOG_STORE_END;
+    }
+    if (busy(store)) {
+        return LOG_STORE_BUSY;
+    }
+    for (;;) {
+        const bool newest = cursor->sector == store->sector;
+        const uint32_t end = newest ? store->pageAddress + store->flushed :
+                cursor->sector + LOG_STORE_SECTOR_SIZE;
+        uint8_t h[5];
+        if (cursor->address + LOG_STORE_RECORD_OVERHEAD <= end) {
+            flash->read(flash->ctx, cursor->address, h, sizeof(h));
+        } else {
+            h[0] = LENGTH_ERASED;
+        }
+        const uint32_t next = cursor->address + h[0] + LOG_STORE_RECORD_OVERHEAD;
+        if (h[0] <= store->recordMax && next <= end) {
+            flash->read(flash->ctx, cursor->address + sizeof(h), buf, h[0]);
+            uint8_t c[2];
+            flash->read(flash->ctx, cursor->address + sizeof(h) + h[0], c, sizeof(c));
+            cursor->address = next;
+            uint16_t crc = crcBuffer(crcBuffer(crcBuffer(0xFFFF, h, sizeof(h)), buf, h[0]), c, 2);
+            if (crc == 0) {
+                *length = h[0];
+                *seq = getU32(&h[1]);
+                return LOG_STORE_OK;
+            }
+            continue;
+        }
+        // end of the sector, continue with the next valid one
+        if (newest) {
+            return LOG_STORE_END;
+        }
+        uint8_t sh[LOG_STORE_HEADER_SIZE];
+        do {
+            cursor->sector = nextSector(store, cursor->sector);
+            flash->read(flash->ctx, cursor->sector, sh, sizeof(sh));
+        } while (cursor->sector != store->sector && !headerValid(sh));
+        cursor->address = cursor->sector + LOG_STORE_HEADER_SIZE;
+    }
+}
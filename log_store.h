@@ -0,0 +1,127 @@
+/*! \file
+ *  log_store.h
+ *  xenon-lib-tiny
+ *  Copyright (c) 2020 Martin Clemons
+ *
+ *  Append-only record log on NOR flash. The flash is used as a ring of 4KB
+ *  sectors, each starting with a header holding a sector sequence number.
+ *  Records are appended to the newest sector; when it is full the next
+ *  sector in the ring is erased (dropping the oldest records) and opened with
+ *  the next sequence number, so every sector is erased once per pass over
+ *  the flash (wear leveling by rotation).
+ *
+ *  Each record carries a 32-bit sequence number and a CRC-16, so a record
+ *  torn by a reset is detected and skipped. Records are collected in a RAM
+ *  page buffer and programmed a page at a time; `logStoreFlush()` programs a
+ *  partially filled page.
+ *
+ *  Mounting does not scan the flash. Sector sequence numbers increase along
+ *  the ring up to the newest sector and drop after it, so the newest sector
+ *  is found with a binary search over the sector headers, about 15 header
+ *  reads for 16MB instead of 4096, followed by a scan of the newest sector
+ *  for the write position.
+ *
+ *  The flash is accessed through `logStoreFlash_s`, see `log_store_spi.c` for
+ *  SPI NOR flash (`spi_flash.h`) and `log_store_host.c` for a file backed
+ *  flash model used for benchmarks on the host. Program and erase may run in
+ *  the background: functions which need the flash while it is busy return
+ *  `LOG_STORE_BUSY` without side effects and are retried by the caller, e.g.
+ *  from a scheduler task. This file does not depend on AVR headers.
+ *
+ *  Layout, all multi-byte values little endian except the CRC:
+ *      sector header:  magic (2), sector sequence (4), first record sequence (4), CRC (2)
+ *      record:         length (1), sequence (4), data (length), CRC (2)
+ *  The CRC is CRC-16/CCITT (`_crc_xmodem_update()`), high byte first.
+ */
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+struct spiFlash_s;
+
+
+/*** Public Variables --------------------------------------------------------*/
+/*! \publicsection */
+
+#define LOG_STORE_SECTOR_SIZE       4096UL      ///< Erase unit
+#define LOG_STORE_HEADER_SIZE       12          ///< Sector header size
+#define LOG_STORE_RECORD_OVERHEAD   7           ///< Record bytes besides the data
+#define LOG_STORE_NO_SECTOR         0xFFFFFFFFUL
+
+/*! Blocking read, only called while the flash is not busy.
+ */
+typedef void (logStoreRead_t)(void *ctx, uint32_t address, uint8_t *buf, uint16_t length);
+/*! Start programming within one page, `data` must stay valid while busy.
+ * Returns `false` if the program could not be started.
+ */
+typedef bool (logStoreProgram_t)(void *ctx, uint32_t address, const uint8_t *data, uint16_t length);
+/*! Start erasing the sector at `address`. Returns `false` if the erase could
+ * not be started.
+ */
+typedef bool (logStoreErase_t)(void *ctx, uint32_t address);
+/*! Returns `true` while a program or erase is in progress.
+ */
+typedef bool (logStoreBusy_t)(void *ctx);
+
+/*! Flash access functions and geometry.
+ */
+struct logStoreFlash_s {
+    logStoreRead_t *read;               ///< Read function
+    logStoreProgram_t *program;         ///< Page program function
+    logStoreErase_t *erase;             ///< Sector erase function
+    logStoreBusy_t *busy;               ///< Busy check function
+    void *ctx;                          ///< Context passed to the functions
+    uint32_t size;                      ///< Bytes used for the log, a multiple of the sector size
+    uint16_t pageSize;                  ///< Program page size, a power of two from 16 to 256
+};
+
+/*! Log store function status.
+ */
+enum logStoreStatus_e {
+    LOG_STORE_OK        = 0,            ///< Success
+    LOG_STORE_BUSY,                     ///< Flash busy, call again later
+    LOG_STORE_END,                      ///< No more records
+    LOG_STORE_TOO_LONG,                 ///< Record longer than `logStoreRecordMax()`
+    LOG_STORE_ERROR,                    ///< Invalid flash geometry or program/erase failed to start
+};
+
+/*! Log store state, allocated by the caller. All members are private.
+ */
+struct logStore_s {
+    const struct logStoreFlash_s *flash;
+    uint8_t *page[2];                   // page buffers, one may be programming
+    uint8_t cur;                        // page buffer being filled
+    uint8_t recordMax;
+    bool erasing;                       // erase of the next sector in progress
+    uint16_t fill;                      // bytes in the current page buffer
+    uint16_t flushed;                   // bytes of the current page already programmed
+    uint32_t pageAddress;               // flash address of the current page
+    uint32_t sector;                    // newest sector, `LOG_STORE_NO_SECTOR` if empty
+    uint32_t oldest;                    // oldest sector
+    uint32_t sectorSeq;                 // sequence number of the newest sector
+    uint32_t seq;                       // sequence number of the next record
+    uint16_t headerReads;               // sector headers read by the last mount
+};
+
+/*! Read position, see `logStoreRewind()`. All members are private.
+ */
+struct logStoreCursor_s {
+    uint32_t sector;
+    uint32_t address;
+};
+
+
+/*** Public Functions --------------------------------------------------------*/
+/*! \publicsection */
+
+enum logStoreStatus_e logStoreMount(struct logStore_s *store, const struct logStoreFlash_s *flash,
+                                    uint8_t *pages);
+enum logStoreStatus_e logStoreAppend(struct logStore_s *store, const void *data, uint8_t length);
+enum logStoreStatus_e logStoreFlush(struct logStore_s *store);
+uint8_t logStoreRecordMax(const struct logStore_s *store);
+uint32_t logStoreNextSequence(const struct logStore_s *store);
+void logStoreRewind(const struct logStore_s *store, struct logStoreCursor_s *cursor);
+enum logStoreStatus_e logStoreRead(const struct logStore_s *store, struct logStoreCursor_s *cursor,
+                                   uint8_t *buf, uint8_t *length, uint32_t *seq);
+void logStoreSpiFlash(struct logStoreFlash_s *ops, struct spiFlash_s *flash);
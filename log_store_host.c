@@ -0,0 +1,362 @@
+/*! \file
+ *  log_store_host.c
+ *  xenon-lib-tiny
+ *  Copyright (c) 2020 Martin Clemons
+ *
+ *  Host program which exercises the log store (see `log_store.h`) on a NOR
+ *  flash model and compares the flash reads of a mount against a linear scan
+ *  of all sector headers:
+ *
+ *      cc -O2 -o log_store_host log_store_host.c log_store.c
+ *      log_store_host [flash size in KB] [records] [image file]
+ *
+ *  The model behaves like NOR flash: programming only clears bits, erase sets
+ *  a sector to 0xFF and both stay busy for a few polls. The flash image is
+ *  loaded from and saved to the image file if one is given, so the log can
+ *  be remounted across runs. Records are written until the ring has wrapped,
+ *  then the log is remounted, iterated and checked, a torn record is
+ *  simulated, and finally programs are made to fail, which must leave the
+ *  record for a retry.
+ *  This file is not part of the target build.
+ */
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "log_store.h"
+
+#define PAGE_SIZE   256
+#define BUSY_POLLS  3
+
+
+/*** Private Global Variables ------------------------------------------------*/
+/*! \privatesection */
+
+static uint8_t *image;
+static uint32_t imageSize;
+static uint8_t busyPolls;
+static bool failProgram;                // next program fails to start
+static unsigned long reads, readBytes, programs, erases;
+
+
+/*** Private Function Prototypes ---------------------------------------------*/
+/*! \privatesection */
+static logStoreRead_t modelRead;
+static logStoreProgram_t modelProgram;
+static logStoreErase_t modelErase;
+static logStoreBusy_t modelBusy;
+static void recordData(uint32_t seq, uint8_t *buf, uint8_t *length, uint8_t max);
+static void append(struct logStore_s *store, uint32_t seq, uint8_t max);
+static uint32_t linearScan(uint32_t *headerReads);
+static bool check(struct logStore_s *store, uint32_t nextSeq);
+static double now(void);
+
+
+/*** Private Functions -------------------------------------------------------*/
+/*! \privatesection */
+
+static void modelRead(void *ctx, uint32_t address, uint8_t *buf, uint16_t length)
+{
+    if (busyPolls > 0 || address + length > imageSize) {
+        fprintf(stderr, "read while busy or out of range at 0x%06" PRIx32 "\n", address);
+        exit(1);
+    }
+    memcpy(buf, image + address, length);
+    reads++;
+    readBytes += length;
+}
+
+static bool modelProgram(void *ctx, uint32_t address, const uint8_t *data, uint16_t length)
+{
+    if (busyPolls > 0 || address % PAGE_SIZE + length > PAGE_SIZE) {
+        return false;
+    }
+    if (failProgram) {
+        failProgram = false;
+        return false;
+    }
+    for (uint16_t i = 0; i < length; i++) {
+        image[address + i] &= data[i];
+    }
+    programs++;
+    busyPolls = BUSY_POLLS;
+    return true;
+}
+
+static bool modelErase(void *ctx, uint32_t address)
+{
+    if (busyPolls > 0) {
+        return false;
+    }
+    memset(image + (address & ~(LOG_STORE_SECTOR_SIZE - 1)), 0xFF, LOG_STORE_SECTOR_SIZE);
+    erases++;
+    busyPolls = BUSY_POLLS;
+    return true;
+}
+
+static bool modelBusy(void *ctx)
+{
+    if (busyPolls > 0) {
+        busyPolls--;
+        return true;
+    }
+    return false;
+}
+
+/*! Record contents derived from the sequence number, so records can be
+ * checked when read back.
+ */
+static void recordData(uint32_t seq, uint8_t *buf, uint8_t *length, uint8_t max)
+{
+    *length = seq * 7 % (max + 1);
+    for (uint8_t i = 0; i < *length; i++) {
+        buf[i] = seq + i;
+    }
+}
+
+static void append(struct logStore_s *store, uint32_t seq, uint8_t max)
+{
+    uint8_t buf[256], length;
+    recordData(seq, buf, &length, max);
+    enum logStoreStatus_e status;
+    while ((status = logStoreAppend(store, buf, length)) == LOG_STORE_BUSY) {
+        ;
+    }
+    if (status != LOG_STORE_OK) {
+        fprintf(stderr, "append failed: %d\n", status);
+        exit(1);
+    }
+}
+
+/*! Find the newest sector by reading every sector header, for comparison.
+ */
+static uint32_t linearScan(uint32_t *headerReads)
+{
+    uint32_t newest = LOG_STORE_NO_SECTOR, newestSeq = 0;
+    *headerReads = 0;
+    for (uint32_t s = 0; s < imageSize; s += LOG_STORE_SECTOR_SIZE) {
+        uint8_t h[LOG_STORE_HEADER_SIZE];
+        modelRead(NULL, s, h, sizeof(h));
+        (*headerReads)++;
+        if (h[0] != 0x4C || h[1] != 0x47) {
+            continue;
+        }
+        uint32_t seq = (uint32_t)h[5] << 24 | (uint32_t)h[4] << 16 | (uint32_t)h[3] << 8 | h[2];
+        if (newest == LOG_STORE_NO_SECTOR || (int32_t)(seq - newestSeq) > 0) {
+            newest = s;
+            newestSeq = seq;
+        }
+    }
+    return newest;
+}
+
+/*! Iterate the log and check that records are consecutive, intact and end
+ * just before `nextSeq`.
+ */
+static bool check(struct logStore_s *store, uint32_t nextSeq)
+{
+    struct logStoreCursor_s cursor;
+    uint8_t buf[256], expect[256], length, expectLength;
+    uint32_t seq, count = 0, first = 0, last = 0;
+    logStoreRewind(store, &cursor);
+    enum logStoreStatus_e status;
+    while ((status = logStoreRead(store, &cursor, buf, &length, &seq)) != LOG_STORE_END) {
+        if (status == LOG_STORE_BUSY) {
+            continue;
+        }
+        recordData(seq, expect, &expectLength, logStoreRecordMax(store));
+        if (length != expectLength || memcmp(buf, expect, length) != 0) {
+            fprintf(stderr, "record %" PRIu32 " corrupt\n", seq);
+            return false;
+        }
+        if (count > 0 && seq != last + 1) {
+            fprintf(stderr, "record %" PRIu32 " follows %" PRIu32 "\n", seq, last);
+            return false;
+        }
+        if (count == 0) {
+            first = seq;
+        }
+        last = seq;
+        count++;
+    }
+    printf("  %" PRIu32 " records %" PRIu32 "..%" PRIu32 ", next %" PRIu32 "\n",
+           count, first, last, logStoreNextSequence(store));
+    if (count > 0 && last + 1 != nextSeq) {
+        fprintf(stderr, "last record %" PRIu32 ", expected %" PRIu32 "\n", last, nextSeq - 1);
+        return false;
+    }
+    return true;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/*** Public Functions --------------------------------------------------------*/
+/*! \publicsection */
+
+int main(int argc, char *argv[])
+{
+    imageSize = (argc > 1 ? strtoul(argv[1], NULL, 0) : 1024) * 1024;
+    const char *file = argc > 3 ? argv[3] : NULL;
+    imageSize &= ~(LOG_STORE_SECTOR_SIZE - 1);
+    image = malloc(imageSize);
+    memset(image, 0xFF, imageSize);
+    if (file != NULL) {
+        FILE *fp = fopen(file, "rb");
+        if (fp != NULL) {
+            if (fread(image, 1, imageSize, fp) != imageSize) {
+                memset(image, 0xFF, imageSize);
+            }
+            fclose(fp);
+        }
+    }
+    const struct logStoreFlash_s flash = {
+        modelRead, modelProgram, modelErase, modelBusy, NULL, imageSize, PAGE_SIZE
+    };
+    static uint8_t pages[2 * PAGE_SIZE];
+    struct logStore_s store;
+    while (logStoreMount(&store, &flash, pages) == LOG_STORE_BUSY) {
+        ;
+    }
+    const uint8_t max = logStoreRecordMax(&store);
+    uint32_t seq = logStoreNextSequence(&store);
+    // default: enough records for the ring to wrap about one and a half times
+    uint32_t records = argc > 2 ? strtoul(argv[2], NULL, 0) : imageSize / (max / 2 + 7) * 3 / 2;
+    printf("flash %" PRIu32 "KB, %" PRIu32 " sectors, writing %" PRIu32 " records from %" PRIu32 "\n",
+           imageSize / 1024, (uint32_t)(imageSize / LOG_STORE_SECTOR_SIZE), records, seq);
+    for (uint32_t i = 0; i < records; i++, seq++) {
+        append(&store, seq, max);
+    }
+    while (logStoreFlush(&store) == LOG_STORE_BUSY) {
+        ;
+    }
+    printf("  %lu page programs, %lu sector erases\n", programs, erases);
+
+    // mount: binary search against a linear scan of all headers
+    reads = readBytes = 0;
+    double t = now();
+    while (logStoreMount(&store, &flash, pages) == LOG_STORE_BUSY) {
+        ;
+    }
+    t = now() - t;
+    printf("mount: %u header reads, %lu reads (%lu bytes) with newest sector scan, %.1fus\n",
+           store.headerReads, reads, readBytes, t * 1e6);
+    uint32_t headerReads;
+    reads = readBytes = 0;
+    t = now();
+    uint32_t newest = linearScan(&headerReads);
+    t = now() - t;
+    printf("linear scan: %" PRIu32 " header reads, %.1fus\n", headerReads, t * 1e6);
+    if (newest != store.sector || logStoreNextSequence(&store) != seq) {
+        fprintf(stderr, "mount found sector 0x%06" PRIx32 " next %" PRIu32
+                ", expected 0x%06" PRIx32 " next %" PRIu32 "\n",
+                store.sector, logStoreNextSequence(&store), newest, seq);
+        return 1;
+    }
+    if (!check(&store, seq)) {
+        return 1;
+    }
+
+    // torn record: the record is lost and its sequence number reused
+    const uint32_t torn = seq;
+    printf("torn record %" PRIu32 "\n", torn);
+    append(&store, seq++, max);
+    while (logStoreFlush(&store) == LOG_STORE_BUSY) {
+        ;
+    }
+    uint32_t tail = store.pageAddress + store.fill - 3;
+    image[tail] ^= 0x01;
+    while (logStoreMount(&store, &flash, pages) == LOG_STORE_BUSY) {
+        ;
+    }
+    seq = logStoreNextSequence(&store);
+    if (seq != torn) {
+        fprintf(stderr, "next %" PRIu32 " after torn record, expected %" PRIu32 "\n", seq, torn);
+        return 1;
+    }
+    append(&store, seq++, max);
+    append(&store, seq++, max);
+    while (logStoreFlush(&store) == LOG_STORE_BUSY) {
+        ;
+    }
+    struct logStoreCursor_s cursor;
+    uint8_t buf[256], expect[256], length, expectLength;
+    uint32_t s, last = 0;
+    logStoreRewind(&store, &cursor);
+    enum logStoreStatus_e status;
+    while ((status = logStoreRead(&store, &cursor, buf, &length, &s)) != LOG_STORE_END) {
+        if (status == LOG_STORE_OK) {
+            recordData(s, expect, &expectLength, max);
+            if ((last != 0 && s != last + 1) || length != expectLength ||
+                    memcmp(buf, expect, length) != 0) {
+                fprintf(stderr, "record %" PRIu32 " corrupt after torn record\n", s);
+                return 1;
+            }
+            last = s;
+        }
+    }
+    if (last != seq - 1) {
+        fprintf(stderr, "last record %" PRIu32 ", expected %" PRIu32 "\n", last, seq - 1);
+        return 1;
+    }
+    printf("  skipped, last record %" PRIu32 "\n", last);
+    if (!check(&store, seq)) {
+        return 1;
+    }
+
+    // program failures: the record or pending records are kept for a retry
+    unsigned failures = 0;
+    for (uint32_t i = 0; i < 4 * LOG_STORE_SECTOR_SIZE / PAGE_SIZE; i++, seq++) {
+        uint8_t length;
+        recordData(seq, buf, &length, max);
+        failProgram = true;
+        while ((status = logStoreAppend(&store, buf, length)) != LOG_STORE_OK) {
+            if (status == LOG_STORE_ERROR) {
+                failures++;
+            } else if (status != LOG_STORE_BUSY) {
+                fprintf(stderr, "append failed: %d\n", status);
+                return 1;
+            }
+        }
+        if (i % 8 == 0) {
+            failProgram = true;
+            while ((status = logStoreFlush(&store)) != LOG_STORE_OK) {
+                if (status == LOG_STORE_ERROR) {
+                    failures++;
+                }
+            }
+        }
+    }
+    failProgram = false;
+    while (logStoreFlush(&store) == LOG_STORE_BUSY) {
+        ;
+    }
+    printf("program failures: %u retried\n", failures);
+    if (failures == 0 || !check(&store, seq)) {
+        return 1;
+    }
+    while (logStoreMount(&store, &flash, pages) == LOG_STORE_BUSY) {
+        ;
+    }
+    if (!check(&store, seq)) {
+        return 1;
+    }
+
+    if (file != NULL) {
+        FILE *fp = fopen(file, "wb");
+        if (fp == NULL || fwrite(image, 1, imageSize, fp) != imageSize) {
+            perror(file);
+            return 1;
+        }
+        fclose(fp);
+    }
+    printf("ok\n");
+    return 0;
+}
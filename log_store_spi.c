@@ -0,0 +1,79 @@
+/*! \file
+ *  log_store_spi.c
+ *  xenon-lib-tiny
+ *  Copyright (c) 2020 Martin Clemons
+ *
+ *  Log store flash functions for SPI NOR flash (`spi_flash.h`).
+ */
+#include "log_store.h"
+#include "spi_flash.h"
+
+
+/*** Private Global Variables ------------------------------------------------*/
+/*! \privatesection */
+
+/* Program and erase futures, completion is checked with `spiFlashIdle()`. */
+static future_t future;
+static promise_t promise;
+
+
+/*** Public Global Variables -------------------------------------------------*/
+/*! \publicsection */
+
+
+/*** Private Function Prototypes ---------------------------------------------*/
+/*! \privatesection */
+static logStoreRead_t flashRead;
+static logStoreProgram_t flashProgram;
+static logStoreErase_t flashErase;
+static logStoreBusy_t flashBusy;
+
+
+/*** Interrupt Service Routines (ISR) ----------------------------------------*/
+/*! \privatesection */
+
+
+/*** Private Functions -------------------------------------------------------*/
+/*! \privatesection */
+
+static void flashRead(void *ctx, uint32_t address, uint8_t *buf, uint16_t length)
+{
+    spiFlashRead(ctx, address, buf, length);
+}
+
+static bool flashProgram(void *ctx, uint32_t address, const uint8_t *data, uint16_t length)
+{
+    return spiFlashProgram(ctx, &future, &promise, address, data, length) == TASK_INIT_OK;
+}
+
+static bool flashErase(void *ctx, uint32_t address)
+{
+    return spiFlashErase(ctx, &future, &promise, address) == TASK_INIT_OK;
+}
+
+static bool flashBusy(void *ctx)
+{
+    return !spiFlashIdle(ctx);
+}
+
+
+/*** Public Functions --------------------------------------------------------*/
+/*! \publicsection */
+
+/*! Set up log store flash functions for an SPI NOR flash. The whole device is
+ * used for the log.
+ * @param ops Pointer to the flash functions to set up.
+ * @param flash Pointer to the device, initialized with `spiFlashInit()`.
+ * Note: A read stream must not be open on the device while the log store
+ * uses it.
+ */
+void logStoreSpiFlash(struct logStoreFlash_s *ops, struct spiFlash_s *flash)
+{
+    ops->read = flashRead;
+    ops->program = flashProgram;
+    ops->erase = flashErase;
+    ops->busy = flashBusy;
+    ops->ctx = flash;
+    ops->size = flash->size & ~(LOG_STORE_SECTOR_SIZE - 1);
+    ops->pageSize = flash->pageSize;
+}
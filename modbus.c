@@ -0,0 +1,604 @@
+/*! \file
+ *  modbus.c
+ *  xenon-lib-tiny
+ *  Copyright (c) 2020 Martin Clemons
+ */
+#include "modbus.h"
+#include <stddef.h>
+#include <string.h>
+#include <avr/pgmspace.h>
+#include "util/atomic.h"
+#include "util/crc16.h"
+#include "usart_buffered.h"
+#include "usart_idle.h"
+
+#if MODBUS_BUFFER_SIZE > 256 || MODBUS_BUFFER_SIZE < 8
+#error "MODBUS_BUFFER_SIZE must be between 8 and 256"
+#endif
+
+#define BROADCAST_ADDRESS       0
+#define EXCEPTION_FLAG          0x80
+#define MAX_READ_BITS           2000
+#define MAX_WRITE_BITS          1968
+#define MAX_READ_REGISTERS      125
+#define MAX_WRITE_REGISTERS     123
+
+/* Frame states. */
+enum state_e {
+    MB_RX = 0,                  // receiving a request
+    MB_FRAME,                   // request complete, owned by the task
+    MB_ABORT,                   // extra bytes after a complete request, owned by the task
+    MB_READY,                   // response ready, waiting for t3.5
+    MB_TX,                      // transmitting the response
+    MB_DISCARD,                 // discarding bytes until t3.5
+};
+
+
+/*** Private Global Variables ------------------------------------------------*/
+/*! \privatesection */
+
+/* Frame buffer, holds the request and the response built in place. */
+static uint8_t buffer[MODBUS_BUFFER_SIZE];
+static uint16_t length;         // bytes received, or response length in MB_READY and MB_TX
+static uint16_t expected;       // request length known from function code, 0 if unknown
+static uint16_t crc;            // running CRC of the received bytes
+
+static volatile uint8_t state;
+static uint8_t ticks;           // half character times since the last byte
+static bool silent;             // t3.5 elapsed while in MB_FRAME
+
+static uint8_t slaveAddress;
+static const struct modbusMap_s *registerMap;
+static struct modbusStats_s counters;
+static task_t task;
+static bool taskAdded;           // task stays in the scheduler once added
+
+
+/*** Public Global Variables -------------------------------------------------*/
+/*! \publicsection */
+
+
+/*** Private Function Prototypes ---------------------------------------------*/
+/*! \privatesection */
+static inline void countError(uint16_t *counter);
+static inline uint16_t getWord(uint8_t i);
+static inline void putWord(uint8_t i, uint16_t value);
+static void rxByte(uint8_t data, void *ctx);
+static void tick(void);
+static void startResponse(void);
+static bool frameReady(cbParam_t *param);
+static void process(cbParam_t *param);
+static bool findRegion(const struct modbusRegion_s *table, uint8_t count, uint16_t start,
+                       uint16_t quantity, struct modbusRegion_s *region);
+static uint8_t readBits(const struct modbusRegion_s *table, uint8_t count, uint16_t *n);
+static uint8_t readRegisters(const struct modbusRegion_s *table, uint8_t count, uint16_t *n);
+static uint8_t writeSingle(const struct modbusRegion_s *table, uint8_t count, bool coil);
+static uint8_t writeBits(void);
+static uint8_t writeRegisters(void);
+static uint16_t handle(void);
+
+
+/*** Interrupt Service Routines (ISR) ----------------------------------------*/
+/*! \privatesection */
+
+
+/*** Private Functions -------------------------------------------------------*/
+/*! \privatesection */
+
+/*! Increment a statistics counter, saturating at its maximum value.
+ * @param counter Pointer to the counter.
+ */
+static inline void countError(uint16_t *counter)
+{
+    if (*counter != UINT16_MAX) {
+        (*counter)++;
+    }
+}
+
+/*! Get a big-endian word from the frame buffer.
+ */
+static inline uint16_t getWord(uint8_t i)
+{
+    return (uint16_t)buffer[i] << 8 | buffer[i + 1];
+}
+
+/*! Store a big-endian word in the frame buffer.
+ */
+static inline void putWord(uint8_t i, uint16_t value)
+{
+    buffer[i] = value >> 8;
+    buffer[i + 1] = value & 0xFF;
+}
+
+/*! Receive sink, called from the RXC ISR for each byte. The CRC is updated as
+ * bytes arrive, so a request is validated as soon as its last byte is in.
+ * The CRC of a frame including its CRC bytes is zero.
+ */
+static void rxByte(uint8_t data, void *ctx)
+{
+    uint8_t gap = ticks;
+    ticks = 0;
+    switch (state) {
+        case MB_TX:
+            if (!usartTxDrained(NULL)) {
+                // echo of the response
+                return;
+            }
+            state = MB_RX;
+            length = 0;
+            // fall through
+        case MB_RX:
+            if (length == 0) {
+                if (data != slaveAddress && data != BROADCAST_ADDRESS) {
+                    state = MB_DISCARD;
+                    return;
+                }
+                crc = 0xFFFF;
+                expected = 0;
+            } else if (gap >= MODBUS_T15_HALF_CHARS + 2 || length >= MODBUS_BUFFER_SIZE) {
+                // the gap is counted from the previous RXC, so it includes
+                // the two half characters of this byte
+                countError(&counters.discarded);
+                state = MB_DISCARD;
+                return;
+            }
+            buffer[length++] = data;
+            crc = _crc16_update(crc, data);
+            if (length == 2) {
+                // functions 1 - 6 have fixed length requests, the length of
+                // 15 and 16 is known once the byte count is in
+                if (data >= 1 && data <= 6) {
+                    expected = 8;
+                } else if (data == 15 || data == 16) {
+                    expected = UINT16_MAX;
+                }
+            } else if (length == 7 && (buffer[1] == 15 || buffer[1] == 16)) {
+                expected = 9 + data;
+            }
+            if (length == expected) {
+                if (crc == 0) {
+                    silent = false;
+                    state = MB_FRAME;
+                } else {
+                    countError(&counters.crcErrors);
+                    state = MB_DISCARD;
+                }
+            }
+            break;
+        case MB_FRAME:
+            state = MB_ABORT;
+            countError(&counters.discarded);
+            break;
+        case MB_READY:
+            state = MB_DISCARD;
+            countError(&counters.discarded);
+            break;
+        default:
+            break;
+    }
+}
+
+/*! Idle timer callback, called from ISR every half character time after the
+ * last received byte until t3.5 has elapsed.
+ */
+static void tick(void)
+{
+    if (++ticks < MODBUS_T35_HALF_CHARS) {
+        usartIdleRestart();
+        return;
+    }
+    switch (state) {
+        case MB_RX:
+            // request of unknown length (unsupported function), ends at t3.5
+            if (expected == 0 && length >= 4 && crc == 0) {
+                silent = true;
+                state = MB_FRAME;
+            } else {
+                if (expected == 0 && length >= 4) {
+                    countError(&counters.crcErrors);
+                } else if (length > 0) {
+                    // cut short before its known length
+                    countError(&counters.discarded);
+                }
+                length = 0;
+            }
+            break;
+        case MB_FRAME:
+            silent = true;
+            break;
+        case MB_READY:
+            startResponse();
+            break;
+        case MB_TX:
+            if (usartTxDrained(NULL)) {
+                state = MB_RX;
+                length = 0;
+            }
+            break;
+        case MB_DISCARD:
+            state = MB_RX;
+            length = 0;
+            break;
+        default:
+            break;
+    }
+}
+
+/*! Start transmitting the response. Called from ISR or with interrupts
+ * disabled.
+ */
+static void startResponse(void)
+{
+    if (usartTxJobStart(buffer, length, NULL)) {
+        state = MB_TX;
+    } else {
+        state = MB_RX;
+        length = 0;
+    }
+}
+
+/*! Conditional task check, a request is ready to be processed.
+ */
+static bool frameReady(cbParam_t *param)
+{
+    return state == MB_FRAME;
+}
+
+/*! Process a request and build the response in place. If t3.5 has already
+ * elapsed the response is started right away, otherwise the timer ISR starts
+ * it at t3.5.
+ * @param param Task scheduler parameter (not used).
+ */
+static void process(cbParam_t *param)
+{
+    uint16_t n = handle();
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (state == MB_FRAME && n > 0) {
+            length = n;
+            if (silent) {
+                startResponse();
+            } else {
+                state = MB_READY;
+            }
+        } else if (state == MB_FRAME || state == MB_ABORT) {
+            // bytes before t3.5 still belong to this frame, the timer ISR
+            // returns to MB_RX from MB_DISCARD
+            state = ticks >= MODBUS_T35_HALF_CHARS ? MB_RX : MB_DISCARD;
+            length = 0;
+        }
+    }
+}
+
+/*! Find the region containing a range of addresses.
+ * @param table Region table in flash.
+ * @param count Number of regions in `table`.
+ * @param start The first address.
+ * @param quantity Number of addresses.
+ * @param region Pointer where the region is copied.
+ * @return Returns `true` if a region was found.
+ */
+static bool findRegion(const struct modbusRegion_s *table, uint8_t count, uint16_t start,
+                       uint16_t quantity, struct modbusRegion_s *region)
+{
+    for (uint8_t i = 0; i < count; i++) {
+        memcpy_P(region, &table[i], sizeof(*region));
+        if (start >= region->start &&
+                (uint32_t)start + quantity <= (uint32_t)region->start + region->count) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*! Read coils or discrete inputs (functions 1 and 2).
+ * @param n Pointer where the response length without CRC is stored.
+ * @return Exception code.
+ */
+static uint8_t readBits(const struct modbusRegion_s *table, uint8_t count, uint16_t *n)
+{
+    uint16_t start = getWord(2);
+    uint16_t quantity = getWord(4);
+    uint8_t bytes = (quantity + 7) / 8;
+    struct modbusRegion_s region;
+    if (quantity == 0 || quantity > MAX_READ_BITS || 3 + bytes + 2 > MODBUS_BUFFER_SIZE) {
+        return MODBUS_ILLEGAL_DATA_VALUE;
+    }
+    if (!findRegion(table, count, start, quantity, &region)) {
+        return MODBUS_ILLEGAL_DATA_ADDRESS;
+    }
+    buffer[2] = bytes;
+    memset(&buffer[3], 0, bytes);
+    for (uint16_t i = 0; i < quantity; i++) {
+        uint16_t value;
+        uint8_t ex = region.read(start - region.start + i, &value, region.ctx);
+        if (ex != MODBUS_OK) {
+            return ex;
+        }
+        if (value) {
+            buffer[3 + i / 8] |= 1 << (i % 8);
+        }
+    }
+    *n = 3 + bytes;
+    return MODBUS_OK;
+}
+
+/*! Read holding or input registers (functions 3 and 4).
+ * @param n Pointer where the response length without CRC is stored.
+ * @return Exception code.
+ */
+static uint8_t readRegisters(const struct modbusRegion_s *table, uint8_t count, uint16_t *n)
+{
+    uint16_t start = getWord(2);
+    uint16_t quantity = getWord(4);
+    struct modbusRegion_s region;
+    if (quantity == 0 || quantity > MAX_READ_REGISTERS ||
+            3 + 2 * quantity + 2 > MODBUS_BUFFER_SIZE) {
+        return MODBUS_ILLEGAL_DATA_VALUE;
+    }
+    if (!findRegion(table, count, start, quantity, &region)) {
+        return MODBUS_ILLEGAL_DATA_ADDRESS;
+    }
+    buffer[2] = 2 * quantity;
+    for (uint8_t i = 0; i < quantity; i++) {
+        uint16_t value;
+        uint8_t ex = region.read(start - region.start + i, &value, region.ctx);
+        if (ex != MODBUS_OK) {
+            return ex;
+        }
+        putWord(3 + 2 * i, value);
+    }
+    *n = 3 + 2 * quantity;
+    return MODBUS_OK;
+}
+
+/*! Write a single coil or holding register (functions 5 and 6). The response
+ * is the request echoed.
+ * @return Exception code.
+ */
+static uint8_t writeSingle(const struct modbusRegion_s *table, uint8_t count, bool coil)
+{
+    uint16_t address = getWord(2);
+    uint16_t value = getWord(4);
+    struct modbusRegion_s region;
+    if (coil) {
+        if (value != 0xFF00 && value != 0x0000) {
+            return MODBUS_ILLEGAL_DATA_VALUE;
+        }
+        value = value ? 1 : 0;
+    }
+    if (!findRegion(table, count, address, 1, &region) || region.write == NULL) {
+        return MODBUS_ILLEGAL_DATA_ADDRESS;
+    }
+    return region.write(address - region.start, value, region.ctx);
+}
+
+/*! Write multiple coils (function 15).
+ * @return Exception code.
+ */
+static uint8_t writeBits(void)
+{
+    uint16_t start = getWord(2);
+    uint16_t quantity = getWord(4);
+    struct modbusRegion_s region;
+    if (quantity == 0 || quantity > MAX_WRITE_BITS || buffer[6] != (quantity + 7) / 8) {
+        return MODBUS_ILLEGAL_DATA_VALUE;
+    }
+    if (!findRegion(registerMap->coils, registerMap->coilRegions, start, quantity, &region) ||
+            region.write == NULL) {
+        return MODBUS_ILLEGAL_DATA_ADDRESS;
+    }
+    for (uint16_t i = 0; i < quantity; i++) {
+        uint16_t value = (buffer[7 + i / 8] >> (i % 8)) & 0x01;
+        uint8_t ex = region.write(start - region.start + i, value, region.ctx);
+        if (ex != MODBUS_OK) {
+            return ex;
+        }
+    }
+    return MODBUS_OK;
+}
+
+/*! Write multiple holding registers (function 16).
+ * @return Exception code.
+ */
+static uint8_t writeRegisters(void)
+{
+    uint16_t start = getWord(2);
+    uint16_t quantity = getWord(4);
+    struct modbusRegion_s region;
+    if (quantity == 0 || quantity > MAX_WRITE_REGISTERS || buffer[6] != 2 * quantity) {
+        return MODBUS_ILLEGAL_DATA_VALUE;
+    }
+    if (!findRegion(registerMap->holdingRegisters, registerMap->holdingRegisterRegions,
+                    start, quantity, &region) || region.write == NULL) {
+        return MODBUS_ILLEGAL_DATA_ADDRESS;
+    }
+    for (uint8_t i = 0; i < quantity; i++) {
+        uint8_t ex = region.write(start - region.start + i, getWord(7 + 2 * i), region.ctx);
+        if (ex != MODBUS_OK) {
+            return ex;
+        }
+    }
+    return MODBUS_OK;
+}
+
+/*! Execute the request in the frame buffer and build the response in place.
+ * Request fields are read before the response overwrites them.
+ * @return The response length including CRC, 0 if no response is sent.
+ */
+static uint16_t handle(void)
+{
+    const struct modbusMap_s *map = registerMap;
+    uint8_t function = buffer[1];
+    uint16_t n = 6;
+    uint8_t ex;
+    countError(&counters.requests);
+    switch (function) {
+        case 1:
+            ex = readBits(map->coils, map->coilRegions, &n);
+            break;
+        case 2:
+            ex = readBits(map->discreteInputs, map->discreteInputRegions, &n);
+            break;
+        case 3:
+            ex = readRegisters(map->holdingRegisters, map->holdingRegisterRegions, &n);
+            break;
+        case 4:
+            ex = readRegisters(map->inputRegisters, map->inputRegisterRegions, &n);
+            break;
+        case 5:
+            ex = writeSingle(map->coils, map->coilRegions, true);
+            break;
+        case 6:
+            ex = writeSingle(map->holdingRegisters, map->holdingRegisterRegions, false);
+            break;
+        case 15:
+            ex = writeBits();
+            break;
+        case 16:
+            ex = writeRegisters();
+            break;
+        default:
+            ex = MODBUS_ILLEGAL_FUNCTION;
+            break;
+    }
+    if (buffer[0] == BROADCAST_ADDRESS) {
+        return 0;
+    }
+    if (ex != MODBUS_OK) {
+        countError(&counters.exceptions);
+        buffer[1] = function | EXCEPTION_FLAG;
+        buffer[2] = ex;
+        n = 3;
+    }
+    uint16_t c = 0xFFFF;
+    for (uint16_t i = 0; i < n; i++) {
+        c = _crc16_update(c, buffer[i]);
+    }
+    // Modbus CRC is sent low byte first
+    buffer[n] = c & 0xFF;
+    buffer[n + 1] = c >> 8;
+    return n + 2;
+}
+
+
+/*** Public Functions --------------------------------------------------------*/
+/*! \publicsection */
+
+/*! Start the Modbus RTU slave. USART0 must be configured first, the frame
+ * timeouts are computed from its baud rate. Takes over the receive sink of
+ * `usart_buffered.h` and the idle timer of `usart_idle.h`.
+ * @param address The slave address, 1 - 247.
+ * @param map Pointer to the register map, must remain valid.
+ * Calling again restarts the slave, the processing task is only added on the
+ * first call.
+ * @return Returns `TASK_INIT_OK` if the processing task was added,
+ * `TASK_INIT_ERROR` otherwise.
+ */
+enum addStatus_e modbusInit(uint8_t address, const struct modbusMap_s *map)
+{
+    modbusStop();
+    slaveAddress = address;
+    registerMap = map;
+    length = 0;
+    // no byte received yet, so there is no inter-character gap to check
+    ticks = MODBUS_T35_HALF_CHARS;
+    state = MB_RX;
+    usartIdleStart(USART_IDLE_CHARS(0.5), tick);
+    usartRxSinkStart(rxByte, NULL);
+    if (!taskAdded) {
+        // a removed task stays linked until `tsMain()` runs, so it is added once
+        if (tsAddConditionalTask(&task, process, NULL, frameReady, NULL) != TASK_INIT_OK) {
+            modbusStop();
+            return TASK_INIT_ERROR;
+        }
+        taskAdded = true;
+    }
+    return TASK_INIT_OK;
+}
+
+/*! Stop the Modbus RTU slave. A response in progress is completed. The
+ * processing task stays in the scheduler and idles until the next
+ * `modbusInit()`.
+ */
+void modbusStop(void)
+{
+    usartRxSinkStop();
+    usartIdleStop();
+    state = MB_DISCARD;
+}
+
+/*! Get the slave statistics.
+ * @param stats Pointer to data structure where counters are copied.
+ * @param clear Set to `true` to reset the counters after copying.
+ */
+void modbusGetStats(struct modbusStats_s *stats, bool clear)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        *stats = counters;
+        if (clear) {
+            counters = (struct modbusStats_s){ 0 };
+        }
+    }
+}
+
+/*! Region read callback for registers in a RAM array.
+ * @param ctx Pointer to a `uint16_t` array.
+ */
+uint8_t modbusReadRam(uint16_t index, uint16_t *value, void *ctx)
+{
+    const volatile uint16_t *registers = ctx;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        *value = registers[index];
+    }
+    return MODBUS_OK;
+}
+
+/*! Region write callback for registers in a RAM array.
+ * @param ctx Pointer to a `uint16_t` array.
+ */
+uint8_t modbusWriteRam(uint16_t index, uint16_t value, void *ctx)
+{
+    volatile uint16_t *registers = ctx;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        registers[index] = value;
+    }
+    return MODBUS_OK;
+}
+
+/*! Region read callback for constant registers in flash.
+ * @param ctx Pointer to a `uint16_t` array in flash (`PROGMEM`).
+ */
+uint8_t modbusReadFlash(uint16_t index, uint16_t *value, void *ctx)
+{
+    const uint16_t *registers = ctx;
+    *value = pgm_read_word(&registers[index]);
+    return MODBUS_OK;
+}
+
+/*! Region read callback for coils or discrete inputs packed in a RAM array,
+ * eight per byte with the lowest index in bit 0.
+ * @param ctx Pointer to a `uint8_t` array.
+ */
+uint8_t modbusReadBits(uint16_t index, uint16_t *value, void *ctx)
+{
+    const volatile uint8_t *bits = ctx;
+    *value = (bits[index / 8] >> (index % 8)) & 0x01;
+    return MODBUS_OK;
+}
+
+/*! Region write callback for coils packed in a RAM array.
+ * @param ctx Pointer to a `uint8_t` array.
+ */
+uint8_t modbusWriteBits(uint16_t index, uint16_t value, void *ctx)
+{
+    volatile uint8_t *bits = ctx;
+    uint8_t mask = 1 << (index % 8);
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (value) {
+            bits[index / 8] |= mask;
+        } else {
+            bits[index / 8] &= ~mask;
+        }
+    }
+    return MODBUS_OK;
+}
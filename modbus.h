@@ -0,0 +1,118 @@
+/*! \file
+ *  modbus.h
+ *  xenon-lib-tiny
+ *  Copyright (c) 2020 Martin Clemons
+ *
+ *  Modbus RTU slave on USART0. Request bytes are received from the RXC ISR
+ *  into a single frame buffer while the CRC is updated incrementally. Frame
+ *  boundaries (t1.5 / t3.5) are timed with the TCB of `usart_idle.h`.
+ *  A request whose length is known from its function code is processed by a
+ *  scheduler task as soon as its last byte arrives, so the response is
+ *  usually ready before t3.5 has elapsed and is started from the timer ISR
+ *  without further delay. The Modbus RTU specification requires t3.5 of
+ *  silence before the response, so the response starts 3.5 character times
+ *  after the request end, not within one character time. Responses are sent with an interrupt driven
+ *  transmit job, use `usart_rs485.h` for the line driver.
+ *  Coils, discrete inputs, holding registers and input registers are mapped
+ *  with tables of regions stored in flash, each with read and write callbacks.
+ *  Supported functions: 1, 2, 3, 4, 5, 6, 15 and 16.
+ */
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <avr/io.h>
+#include "task_scheduler.h"
+
+
+/*** Public Variables --------------------------------------------------------*/
+/*! \publicsection */
+
+/*! Size of the frame buffer in bytes, at most 256. Requests longer than the
+ * buffer are discarded, reads which don't fit are answered with an exception.
+ */
+#ifndef MODBUS_BUFFER_SIZE
+#define MODBUS_BUFFER_SIZE      256
+#endif
+
+/*! Inter-character (t1.5) and inter-frame (t3.5) timeouts in half character
+ * times. The Modbus specification recommends fixed values of 750us and
+ * 1750us above 19200 baud, these defaults scale with the baud rate instead.
+ */
+#ifndef MODBUS_T15_HALF_CHARS
+#define MODBUS_T15_HALF_CHARS   3
+#endif
+#ifndef MODBUS_T35_HALF_CHARS
+#define MODBUS_T35_HALF_CHARS   7
+#endif
+
+/*! Modbus exception codes, returned by the region callbacks.
+ */
+enum modbusException_e {
+    MODBUS_OK                       = 0x00,     ///< No exception
+    MODBUS_ILLEGAL_FUNCTION         = 0x01,     ///< Function not supported
+    MODBUS_ILLEGAL_DATA_ADDRESS     = 0x02,     ///< Address not mapped or not writable
+    MODBUS_ILLEGAL_DATA_VALUE       = 0x03,     ///< Value or quantity out of range
+    MODBUS_SERVER_DEVICE_FAILURE    = 0x04,     ///< Error while performing the action
+};
+
+/*! Region read callback, called from a task. The first parameter is the index
+ * of the coil or register relative to the region start, the second parameter
+ * points to where the value is stored (0 or 1 for coils and discrete inputs),
+ * the third parameter is the region context.
+ * Returns `MODBUS_OK` or an exception code.
+ */
+typedef uint8_t (modbusReadCb_t)(uint16_t, uint16_t *, void *);
+
+/*! Region write callback, called from a task. The first parameter is the
+ * index relative to the region start, the second parameter the value to
+ * write (0 or 1 for coils), the third parameter is the region context.
+ * Returns `MODBUS_OK` or an exception code.
+ */
+typedef uint8_t (modbusWriteCb_t)(uint16_t, uint16_t, void *);
+
+/*! A region of consecutive coils or registers. Region tables are stored in
+ * flash (`PROGMEM`). A request must fall within a single region.
+ */
+struct modbusRegion_s {
+    uint16_t start;             ///< Address of the first coil or register
+    uint16_t count;             ///< Number of coils or registers
+    modbusReadCb_t *read;       ///< Read callback
+    modbusWriteCb_t *write;     ///< Write callback, `NULL` if read-only
+    void *ctx;                  ///< Context passed to the callbacks
+};
+
+/*! Register map. Each member points to a table of regions in flash.
+ */
+struct modbusMap_s {
+    const struct modbusRegion_s *coils;             ///< Coil regions (functions 1, 5, 15)
+    uint8_t coilRegions;                            ///< Number of coil regions
+    const struct modbusRegion_s *discreteInputs;    ///< Discrete input regions (function 2)
+    uint8_t discreteInputRegions;                   ///< Number of discrete input regions
+    const struct modbusRegion_s *holdingRegisters;  ///< Holding register regions (functions 3, 6, 16)
+    uint8_t holdingRegisterRegions;                 ///< Number of holding register regions
+    const struct modbusRegion_s *inputRegisters;    ///< Input register regions (function 4)
+    uint8_t inputRegisterRegions;                   ///< Number of input register regions
+};
+
+/*! Slave statistics. Counters saturate at their maximum value.
+ */
+struct modbusStats_s {
+    uint16_t requests;          ///< Valid requests addressed to this slave
+    uint16_t crcErrors;         ///< Frames with a CRC error
+    uint16_t discarded;         ///< Frames discarded due to gaps, length or overflow
+    uint16_t exceptions;        ///< Exception responses sent
+};
+
+
+/*** Public Functions --------------------------------------------------------*/
+/*! \publicsection */
+
+enum addStatus_e modbusInit(uint8_t address, const struct modbusMap_s *map);
+void modbusStop(void);
+void modbusGetStats(struct modbusStats_s *stats, bool clear);
+uint8_t modbusReadRam(uint16_t index, uint16_t *value, void *ctx);
+uint8_t modbusWriteRam(uint16_t index, uint16_t value, void *ctx);
+uint8_t modbusReadFlash(uint16_t index, uint16_t *value, void *ctx);
+uint8_t modbusReadBits(uint16_t index, uint16_t *value, void *ctx);
+uint8_t modbusWriteBits(uint16_t index, uint16_t value, void *ctx);
@@ -6,6 +6,7 @@
  *  RTC (Real Time Counter) peripheral.
  */
 #include "rtc.h"
+#include "sleep_manager.h"
 #include "util/atomic.h"
 
 
@@ -149,6 +150,8 @@ void rtcInitEnable(struct rtcConfig_s *config)
 /*! Set the RTC enable and run standby bits in RTC CTRLA register. ** Not Reentrant **
  * Function waits for clock domain sync by polling the RTC_CTRLABUSY bit before
  * writing CTRLA register.
+ * The RTC does not run in power-down, the sleep manager is limited to standby
+ * and manages the RUNSTDBY bit itself when it enters sleep.
  * @param runStdby The state to set the RUNSTDBY bit.
  */
 void rtcEnable(bool runStdby)
@@ -156,6 +159,7 @@ void rtcEnable(bool runStdby)
     // wait for clock domain sync
     loop_until_bit_is_clear(RTC.STATUS, RTC_CTRLABUSY_bp);
     RTC.CTRLA |= RTC_RTCEN_bm | (runStdby ? RTC_RUNSTDBY_bm: 0x00);
+    sleepMgrSetLevel(SLEEP_MGR_CLIENT_RTC, SLEEP_MGR_STANDBY);
 }
 
 /*! Clear the RTC enable bit in RTC CTRLA register. ** Not Reentrant **
@@ -167,4 +171,5 @@ void rtcDisable(void)
     // wait for clock domain sync
     loop_until_bit_is_clear(RTC.STATUS, RTC_CTRLABUSY_bp);
     RTC.CTRLA &= ~RTC_RTCEN_bm;
+    sleepMgrSetLevel(SLEEP_MGR_CLIENT_RTC, SLEEP_MGR_POWER_DOWN);
 }
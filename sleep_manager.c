@@ -0,0 +1,168 @@
+/*! \file
+ *  sleep_manager.c
+ *  xenon-lib-tiny
+ *  Copyright (c) 2020 Martin Clemons
+ */
+#include "sleep_manager.h"
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include "util/atomic.h"
+#include "task_scheduler.h"
+
+
+/*** Private Global Variables ------------------------------------------------*/
+/*! \privatesection */
+
+/* One bit per client for each level which keeps the CPU awake. A client's bit
+ * is set in at most one mask. `SLEEP_MGR_POWER_DOWN` has no mask, a client
+ * without a bit set in any mask permits power-down. */
+static volatile uint8_t clientMask[SLEEP_MGR_POWER_DOWN];
+
+
+/*** Public Global Variables -------------------------------------------------*/
+/*! \publicsection */
+
+
+/*** Private Function Prototypes ---------------------------------------------*/
+/*! \privatesection */
+static void applyRunStdby(bool runStdby);
+static void enterSleep(enum sleepMgrLevel_e level);
+
+
+/*** Interrupt Service Routines (ISR) ----------------------------------------*/
+/*! \privatesection */
+
+
+/*** Private Functions -------------------------------------------------------*/
+/*! \privatesection */
+
+/*! Set or clear the `RUNSTDBY` bits of the RTC and the XOSC32K oscillator.
+ * The RTC only keeps counting in standby if `RUNSTDBY` is set. If the RTC runs
+ * from XOSC32K, the oscillator is also kept running so it doesn't need to go
+ * through its start-up time on each RTC clock request.
+ * Registers are only written when the RTC `RUNSTDBY` bit differs from the
+ * desired state.
+ * @param runStdby The desired state of the `RUNSTDBY` bits.
+ */
+static void applyRunStdby(bool runStdby)
+{
+    if (bit_is_clear(RTC.CTRLA, RTC_RTCEN_bp) ||
+            ((RTC.CTRLA & RTC_RUNSTDBY_bm) ? true : false) == runStdby) {
+        return;
+    }
+    loop_until_bit_is_clear(RTC.STATUS, RTC_CTRLABUSY_bp);
+    if (runStdby) {
+        RTC.CTRLA |= RTC_RUNSTDBY_bm;
+    } else {
+        RTC.CTRLA &= ~RTC_RUNSTDBY_bm;
+    }
+    if (RTC.CLKSEL == RTC_CLKSEL_TOSC32K_gc &&
+            bit_is_set(CLKCTRL.XOSC32KCTRLA, CLKCTRL_ENABLE_bp)) {
+        uint8_t mask = CLKCTRL.XOSC32KCTRLA & ~CLKCTRL_RUNSTDBY_bm;
+        mask |= runStdby ? CLKCTRL_RUNSTDBY_bm : 0x00;
+        CPU_CCP = CCP_IOREG_gc;
+        CLKCTRL.XOSC32KCTRLA = mask;
+    }
+}
+
+/*! Enter sleep mode. Interrupts must be disabled when this function is called,
+ * they are enabled immediately before the `SLEEP` instruction so a pending
+ * interrupt wakes the CPU right away.
+ * @param level The sleep level to enter, must not be `SLEEP_MGR_ACTIVE`.
+ */
+static void enterSleep(enum sleepMgrLevel_e level)
+{
+    switch (level) {
+        case SLEEP_MGR_IDLE:
+            SLPCTRL.CTRLA = SLPCTRL_SMODE_IDLE_gc;
+            break;
+        case SLEEP_MGR_STANDBY:
+            applyRunStdby(true);
+            SLPCTRL.CTRLA = SLPCTRL_SMODE_STDBY_gc;
+            break;
+        default:
+            applyRunStdby(false);
+            SLPCTRL.CTRLA = SLPCTRL_SMODE_PDOWN_gc;
+            break;
+    }
+    sleep_enable();
+    sei();
+    sleep_cpu();
+    sleep_disable();
+}
+
+
+/*** Public Functions --------------------------------------------------------*/
+/*! \publicsection */
+
+/*! Set the deepest sleep level in which a client can still operate. May be
+ * called from ISR.
+ * A driver typically sets `SLEEP_MGR_IDLE` (or `SLEEP_MGR_STANDBY` if the
+ * peripheral runs in standby) when the peripheral is enabled, and
+ * `SLEEP_MGR_POWER_DOWN` when it is disabled.
+ * @param client The client setting its requirement.
+ * @param level The deepest sleep level permitted by this client.
+ */
+void sleepMgrSetLevel(enum sleepMgrClient_e client, enum sleepMgrLevel_e level)
+{
+    const uint8_t bit = 1 << client;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        for (uint8_t i = 0; i < SLEEP_MGR_POWER_DOWN; i++) {
+            if (i == level) {
+                clientMask[i] |= bit;
+            } else {
+                clientMask[i] &= ~bit;
+            }
+        }
+    }
+}
+
+/*! Get the deepest sleep level currently permitted by all clients.
+ * @return The deepest permitted sleep level.
+ */
+enum sleepMgrLevel_e sleepMgrGetLevel(void)
+{
+    uint8_t level;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        for (level = 0; level < SLEEP_MGR_POWER_DOWN; level++) {
+            if (clientMask[level] != 0) {
+                break;
+            }
+        }
+    }
+    return level;
+}
+
+/*! Immediately enter the deepest permitted sleep mode, without checking the
+ * task scheduler. This is a replacement for `sleep_mode()` in blocking loops
+ * which wait for an interrupt. Returns immediately if sleep is not permitted.
+ */
+void sleepMgrSleep(void)
+{
+    cli();
+    enum sleepMgrLevel_e level = sleepMgrGetLevel();
+    if (level == SLEEP_MGR_ACTIVE) {
+        sei();
+        return;
+    }
+    enterSleep(level);
+}
+
+/*! Scheduler idle function. Call after each call to `tsMain()`. If no task is
+ * due, the CPU enters the deepest sleep mode permitted by all clients and
+ * stays there until the next interrupt.
+ * The idle check and entering sleep are performed with interrupts disabled,
+ * so an interrupt which makes a task due between the two cannot be missed.
+ * Note: Timed tasks depend on the RTC overflow interrupt, the RTC driver sets
+ * `SLEEP_MGR_STANDBY` while the RTC is enabled so the RTC keeps counting.
+ */
+void sleepMgrIdle(void)
+{
+    cli();
+    enum sleepMgrLevel_e level = sleepMgrGetLevel();
+    if (level == SLEEP_MGR_ACTIVE || !tsIdle()) {
+        sei();
+        return;
+    }
+    enterSleep(level);
+}
@@ -0,0 +1,53 @@
+/*! \file
+ *  sleep_manager.h
+ *  xenon-lib-tiny
+ *  Copyright (c) 2020 Martin Clemons
+ *
+ *  Sleep manager which puts the CPU into the deepest sleep mode permitted by
+ *  the active peripherals whenever the task scheduler is idle.
+ *  Each peripheral driver (client) sets the deepest sleep mode in which it can
+ *  still operate. When the scheduler is idle, `sleepMgrIdle()` selects the
+ *  shallowest of these modes, so the deepest mode permitted by all clients.
+ *  A client which doesn't need to stay awake sets `SLEEP_MGR_POWER_DOWN`.
+ */
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <avr/io.h>
+
+
+/*** Public Variables --------------------------------------------------------*/
+/*! \publicsection */
+
+/*! Sleep levels, ordered from shallowest to deepest.
+ */
+enum sleepMgrLevel_e {
+    SLEEP_MGR_ACTIVE        = 0,    ///< CPU must not sleep
+    SLEEP_MGR_IDLE,                 ///< Idle sleep mode, all peripherals run
+    SLEEP_MGR_STANDBY,              ///< Standby sleep mode, RTC and `RUNSTDBY` peripherals run
+    SLEEP_MGR_POWER_DOWN,           ///< Power-down sleep mode, only PIT, WDT and pin wake-up
+};
+
+/*! Sleep manager clients. Each client holds a single sleep requirement.
+ * Note: There can be at most 8 clients.
+ */
+enum sleepMgrClient_e {
+    SLEEP_MGR_CLIENT_USART0 = 0,    ///< USART0 driver
+    SLEEP_MGR_CLIENT_SPI0,          ///< SPI0 driver
+    SLEEP_MGR_CLIENT_TCA0,          ///< Timer/Counter A driver
+    SLEEP_MGR_CLIENT_TCB0,          ///< Timer/Counter B0 driver
+    SLEEP_MGR_CLIENT_TCB1,          ///< Timer/Counter B1 driver
+    SLEEP_MGR_CLIENT_TCD0,          ///< Timer/Counter D driver
+    SLEEP_MGR_CLIENT_RTC,           ///< RTC driver
+    SLEEP_MGR_CLIENT_APP,           ///< Application
+};
+
+
+/*** Public Functions --------------------------------------------------------*/
+/*! \publicsection */
+
+void sleepMgrSetLevel(enum sleepMgrClient_e client, enum sleepMgrLevel_e level);
+enum sleepMgrLevel_e sleepMgrGetLevel(void);
+void sleepMgrSleep(void);
+void sleepMgrIdle(void);
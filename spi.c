@@ -4,6 +4,8 @@
  *  Copyright (c) 2020 Martin Clemons
  */
 #include "spi.h"
+#include "util/atomic.h"
+#include "sleep_manager.h"
 
 
 /*** Private Global Variables ------------------------------------------------*/
@@ -16,6 +18,7 @@
 
 /*** Private Function Prototypes ---------------------------------------------*/
 /*! \privatesection */
+static void writeLast(uint8_t data);
 
 
 /*** Interrupt Service Routines (ISR) ----------------------------------------*/
@@ -25,6 +28,25 @@
 /*** Private Functions -------------------------------------------------------*/
 /*! \privatesection */
 
+/*! Write the last byte of a write-only transfer, wait until it is shifted out
+ * and discard the received bytes. `TXCIF` is cleared and the byte written
+ * with interrupts disabled, so an interrupt can't let the previous byte
+ * complete in between and end the wait early.
+ * @param data The last byte.
+ */
+static void writeLast(uint8_t data)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        loop_until_bit_is_set(SPI0.INTFLAGS, SPI_DREIF_bp);
+        SPI0.INTFLAGS = SPI_TXCIF_bm;
+        SPI0.DATA = data;
+    }
+    loop_until_bit_is_set(SPI0.INTFLAGS, SPI_TXCIF_bp);
+    while (bit_is_set(SPI0.INTFLAGS, SPI_RXCIF_bp)) {
+        SPI0.DATA;
+    }
+}
+
 
 /*** Public Functions --------------------------------------------------------*/
 /*! \publicsection */
@@ -53,6 +75,8 @@ void spiConfigInterrupts(struct spiInterruptConfig_s *config)
  * @param config Pointer to `spiMasterConfig_s` with the desired configuration.
  * Note: function does not set the data direction of the MOSI, SCK, and !SS pins,
  * these must be set as outputs elsewhere.
+ * The sleep manager is kept out of modes deeper than idle until `spiDisable()`
+ * is called.
  */
 void spiConfigMaster(struct spiMasterConfig_s *config)
 {
@@ -67,6 +91,69 @@ void spiConfigMaster(struct spiMasterConfig_s *config)
     SPI0.DATA;
     SPI0.DATA;
     SPI0.DATA;
+    sleepMgrSetLevel(SLEEP_MGR_CLIENT_SPI0, SLEEP_MGR_IDLE);
+}
+
+/*! Configure and enable the SPI peripheral in slave mode. Enables the hardware
+ * tx/rx buffers in the peripheral. `BUFWR` is set, so a byte written to
+ * `DATA` while !SS is high is the first byte sent when the master selects
+ * the device.
+ * @param config Pointer to `spiSlaveConfig_s` with the desired configuration.
+ * Note: function does not set the data direction of the MISO pin, it must be
+ * set as output elsewhere.
+ * The sleep manager is kept out of modes deeper than idle until `spiDisable()`
+ * is called.
+ */
+void spiConfigSlave(struct spiSlaveConfig_s *config)
+{
+    // clear interrupt flags
+    SPI0.INTFLAGS = SPI_RXCIF_bm | SPI_TXCIF_bm | SPI_DREIF_bm | SPI_SSIF_bm;
+    // configure SPI peripheral
+    SPI0.CTRLB = SPI_BUFEN_bm | SPI_BUFWR_bm | config->transferMode;
+    // configure and enable
+    SPI0.CTRLA = config->dataOrder | SPI_ENABLE_bm;
+    // make sure rx buffers don't have stale data
+    SPI0.DATA;
+    SPI0.DATA;
+    SPI0.DATA;
+    sleepMgrSetLevel(SLEEP_MGR_CLIENT_SPI0, SLEEP_MGR_IDLE);
+}
+
+/*! Disable the SPI peripheral, permitting the sleep manager to enter power-down.
+ * Note: A transfer in progress is aborted.
+ */
+void spiDisable(void)
+{
+    SPI0.CTRLA &= ~SPI_ENABLE_bm;
+    sleepMgrSetLevel(SLEEP_MGR_CLIENT_SPI0, SLEEP_MGR_POWER_DOWN);
+}
+
+/*! Select a new SPI clock prescaler after a peripheral clock change. The
+ * function signature is compatible with `clockGovAddClient()`.
+ * The smallest clock divisor is chosen which does not make SCK faster than
+ * before the clock change, so SPI devices are never clocked beyond their
+ * limit.
+ * @param from The old peripheral clock frequency.
+ * @param to The new peripheral clock frequency.
+ * @param param Task scheduler parameter (not used).
+ */
+void spiRescaleClock(uint32_t from, uint32_t to, cbParam_t *param)
+{
+    // log2 of the clock divisor for each PRESC value, CLK2X subtracts 1
+    static const uint8_t prescShift[4] = { 2, 4, 6, 7 };
+    uint8_t ctrla = SPI0.CTRLA;
+    uint8_t shift = prescShift[(ctrla & SPI_PRESC_gm) >> SPI_PRESC_gp] -
+            ((ctrla & SPI_CLK2X_bm) ? 1 : 0);
+    const uint32_t sck = from >> shift;
+    // smallest divisor (2 to 128) for which new SCK doesn't exceed old SCK
+    for (shift = 1; shift < 7 && (to >> shift) > sck; shift++) { }
+    uint8_t presc = 0;
+    while (prescShift[presc] < shift) {
+        presc++;
+    }
+    ctrla &= ~(SPI_PRESC_gm | SPI_CLK2X_bm);
+    ctrla |= (presc << SPI_PRESC_gp) | (prescShift[presc] > shift ? SPI_CLK2X_bm : 0);
+    SPI0.CTRLA = ctrla;
 }
 
 /*! Send and receive data through the SPI interface.
@@ -94,62 +181,122 @@ void spiIo(uint8_t buf[], uint8_t len)
     }
 }
 
-/*! Efficiently send and receive exactly 3 bytes (24 bits).
- * This is a blocking send/receive, and the CS line must be asserted and released
- * externally. The function will not return until 3 bytes have been transmitted
- * and received. The received bytes are written into `buf`.
- * This function is identical to `spiIo` except that it maximizes the use of
- * the SPI buffers and eliminates any internal counters and indexes, making
- * it slightly faster than using `spiIo` to transmit exactly 3 bytes (assuming
- * fast SPI clock frequency).
- * @param buf Buffer to send and receive from (exactly 3 bytes).
- * Note: This function assumes that the SPI peripheral is buffered: `BUFEN`
- * bit in `CTRLB` register is set.
+/* Generator for the fixed-length transfers `spiIo_N()` and `spiIo_N_r()`,
+ * see `spi.h`. `SPI_IO_STEPS_N` lists the byte positions after the first, so
+ * all variants are unrolled from the same step. The first byte goes to the
+ * shift register and the second directly to the transmit buffer; after that
+ * each received byte frees one transmit slot, so the next byte is written
+ * before the received one is read and two bytes are always in flight. */
+#define SPI_IO_STEPS_8(X)
+#define SPI_IO_STEPS_16(X)      SPI_IO_STEPS_8(X) X(1)
+#define SPI_IO_STEPS_24(X)      SPI_IO_STEPS_16(X) X(2)
+#define SPI_IO_STEPS_32(X)      SPI_IO_STEPS_24(X) X(3)
+#define SPI_IO_STEPS_40(X)      SPI_IO_STEPS_32(X) X(4)
+#define SPI_IO_STEPS_48(X)      SPI_IO_STEPS_40(X) X(5)
+
+#define SPI_IO_INDEX_(i)        (reverse ? bytes - 1 - (i) : (i))
+#define SPI_IO_STEP_(i) \
+    SPI0.DATA = buf[SPI_IO_INDEX_(i)]; \
+    loop_until_bit_is_set(SPI0.INTFLAGS, SPI_RXCIF_bp); \
+    buf[SPI_IO_INDEX_((i) - 1)] = SPI0.DATA;
+#define SPI_IO_DEFINE_(bits, suffix, rev) \
+    void spiIo_##bits##suffix(uint8_t buf[bits / 8]) \
+    { \
+        const uint8_t bytes = bits / 8; \
+        const bool reverse = rev; \
+        SPI0.DATA = buf[SPI_IO_INDEX_(0)]; \
+        SPI_IO_STEPS_##bits(SPI_IO_STEP_) \
+        loop_until_bit_is_set(SPI0.INTFLAGS, SPI_RXCIF_bp); \
+        buf[SPI_IO_INDEX_(bytes - 1)] = SPI0.DATA; \
+    }
+
+SPI_IO_DEFINE_(8, , false)
+SPI_IO_DEFINE_(8, _r, true)
+SPI_IO_DEFINE_(16, , false)
+SPI_IO_DEFINE_(16, _r, true)
+SPI_IO_DEFINE_(24, , false)
+SPI_IO_DEFINE_(24, _r, true)
+SPI_IO_DEFINE_(32, , false)
+SPI_IO_DEFINE_(32, _r, true)
+SPI_IO_DEFINE_(40, , false)
+SPI_IO_DEFINE_(40, _r, true)
+SPI_IO_DEFINE_(48, , false)
+SPI_IO_DEFINE_(48, _r, true)
+
+/*! Send data through the SPI interface, discarding received data. Faster
+ * than `spiIo()` since nothing is stored and the loop only waits for the
+ * transmit buffer. Measure the cost per byte on target with
+ * `spiBenchStream()` of `spi_bench.h`; SCK runs without gaps while it is
+ * below the 8 SCK periods a byte takes on the wire.
+ * This is a blocking send, and the CS line must be asserted and released
+ * externally. The function returns after the last byte is shifted out.
+ * @param buf Buffer to send from.
+ * @param len Number of bytes to send.
+ * Note: The receive buffer overflows during the transfer, its contents are
+ * discarded before returning. This function assumes that the SPI peripheral
+ * is buffered: `BUFEN` bit in `CTRLB` register is set.
  */
-void spiIo_24(uint8_t buf[3])
+void spiWrite(const uint8_t buf[], uint16_t len)
 {
-    SPI0.DATA = buf[0];
-    SPI0.DATA = buf[1];
-    loop_until_bit_is_set(SPI0.INTFLAGS, SPI_DREIF_bp);
-    buf[0] = SPI0.DATA;
-    SPI0.INTFLAGS |= SPI_TXCIF_bm;
-    SPI0.DATA = buf[2];
-    loop_until_bit_is_set(SPI0.INTFLAGS, SPI_TXCIF_bp);
-    buf[1] = SPI0.DATA;
-    buf[2] = SPI0.DATA;
+    if (len == 0) {
+        return;
+    }
+    const uint8_t *last = buf + len - 1;
+    while (buf < last) {
+        loop_until_bit_is_set(SPI0.INTFLAGS, SPI_DREIF_bp);
+        SPI0.DATA = *buf++;
+    }
+    writeLast(*buf);
 }
 
-/*! Same as spiIo24 except bytes are sent and received reversed. Useful for
- * communicating with systems that have multi-bit variables that have the high
- * byte first.
- * @param buf Buffer to send and receive from (exactly 3 bytes).
+/*! Receive data through the SPI interface, sending `fill` for every byte,
+ * without a pre-filled dummy buffer. One byte is written ahead, so the
+ * transmit buffer is refilled while the previous byte shifts, as in
+ * `spiIo_24()`. Measure the cost per byte on target with `spiBenchStream()`
+ * of `spi_bench.h`.
+ * This is a blocking receive, and the CS line must be asserted and released
+ * externally.
+ * @param buf Buffer to receive into.
+ * @param len Number of bytes to receive.
+ * @param fill The byte to send, usually 0x00 or 0xFF.
+ * Note: This function assumes that the SPI peripheral is buffered: `BUFEN`
+ * bit in `CTRLB` register is set.
  */
-void spiIo_24_r(uint8_t buf[3])
+void spiRead(uint8_t buf[], uint16_t len, uint8_t fill)
 {
-    SPI0.DATA = buf[2];
-    SPI0.DATA = buf[1];
-    loop_until_bit_is_set(SPI0.INTFLAGS, SPI_DREIF_bp);
-    buf[2] = SPI0.DATA;
-    SPI0.INTFLAGS |= SPI_TXCIF_bm;
-    SPI0.DATA = buf[0];
-    loop_until_bit_is_set(SPI0.INTFLAGS, SPI_TXCIF_bp);
-    buf[1] = SPI0.DATA;
-    buf[0] = SPI0.DATA;
+    if (len == 0) {
+        return;
+    }
+    uint8_t *last = buf + len - 1;
+    SPI0.DATA = fill;
+    while (buf < last) {
+        loop_until_bit_is_set(SPI0.INTFLAGS, SPI_DREIF_bp);
+        SPI0.DATA = fill;
+        loop_until_bit_is_set(SPI0.INTFLAGS, SPI_RXCIF_bp);
+        *buf++ = SPI0.DATA;
+    }
+    loop_until_bit_is_set(SPI0.INTFLAGS, SPI_RXCIF_bp);
+    *buf = SPI0.DATA;
 }
 
-/*! Efficiently send and receive exactly 2 bytes (16 bits).
- * Same as `spiIo_24` except for 2 byte length.
- * @param buf Buffer to send and receive from (exactly 2 bytes).
- * Note: This function assumes that the SPI peripheral is buffered: `BUFEN`
- * bit in `CTRLB` register is set.
+/*! Send `count` copies of `value` through the SPI interface, discarding
+ * received data, e.g. to clear a display. The loop only waits for the
+ * transmit buffer and writes a constant, measure the cost per byte on target
+ * with `spiBenchStream()` of `spi_bench.h`.
+ * This is a blocking send, and the CS line must be asserted and released
+ * externally. The function returns after the last byte is shifted out.
+ * @param value The byte to send.
+ * @param count Number of bytes to send.
+ * Note: See `spiWrite()`.
  */
-void spiIo_16(uint8_t buf[2])
+void spiFill(uint8_t value, uint16_t count)
 {
-    SPI0.INTFLAGS |= SPI_TXCIF_bm;
-    SPI0.DATA = buf[0];
-    SPI0.DATA = buf[1];
-    loop_until_bit_is_set(SPI0.INTFLAGS, SPI_DREIF_bp);
-    buf[0] = SPI0.DATA;
-    loop_until_bit_is_set(SPI0.INTFLAGS, SPI_TXCIF_bp);
-    buf[1] = SPI0.DATA;
+    if (count == 0) {
+        return;
+    }
+    while (--count > 0) {
+        loop_until_bit_is_set(SPI0.INTFLAGS, SPI_DREIF_bp);
+        SPI0.DATA = value;
+    }
+    writeLast(value);
 }
@@ -10,6 +10,7 @@
 #include <inttypes.h>
 #include <stdbool.h>
 #include <avr/io.h>
+#include "task_scheduler.h"
 
 
 /*** Public Variables --------------------------------------------------------*/
@@ -67,13 +68,55 @@ struct spiMasterConfig_s {
     enum spiPrescale_e prescale;            ///< SPI clock prescaler
 };
 
+/*! Configuration options for SPI in slave mode.
+ */
+struct spiSlaveConfig_s {
+    enum spiDataOrder_e dataOrder;          ///< SPI data order
+    enum spiTransferMode_e transferMode;    ///< SPI transfer mode (supports modes 0 through 3)
+};
+
 
 /*** Public Functions --------------------------------------------------------*/
 /*! \publicsection */
 
 void spiConfigInterrupts(struct spiInterruptConfig_s *config);
 void spiConfigMaster(struct spiMasterConfig_s *config);
+void spiConfigSlave(struct spiSlaveConfig_s *config);
+void spiDisable(void);
+void spiRescaleClock(uint32_t from, uint32_t to, cbParam_t *param);
 void spiIo(uint8_t buf[], uint8_t len);
+
+/*! Efficiently send and receive exactly N bits (N / 8 bytes).
+ * This is a blocking send/receive, and the CS line must be asserted and
+ * released externally. The received bytes are written into `buf`.
+ * The transfers are fully unrolled and keep the SPI transmit buffer full, so
+ * SCK runs without gaps between bytes. The `_r` variants send and receive
+ * the bytes reversed, last byte of `buf` first, which is useful for
+ * multi-byte variables on devices that expect the high byte first.
+ * All variants are generated from one definition in `spi.c`.
+ *
+ * Compared with `spiIo()`, which polls both flags and maintains two indexes
+ * in each pass, the unrolled steps leave no gaps on SCK at the fastest
+ * prescalers. At slower prescalers both are wire bound and only the call and
+ * loop setup differ. Measure both on target with `spiBenchIo()` of
+ * `spi_bench.h`.
+ * @param buf Buffer to send and receive from (exactly N / 8 bytes).
+ * Note: These functions assume that the SPI peripheral is buffered: `BUFEN`
+ * bit in `CTRLB` register is set, and that the receive buffer is empty.
+ */
+void spiIo_8(uint8_t buf[1]);
+void spiIo_8_r(uint8_t buf[1]);
+void spiIo_16(uint8_t buf[2]);
+void spiIo_16_r(uint8_t buf[2]);
 void spiIo_24(uint8_t buf[3]);
 void spiIo_24_r(uint8_t buf[3]);
-void spiIo_16(uint8_t buf[2]);
+void spiIo_32(uint8_t buf[4]);
+void spiIo_32_r(uint8_t buf[4]);
+void spiIo_40(uint8_t buf[5]);
+void spiIo_40_r(uint8_t buf[5]);
+void spiIo_48(uint8_t buf[6]);
+void spiIo_48_r(uint8_t buf[6]);
+
+void spiWrite(const uint8_t buf[], uint16_t len);
+void spiRead(uint8_t buf[], uint16_t len, uint8_t fill);
+void spiFill(uint8_t value, uint16_t count);
@@ -0,0 +1,298 @@
+/*! \file
+ *  spi_async.c
+ *  xenon-lib-tiny
+ *  Copyright (c) 2020 Martin Clemons
+ */
+#include "spi_async.h"
+#include <stddef.h>
+#include <avr/interrupt.h>
+#include "util/atomic.h"
+#include "task_scheduler.h"
+
+
+/*** Private Global Variables ------------------------------------------------*/
+/*! \privatesection */
+
+/* State of the active batch, accessed from the ISR. The transmit side runs
+ * up to two bytes ahead of the receive side and may already be in the next
+ * transaction of a `SPI_TXN_KEEP_CS` chain. `future` is `NULL` if no batch is
+ * active. */
+static struct {
+    const struct spiTransaction_s *batch;
+    uint8_t count;
+    uint8_t txIndex;                    // transaction being sent
+    uint8_t rxIndex;                    // transaction being received
+    const uint8_t *tx;
+    uint16_t txRemaining;               // bytes of `txIndex` not yet written to SPI0
+    uint8_t *rx;
+    uint16_t rxRemaining;               // bytes of `rxIndex` not yet received
+    uint8_t inFlight;                   // bytes written but not yet received
+    uint16_t transferred;               // bytes received in the batch
+    const struct spiDevice_s *cs;       // selected device, `NULL` if none
+} q;
+static future_t * volatile future;
+
+/* Batch of one for `spiAsyncTransfer()`. */
+static struct spiTransaction_s single;
+static struct spiDevice_s singleDevice;
+
+
+/*** Public Global Variables -------------------------------------------------*/
+/*! \publicsection */
+
+
+/*** Private Function Prototypes ---------------------------------------------*/
+/*! \privatesection */
+static void csSelect(const struct spiDevice_s *device);
+static void csRelease(void);
+static void fill(void);
+static bool receive(uint8_t data);
+static void finish(void);
+static enum addStatus_e start(future_t *f, promise_t *promise,
+                              const struct spiTransaction_s *batch, uint8_t count);
+
+
+/*** Interrupt Service Routines (ISR) ----------------------------------------*/
+/*! \privatesection */
+
+/*! SPI0 interrupt, receive complete in buffered mode. Each received byte frees
+ * one transmit buffer slot, so the next byte is written first and two bytes
+ * stay in flight. More than one byte may be received if the interrupt was
+ * delayed.
+ */
+ISR(SPI0_INT_vect)
+{
+    while (bit_is_set(SPI0.INTFLAGS, SPI_RXCIF_bp)) {
+        uint8_t data = SPI0.DATA;
+        q.inFlight--;
+        fill();
+        if (receive(data)) {
+            return;
+        }
+    }
+}
+
+
+/*** Private Functions -------------------------------------------------------*/
+/*! \privatesection */
+
+/*! Assert the chip select of a device.
+ */
+static void csSelect(const struct spiDevice_s *device)
+{
+    q.cs = device;
+    if (device != NULL && device->csPort != NULL) {
+        device->csPort->OUTCLR = device->csPin;
+    }
+}
+
+/*! Release the chip select of the selected device.
+ */
+static void csRelease(void)
+{
+    if (q.cs != NULL && q.cs->csPort != NULL) {
+        q.cs->csPort->OUTSET = q.cs->csPin;
+    }
+    q.cs = NULL;
+}
+
+/*! Write bytes to SPI0 until two are in flight. Continues into the next
+ * transaction only while CS stays asserted.
+ */
+static void fill(void)
+{
+    while (q.inFlight < 2) {
+        if (q.txRemaining == 0) {
+            if (!(q.batch[q.txIndex].flags & SPI_TXN_KEEP_CS) || q.txIndex + 1 >= q.count) {
+                return;
+            }
+            q.txIndex++;
+            q.tx = q.batch[q.txIndex].tx;
+            q.txRemaining = q.batch[q.txIndex].length;
+        }
+        SPI0.DATA = q.tx != NULL ? *q.tx++ : 0xFF;
+        q.txRemaining--;
+        q.inFlight++;
+    }
+}
+
+/*! Store a received byte. At the end of a transaction CS is released and the
+ * next device selected and its first bytes written, unless the transactions
+ * are chained.
+ * @param data The received byte.
+ * @return Returns `true` if the batch is complete.
+ */
+static bool receive(uint8_t data)
+{
+    if (q.rx != NULL) {
+        *q.rx++ = data;
+    }
+    q.transferred++;
+    if (--q.rxRemaining > 0) {
+        return false;
+    }
+    bool chained = q.batch[q.rxIndex].flags & SPI_TXN_KEEP_CS;
+    if (!chained) {
+        csRelease();
+    }
+    if (++q.rxIndex >= q.count) {
+        finish();
+        return true;
+    }
+    const struct spiTransaction_s *t = &q.batch[q.rxIndex];
+    q.rx = t->rx;
+    q.rxRemaining = t->length;
+    if (!chained) {
+        csSelect(t->device);
+        q.txIndex = q.rxIndex;
+        q.tx = t->tx;
+        q.txRemaining = t->length;
+        fill();
+    }
+    return false;
+}
+
+/*! Complete the active batch: disable the interrupt and resolve the future
+ * with the number of bytes received. Called from ISR or with interrupts
+ * disabled.
+ */
+static void finish(void)
+{
+    SPI0.INTCTRL &= ~SPI_RXCIE_bm;
+    future->promise->uint16 = q.transferred;
+    future->resolved = true;
+    future = NULL;
+}
+
+/*! Start a batch, see `spiAsyncBatch()`.
+ */
+static enum addStatus_e start(future_t *f, promise_t *promise,
+                              const struct spiTransaction_s *batch, uint8_t count)
+{
+    f->promise = promise;
+    f->resolved = false;
+    promise->uint16 = 0;
+    if (count == 0) {
+        f->resolved = true;
+        return TASK_INIT_OK;
+    }
+    q.batch = batch;
+    q.count = count;
+    q.txIndex = 0;
+    q.rxIndex = 0;
+    q.tx = batch->tx;
+    q.txRemaining = batch->length;
+    q.rx = batch->rx;
+    q.rxRemaining = batch->length;
+    q.inFlight = 0;
+    q.transferred = 0;
+    future = f;
+    // make sure rx buffers don't have stale data
+    while (bit_is_set(SPI0.INTFLAGS, SPI_RXCIF_bp)) {
+        SPI0.DATA;
+    }
+    csSelect(batch->device);
+    // fill shift register and transmit buffer, the ISR keeps them full
+    fill();
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        SPI0.INTCTRL |= SPI_RXCIE_bm;
+    }
+    return TASK_INIT_OK;
+}
+
+
+/*** Public Functions --------------------------------------------------------*/
+/*! \publicsection */
+
+/*! Start an interrupt driven SPI0 transfer. Only one transfer or batch may be
+ * active at a time. CS is asserted before the first byte and released after
+ * the last byte is received. The future resolves with the number of bytes
+ * transferred in `promise->uint16`.
+ * @param f Pointer to the future for this transfer.
+ * @param promise Pointer to the promise receiving the number of bytes transferred.
+ * @param transfer Pointer to the transfer descriptor.
+ * @return returns `TASK_INIT_OK` if the transfer started, `TASK_INIT_ERROR`
+ * if a transfer is already active.
+ * Note: The SPI0 interrupt configuration is changed while the transfer is
+ * active, don't enable other SPI0 interrupts.
+ */
+enum addStatus_e spiAsyncTransfer(future_t *f, promise_t *promise,
+                                  const struct spiTransfer_s *transfer)
+{
+    if (f == NULL || promise == NULL || future != NULL) {
+        return TASK_INIT_ERROR;
+    }
+    singleDevice.csPort = transfer->csPort;
+    singleDevice.csPin = transfer->csPin;
+    single.device = &singleDevice;
+    single.tx = transfer->tx;
+    single.rx = transfer->rx;
+    single.length = transfer->length;
+    single.flags = 0;
+    return start(f, promise, &single, transfer->length > 0 ? 1 : 0);
+}
+
+/*! Start a batch of SPI0 transactions, executed back-to-back. CS of each
+ * transaction's device is asserted before its first byte and released after
+ * its last byte, except with `SPI_TXN_KEEP_CS` where the next transaction
+ * continues on the same CS. If the last transaction has `SPI_TXN_KEEP_CS`,
+ * CS stays asserted after the batch and the next batch must start with the
+ * same device. The future resolves with the total number of bytes
+ * transferred in `promise->uint16`.
+ * @param f Pointer to the future for this batch.
+ * @param promise Pointer to the promise receiving the number of bytes transferred.
+ * @param batch Pointer to the first of `count` transactions.
+ * @param count Number of transactions.
+ * @return returns `TASK_INIT_OK` if the batch started, `TASK_INIT_ERROR` if a
+ * transfer is already active or a transaction has length 0.
+ */
+enum addStatus_e spiAsyncBatch(future_t *f, promise_t *promise,
+                               const struct spiTransaction_s *batch, uint8_t count)
+{
+    if (f == NULL || promise == NULL || future != NULL) {
+        return TASK_INIT_ERROR;
+    }
+    for (uint8_t i = 0; i < count; i++) {
+        if (batch[i].length == 0) {
+            return TASK_INIT_ERROR;
+        }
+    }
+    return start(f, promise, batch, count);
+}
+
+/*! Cancel the active transfer or batch. Up to two bytes already in flight are
+ * completed, then CS is released and the future resolves with the number of
+ * bytes transferred so far. Has no effect if the future is already resolved.
+ * @param f Pointer to the future of the transfer to cancel.
+ */
+void spiAsyncCancel(future_t *f)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (f == future) {
+            // stop sending, then receive the bytes in flight
+            q.count = q.txIndex + 1;
+            q.txRemaining = 0;
+            bool done = false;
+            while (q.inFlight > 0 && !done) {
+                loop_until_bit_is_set(SPI0.INTFLAGS, SPI_RXCIF_bp);
+                uint8_t data = SPI0.DATA;
+                q.inFlight--;
+                done = receive(data);
+            }
+            csRelease();
+            if (!done) {
+                finish();
+            }
+        }
+    }
+}
+
+/*! Check if no transfer is active. Suitable as check function for
+ * `tsAddConditionalTask()`.
+ * @param param Task scheduler parameter (not used).
+ * @return Returns `true` if a new transfer can be started.
+ */
+bool spiAsyncIdle(cbParam_t *param)
+{
+    return future == NULL;
+}
@@ -0,0 +1,82 @@
+/*! \file
+ *  spi_async.h
+ *  xenon-lib-tiny
+ *  Copyright (c) 2020 Martin Clemons
+ *
+ *  Interrupt driven SPI0 master transfers which resolve a future. SPI0 must
+ *  be configured with `spiConfigMaster()` (buffered mode). Two bytes are kept
+ *  in flight, one in the shift register and one in the transmit buffer, and
+ *  the receive complete interrupt reads a byte and writes the next, so SCK
+ *  runs without gaps as long as the interrupt is served within one byte time.
+ *  The CPU is free between bytes.
+ *
+ *  The ISR takes roughly 80 CPU cycles per byte including entry and exit
+ *  (estimate from the generated code, not a measurement), so transfers run
+ *  at wire speed with `SPI_PRESCALE_DIV16` and slower (128 cycles per byte)
+ *  and are ISR bound with `SPI_PRESCALE_DIV4` (32 cycles per byte). For short
+ *  transfers at the fastest clock settings the blocking `spiIo()` is faster.
+ *
+ *  A batch of transactions is executed back-to-back from the ISR. CS is
+ *  released and the next device selected in the interrupt which receives the
+ *  last byte, without a round trip through the scheduler. Transactions
+ *  chained with `SPI_TXN_KEEP_CS` form one continuous stream: the first bytes
+ *  of the next transaction are loaded into the transmit buffer while the
+ *  previous one finishes, e.g. a register address from flash followed by a
+ *  read into a separate buffer.
+ */
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <avr/io.h>
+#include "futures.h"
+
+
+/*** Public Variables --------------------------------------------------------*/
+/*! \publicsection */
+
+/*! SPI transfer descriptor. The descriptor is copied when the transfer
+ * starts, the buffers must be valid until the future resolves.
+ */
+struct spiTransfer_s {
+    const uint8_t *tx;          ///< Data to send, `NULL` to send 0xFF
+    uint8_t *rx;                ///< Buffer for received data, `NULL` to discard
+    uint16_t length;            ///< Number of bytes to transfer
+    PORT_t *csPort;             ///< Chip select port, `NULL` if CS is handled externally
+    uint8_t csPin;              ///< Chip select pin bit mask, active low
+};
+
+/*! SPI device, the chip select pin of a batch transaction.
+ */
+struct spiDevice_s {
+    PORT_t *csPort;             ///< Chip select port, `NULL` if CS is handled externally
+    uint8_t csPin;              ///< Chip select pin bit mask, active low
+};
+
+/*! Batch transaction flags.
+ */
+enum spiTransactionFlags_e {
+    SPI_TXN_KEEP_CS         = 0x01,     ///< Keep CS asserted, the next transaction continues without gap
+};
+
+/*! Batch transaction descriptor. Transactions are read from the ISR and must
+ * be valid until the future resolves.
+ */
+struct spiTransaction_s {
+    const struct spiDevice_s *device;   ///< Device to select or `NULL`, ignored after a `SPI_TXN_KEEP_CS` transaction
+    const uint8_t *tx;                  ///< Data to send, `NULL` to send 0xFF
+    uint8_t *rx;                        ///< Buffer for received data, `NULL` to discard
+    uint16_t length;                    ///< Number of bytes to transfer, not 0
+    uint8_t flags;                      ///< Combination of `spiTransactionFlags_e`
+};
+
+
+/*** Public Functions --------------------------------------------------------*/
+/*! \publicsection */
+
+enum addStatus_e spiAsyncTransfer(future_t *f, promise_t *promise,
+                                  const struct spiTransfer_s *transfer);
+enum addStatus_e spiAsyncBatch(future_t *f, promise_t *promise,
+                               const struct spiTransaction_s *batch, uint8_t count);
+void spiAsyncCancel(future_t *f);
+bool spiAsyncIdle(cbParam_t *param);
@@ -0,0 +1,68 @@
+/*! \file
+ *  spi_bench.c
+ *  xenon-lib-tiny
+ *  Copyright (c) 2020 Martin Clemons
+ */
+#include "spi_bench.h"
+#include "cycle_bench.h"
+#include "spi.h"
+
+
+/*** Private Global Variables ------------------------------------------------*/
+/*! \privatesection */
+
+/* Data sent by the benchmarks, overwritten with the received bytes. */
+static uint8_t benchBuf[SPI_BENCH_STREAM_LENGTH > SPI_BENCH_LENGTHS ?
+        SPI_BENCH_STREAM_LENGTH : SPI_BENCH_LENGTHS];
+
+
+/*** Public Global Variables -------------------------------------------------*/
+/*! \publicsection */
+
+
+/*** Private Function Prototypes ---------------------------------------------*/
+/*! \privatesection */
+
+
+/*** Interrupt Service Routines (ISR) ----------------------------------------*/
+/*! \privatesection */
+
+
+/*** Private Functions -------------------------------------------------------*/
+/*! \privatesection */
+
+
+/*** Public Functions --------------------------------------------------------*/
+/*! \publicsection */
+
+/*! Measure `spiIo()` and `spiIo_N()` for each transfer length, including the
+ * call overhead.
+ * @param result Receives the cycles taken by each call.
+ */
+void spiBenchIo(struct spiBenchIo_s *result)
+{
+    for (uint8_t len = 1; len <= SPI_BENCH_LENGTHS; len++) {
+        CYCLE_BENCH(result->spiIo[len - 1], spiIo(benchBuf, len));
+    }
+    CYCLE_BENCH(result->spiIoN[0], spiIo_8(benchBuf));
+    CYCLE_BENCH(result->spiIoN[1], spiIo_16(benchBuf));
+    CYCLE_BENCH(result->spiIoN[2], spiIo_24(benchBuf));
+    CYCLE_BENCH(result->spiIoN[3], spiIo_32(benchBuf));
+    CYCLE_BENCH(result->spiIoN[4], spiIo_40(benchBuf));
+    CYCLE_BENCH(result->spiIoN[5], spiIo_48(benchBuf));
+}
+
+/*! Measure `spiWrite()`, `spiRead()` and `spiFill()` transferring
+ * `SPI_BENCH_STREAM_LENGTH` bytes, and `spiIo()` with the same length for
+ * comparison.
+ * @param result Receives the cycles taken by each call.
+ * Note: `spiIo()` takes at most 255 bytes, its result is not meaningful if
+ * `SPI_BENCH_STREAM_LENGTH` is larger.
+ */
+void spiBenchStream(struct spiBenchStream_s *result)
+{
+    CYCLE_BENCH(result->spiWrite, spiWrite(benchBuf, SPI_BENCH_STREAM_LENGTH));
+    CYCLE_BENCH(result->spiRead, spiRead(benchBuf, SPI_BENCH_STREAM_LENGTH, 0xFF));
+    CYCLE_BENCH(result->spiFill, spiFill(0xFF, SPI_BENCH_STREAM_LENGTH));
+    CYCLE_BENCH(result->spiIo, spiIo(benchBuf, (uint8_t)SPI_BENCH_STREAM_LENGTH));
+}
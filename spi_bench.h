@@ -0,0 +1,57 @@
+/*! \file
+ *  spi_bench.h
+ *  xenon-lib-tiny
+ *  Copyright (c) 2020 Martin Clemons
+ *
+ *  Measure the SPI transfer functions of `spi.h` on target with
+ *  `cycle_bench.h`. The SPI peripheral must be configured in master mode
+ *  (`spiConfigMaster()`) and `cycleBenchStart()` must have been called. The
+ *  transfers go out on the bus, assert the CS line of a device that ignores
+ *  the data, or none at all. Results depend on the SPI clock prescaler, run
+ *  the benchmark at each setting of interest.
+ */
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <avr/io.h>
+
+
+/*** Public Variables --------------------------------------------------------*/
+/*! \publicsection */
+
+/*! Number of transfer lengths measured, 1 to 6 bytes as `spiIo_8()` to
+ * `spiIo_48()`.
+ */
+#define SPI_BENCH_LENGTHS       6
+
+/*! CPU cycles taken by `spiIo()` and `spiIo_N()`, index 0 is a one byte
+ * transfer.
+ */
+struct spiBenchIo_s {
+    uint16_t spiIo[SPI_BENCH_LENGTHS];      ///< `spiIo()` with 1 to 6 bytes
+    uint16_t spiIoN[SPI_BENCH_LENGTHS];     ///< `spiIo_8()` to `spiIo_48()`
+};
+
+/*! Number of bytes transferred by `spiBenchStream()`.
+ */
+#ifndef SPI_BENCH_STREAM_LENGTH
+#define SPI_BENCH_STREAM_LENGTH     64
+#endif
+
+/*! CPU cycles taken by the fast paths for `SPI_BENCH_STREAM_LENGTH` bytes.
+ * Divide by the length for the cost per byte.
+ */
+struct spiBenchStream_s {
+    uint16_t spiWrite;      ///< `spiWrite()`
+    uint16_t spiRead;       ///< `spiRead()`
+    uint16_t spiFill;       ///< `spiFill()`
+    uint16_t spiIo;         ///< `spiIo()` for comparison
+};
+
+
+/*** Public Functions --------------------------------------------------------*/
+/*! \publicsection */
+
+void spiBenchIo(struct spiBenchIo_s *result);
+void spiBenchStream(struct spiBenchStream_s *result);
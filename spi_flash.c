@@ -0,0 +1,454 @@
+/*! \file
+ *  spi_flash.c
+ *  xenon-lib-tiny
+ *  Copyright (c) 2020 Martin Clemons
+ */
+#include "spi_flash.h"
+#include <stddef.h>
+#include <string.h>
+#include "task_scheduler.h"
+#include "spi.h"
+
+// JEDEC SPI NOR opcodes
+#define CMD_WRITE_ENABLE        0x06
+#define CMD_READ_STATUS         0x05
+#define CMD_PAGE_PROGRAM        0x02
+#define CMD_FAST_READ           0x0B
+#define CMD_READ_SFDP           0x5A
+#define CMD_READ_ID             0x9F
+#define CMD_RELEASE_POWER_DOWN  0xAB
+#define CMD_SECTOR_ERASE        0x20
+
+#define FLASH_STATUS_WIP        0x01
+
+// largest size with 3 byte addresses
+#define SIZE_MAX_3BYTE          0x1000000UL
+
+/*! Device state.
+ */
+enum flashState_e {
+    FLASH_IDLE = 0,             // no program or erase active
+    FLASH_WRITE,                // command transfer in progress
+    FLASH_BUSY,                 // waiting for WIP to clear
+};
+
+/*! Stream chunk state.
+ */
+enum chunkState_e {
+    CHUNK_EMPTY = 0,
+    CHUNK_FETCHING,
+    CHUNK_FULL,
+};
+
+
+/*** Private Global Variables ------------------------------------------------*/
+/*! \privatesection */
+
+static const uint8_t writeEnable = CMD_WRITE_ENABLE;
+
+
+/*** Public Global Variables -------------------------------------------------*/
+/*! \publicsection */
+
+
+/*** Private Function Prototypes ---------------------------------------------*/
+/*! \privatesection */
+static inline void csAssert(struct spiFlash_s *flash);
+static inline void csRelease(struct spiFlash_s *flash);
+static void putAddress(uint8_t *p, uint32_t address);
+static void readCommand(struct spiFlash_s *flash, uint8_t opcode, uint32_t address,
+                        uint8_t *buf, uint16_t length);
+static uint8_t readStatus(struct spiFlash_s *flash);
+static void readSfdp(struct spiFlash_s *flash);
+static enum addStatus_e startWrite(struct spiFlash_s *flash, future_t *f, promise_t *promise,
+                                   uint8_t count, uint16_t length);
+static void streamFetch(struct spiFlashStream_s *stream);
+static void streamUpdate(struct spiFlashStream_s *stream);
+static bool serviceDue(cbParam_t *param);
+static void service(cbParam_t *param);
+
+
+/*** Interrupt Service Routines (ISR) ----------------------------------------*/
+/*! \privatesection */
+
+
+/*** Private Functions -------------------------------------------------------*/
+/*! \privatesection */
+
+static inline void csAssert(struct spiFlash_s *flash)
+{
+    flash->device.csPort->OUTCLR = flash->device.csPin;
+}
+
+static inline void csRelease(struct spiFlash_s *flash)
+{
+    flash->device.csPort->OUTSET = flash->device.csPin;
+}
+
+/*! Store a 3 byte address, most significant byte first.
+ */
+static void putAddress(uint8_t *p, uint32_t address)
+{
+    p[0] = address >> 16;
+    p[1] = address >> 8;
+    p[2] = address;
+}
+
+/*! Blocking read with an opcode, 3 byte address and one dummy byte
+ * (FAST_READ, READ_SFDP).
+ */
+static void readCommand(struct spiFlash_s *flash, uint8_t opcode, uint32_t address,
+                        uint8_t *buf, uint16_t length)
+{
+    uint8_t cmd[5];
+    cmd[0] = opcode;
+    putAddress(&cmd[1], address);
+    cmd[4] = 0xFF;
+    csAssert(flash);
+    spiWrite(cmd, sizeof(cmd));
+    spiRead(buf, length, 0xFF);
+    csRelease(flash);
+}
+
+/*! Read status register 1, blocking for two bytes.
+ */
+static uint8_t readStatus(struct spiFlash_s *flash)
+{
+    uint8_t buf[2] = { CMD_READ_STATUS, 0xFF };
+    csAssert(flash);
+    spiIo_16(buf);
+    csRelease(flash);
+    return buf[1];
+}
+
+/*! Read the SFDP basic flash parameter table (JESD216) if the device has
+ * one, and update size, page size and erase opcode.
+ */
+static void readSfdp(struct spiFlash_s *flash)
+{
+    uint8_t header[16];
+    readCommand(flash, CMD_READ_SFDP, 0, header, sizeof(header));
+    // signature "SFDP", first parameter header must be the basic table (ID 0xFF00)
+    if (memcmp(header, "SFDP", 4) != 0 || header[8] != 0x00 || header[15] != 0xFF) {
+        return;
+    }
+    uint8_t dwords = header[11] < 11 ? header[11] : 11;
+    if (dwords < 2) {
+        return;
+    }
+    uint32_t pointer = (uint32_t)header[14] << 16 | (uint16_t)header[13] << 8 | header[12];
+    uint8_t table[11 * 4];
+    readCommand(flash, CMD_READ_SFDP, pointer, table, dwords * 4);
+    // DWORD 1: 4KB erase supported if bits 1:0 are 01, opcode in bits 15:8
+    if ((table[0] & 0x03) == 0x01) {
+        flash->eraseOpcode = table[1];
+    }
+    // DWORD 2: density in bits, N + 1 or 2^N if bit 31 is set
+    uint32_t density = (uint32_t)table[7] << 24 | (uint32_t)table[6] << 16 |
+            (uint16_t)table[5] << 8 | table[4];
+    if (density & 0x80000000UL) {
+        density &= 0x7FFFFFFFUL;
+        flash->size = density >= 35 ? SIZE_MAX_3BYTE :
+                density >= 3 ? (uint32_t)1 << (density - 3) : 1;
+    } else {
+        flash->size = density / 8 + 1;
+    }
+    // DWORD 11: page size 2^N in bits 7:4
+    if (dwords >= 11) {
+        flash->pageSize = 1 << (table[40] >> 4);
+    }
+}
+
+/*! Start a program or erase: the command transactions in `flash->txn` are
+ * sent, then the WIP bit is polled by the service task.
+ */
+static enum addStatus_e startWrite(struct spiFlash_s *flash, future_t *f, promise_t *promise,
+                                   uint8_t count, uint16_t length)
+{
+    f->promise = promise;
+    f->resolved = false;
+    promise->uint16 = 0;
+    if (spiAsyncBatch(&flash->bus, &flash->busPromise, flash->txn, count) != TASK_INIT_OK) {
+        return TASK_INIT_ERROR;
+    }
+    flash->done = f;
+    flash->doneLength = length;
+    flash->state = FLASH_WRITE;
+    return TASK_INIT_OK;
+}
+
+/*! Start fetching the next chunk of a stream if the chunk is free and the
+ * device and SPI0 are idle.
+ */
+static void streamFetch(struct spiFlashStream_s *stream)
+{
+    uint8_t h = stream->fetchHalf;
+    if (stream->half[h] != CHUNK_EMPTY || stream->flash->state != FLASH_IDLE ||
+            !spiAsyncIdle(NULL)) {
+        return;
+    }
+    putAddress(&stream->cmd[1], stream->fetchAddress);
+    stream->txn[1].rx = stream->cache + h * stream->chunk;
+    if (spiAsyncBatch(&stream->future, &stream->promise, stream->txn, 2) == TASK_INIT_OK) {
+        stream->half[h] = CHUNK_FETCHING;
+        stream->fetchAddress += stream->chunk;
+    }
+}
+
+/*! Mark a completed fetch and start the next one.
+ */
+static void streamUpdate(struct spiFlashStream_s *stream)
+{
+    uint8_t h = stream->fetchHalf;
+    if (stream->half[h] == CHUNK_FETCHING && future_resolved(stream->future)) {
+        stream->half[h] = CHUNK_FULL;
+        stream->fetchHalf = h ^ 1;
+    }
+    streamFetch(stream);
+}
+
+/*! Check function of the service task. Kept short, no SPI access.
+ */
+static bool serviceDue(cbParam_t *param)
+{
+    struct spiFlash_s *flash = param->void_ptr;
+    switch (flash->state) {
+        case FLASH_WRITE:
+            return future_resolved(flash->bus);
+        case FLASH_BUSY:
+            return rtcTimerActive(&flash->pollTimer) == 0 && spiAsyncIdle(NULL);
+        default:
+            if (flash->stream != NULL) {
+                struct spiFlashStream_s *s = flash->stream;
+                uint8_t h = s->half[s->fetchHalf];
+                return (h == CHUNK_FETCHING && future_resolved(s->future)) ||
+                       (h == CHUNK_EMPTY && spiAsyncIdle(NULL));
+            }
+            return false;
+    }
+}
+
+/*! Service task: polls WIP during program and erase, keeps the stream
+ * read-ahead running otherwise.
+ */
+static void service(cbParam_t *param)
+{
+    struct spiFlash_s *flash = param->void_ptr;
+    switch (flash->state) {
+        case FLASH_WRITE:
+            flash->state = FLASH_BUSY;
+            rtcTimerInit(&flash->pollTimer, SPI_FLASH_POLL_PERIOD);
+            break;
+        case FLASH_BUSY:
+            if (readStatus(flash) & FLASH_STATUS_WIP) {
+                rtcTimerInit(&flash->pollTimer, SPI_FLASH_POLL_PERIOD);
+                break;
+            }
+            flash->state = FLASH_IDLE;
+            flash->done->promise->uint16 = flash->doneLength;
+            flash->done->resolved = true;
+            // fall through, resume the stream
+        default:
+            if (flash->stream != NULL) {
+                streamUpdate(flash->stream);
+            }
+            break;
+    }
+}
+
+
+/*** Public Functions --------------------------------------------------------*/
+/*! \publicsection */
+
+/*! Initialize a flash device: release it from deep power-down, read the
+ * JEDEC ID and the SFDP parameters, and add the service task to the
+ * scheduler. Call once per device. Without SFDP, the size is taken from the
+ * JEDEC capacity byte (2^N bytes, used by most vendors), the page size is 256
+ * and the erase opcode 0x20.
+ * @param flash Pointer to the device.
+ * @param csPort Chip select port, the pin is set as output.
+ * @param csPin Chip select pin bit mask, active low.
+ * @return Returns `true` if a device responded.
+ * Note: SPI0 must be configured with `spiConfigMaster()`, mode 0 or 3.
+ * Devices larger than 16MB are limited to the first 16MB.
+ */
+bool spiFlashInit(struct spiFlash_s *flash, PORT_t *csPort, uint8_t csPin)
+{
+    memset(flash, 0, sizeof(*flash));
+    flash->device.csPort = csPort;
+    flash->device.csPin = csPin;
+    csPort->OUTSET = csPin;
+    csPort->DIRSET = csPin;
+    uint8_t cmd = CMD_RELEASE_POWER_DOWN;
+    csAssert(flash);
+    spiWrite(&cmd, 1);
+    csRelease(flash);
+    // the SFDP read below takes longer than the release time (tRES1, a few us)
+    uint8_t buf[4] = { CMD_READ_ID, 0xFF, 0xFF, 0xFF };
+    csAssert(flash);
+    spiIo_32(buf);
+    csRelease(flash);
+    memcpy(flash->jedecId, &buf[1], 3);
+    if (buf[1] == 0x00 || buf[1] == 0xFF) {
+        return false;
+    }
+    flash->pageSize = 256;
+    flash->eraseOpcode = CMD_SECTOR_ERASE;
+    flash->size = buf[3] < 24 ? 1UL << buf[3] : SIZE_MAX_3BYTE;
+    readSfdp(flash);
+    if (flash->size > SIZE_MAX_3BYTE) {
+        flash->size = SIZE_MAX_3BYTE;
+    }
+    flash->param.void_ptr = flash;
+    tsAddConditionalTask(&flash->task, service, &flash->param, serviceDue, &flash->param);
+    return true;
+}
+
+/*! Check if no program or erase is in progress and SPI0 is free, so the
+ * blocking `spiFlashRead()` may be used.
+ * @param flash Pointer to the device.
+ */
+bool spiFlashIdle(struct spiFlash_s *flash)
+{
+    return flash->state == FLASH_IDLE && spiAsyncIdle(NULL);
+}
+
+/*! Blocking read with FAST_READ, for short reads such as headers. Use a
+ * stream for sequential data.
+ * @param flash Pointer to the device.
+ * @param address Flash address.
+ * @param buf Buffer to read into.
+ * @param length Number of bytes to read.
+ * Note: Only call when `spiFlashIdle()` is `true`.
+ */
+void spiFlashRead(struct spiFlash_s *flash, uint32_t address, uint8_t *buf, uint16_t length)
+{
+    readCommand(flash, CMD_FAST_READ, address, buf, length);
+}
+
+/*! Program up to one page. The data is sent by the SPI0 interrupt and the
+ * future resolves with the number of bytes programmed in `promise->uint16`
+ * once the device has finished programming.
+ * @param flash Pointer to the device.
+ * @param f Pointer to the future for this operation.
+ * @param promise Pointer to the promise receiving the number of bytes programmed.
+ * @param address Flash address.
+ * @param data Data to program, must be valid until the future resolves.
+ * @param length Number of bytes, the range must not cross a page boundary.
+ * @return returns `TASK_INIT_OK` if programming started, `TASK_INIT_ERROR` if
+ * the device or SPI0 is busy or the range is invalid.
+ */
+enum addStatus_e spiFlashProgram(struct spiFlash_s *flash, future_t *f, promise_t *promise,
+                                 uint32_t address, const uint8_t *data, uint16_t length)
+{
+    if (f == NULL || promise == NULL || flash->state != FLASH_IDLE || length == 0 ||
+            address % flash->pageSize + length > flash->pageSize ||
+            address + length > flash->size) {
+        return TASK_INIT_ERROR;
+    }
+    flash->cmd[0] = CMD_PAGE_PROGRAM;
+    putAddress(&flash->cmd[1], address);
+    flash->txn[0] = (struct spiTransaction_s) { &flash->device, &writeEnable, NULL, 1, 0 };
+    flash->txn[1] = (struct spiTransaction_s) { &flash->device, flash->cmd, NULL, 4, SPI_TXN_KEEP_CS };
+    flash->txn[2] = (struct spiTransaction_s) { &flash->device, data, NULL, length, 0 };
+    return startWrite(flash, f, promise, 3, length);
+}
+
+/*! Erase the 4KB sector containing `address`. The future resolves once the
+ * device has finished erasing, with `promise->uint16` set to 4096.
+ * @param flash Pointer to the device.
+ * @param f Pointer to the future for this operation.
+ * @param promise Pointer to the promise.
+ * @param address An address in the sector.
+ * @return returns `TASK_INIT_OK` if the erase started, `TASK_INIT_ERROR` if
+ * the device or SPI0 is busy or the address is out of range.
+ */
+enum addStatus_e spiFlashErase(struct spiFlash_s *flash, future_t *f, promise_t *promise,
+                               uint32_t address)
+{
+    if (f == NULL || promise == NULL || flash->state != FLASH_IDLE || address >= flash->size) {
+        return TASK_INIT_ERROR;
+    }
+    flash->cmd[0] = flash->eraseOpcode;
+    putAddress(&flash->cmd[1], address & ~(SPI_FLASH_SECTOR_SIZE - 1));
+    flash->txn[0] = (struct spiTransaction_s) { &flash->device, &writeEnable, NULL, 1, 0 };
+    flash->txn[1] = (struct spiTransaction_s) { &flash->device, flash->cmd, NULL, 4, 0 };
+    return startWrite(flash, f, promise, 2, SPI_FLASH_SECTOR_SIZE);
+}
+
+/*! Open a sequential read stream and start fetching the first chunk. One
+ * stream per device may be open.
+ * @param stream Pointer to the stream.
+ * @param flash Pointer to the device.
+ * @param address Flash address of the first byte.
+ * @param cache Read-ahead cache of `2 * chunk` bytes.
+ * @param chunk Number of bytes per fetch, e.g. 64. Larger chunks reduce the
+ * command overhead (5 bytes per fetch) but delay the first data.
+ */
+void spiFlashStreamOpen(struct spiFlashStream_s *stream, struct spiFlash_s *flash,
+                        uint32_t address, uint8_t *cache, uint8_t chunk)
+{
+    memset(stream, 0, sizeof(*stream));
+    stream->flash = flash;
+    stream->cache = cache;
+    stream->chunk = chunk;
+    stream->fetchAddress = address;
+    stream->cmd[0] = CMD_FAST_READ;
+    stream->cmd[4] = 0xFF;
+    stream->txn[0] = (struct spiTransaction_s) { &flash->device, stream->cmd, NULL, 5, SPI_TXN_KEEP_CS };
+    stream->txn[1] = (struct spiTransaction_s) { NULL, NULL, NULL, chunk, 0 };
+    flash->stream = stream;
+    streamFetch(stream);
+}
+
+/*! Close a stream. A fetch in progress is cancelled.
+ * @param stream Pointer to the stream.
+ */
+void spiFlashStreamClose(struct spiFlashStream_s *stream)
+{
+    spiAsyncCancel(&stream->future);
+    stream->flash->stream = NULL;
+}
+
+/*! Check if stream data is available.
+ * @param param Task scheduler parameter, `void_ptr` points to the stream.
+ * @return Returns `true` if `spiFlashStreamRead()` returns data.
+ */
+bool spiFlashStreamReady(cbParam_t *param)
+{
+    struct spiFlashStream_s *stream = param->void_ptr;
+    uint8_t h = stream->half[stream->readHalf];
+    return h == CHUNK_FULL || (h == CHUNK_FETCHING && future_resolved(stream->future));
+}
+
+/*! Read from a stream, copying from the read-ahead cache. Each chunk that is
+ * used up is refilled in the background.
+ * @param stream Pointer to the stream.
+ * @param buf Buffer to read into.
+ * @param length Maximum number of bytes to read.
+ * @return Number of bytes read, less than `length` (possibly 0) if the next
+ * chunk is still being fetched.
+ */
+uint16_t spiFlashStreamRead(struct spiFlashStream_s *stream, uint8_t *buf, uint16_t length)
+{
+    uint16_t count = 0;
+    streamUpdate(stream);
+    while (length > 0 && stream->half[stream->readHalf] == CHUNK_FULL) {
+        uint8_t n = stream->chunk - stream->readPos;
+        if (n > length) {
+            n = length;
+        }
+        memcpy(buf, stream->cache + stream->readHalf * stream->chunk + stream->readPos, n);
+        buf += n;
+        count += n;
+        length -= n;
+        stream->readPos += n;
+        if (stream->readPos == stream->chunk) {
+            stream->half[stream->readHalf] = CHUNK_EMPTY;
+            stream->readHalf ^= 1;
+            stream->readPos = 0;
+            streamUpdate(stream);
+        }
+    }
+    return count;
+}
@@ -0,0 +1,105 @@
+/*! \file
+ *  spi_flash.h
+ *  xenon-lib-tiny
+ *  Copyright (c) 2020 Martin Clemons
+ *
+ *  Driver for JEDEC SPI NOR flash on SPI0, up to 16MB (3 byte addresses).
+ *  `spiFlashInit()` reads the JEDEC ID and, if the device has one, the SFDP
+ *  basic flash parameter table for size, page size and 4KB erase opcode.
+ *
+ *  Page program and sector erase are started with interrupt driven transfers
+ *  (`spi_async.h`) and resolve a future when the device is done. The write
+ *  in progress (WIP) bit is polled from a scheduler task every
+ *  `SPI_FLASH_POLL_PERIOD` RTC ticks, so nothing blocks for the program or
+ *  erase time.
+ *
+ *  A stream reads sequentially with FAST_READ into a two chunk read-ahead
+ *  cache: while the application copies data out of one chunk, the next chunk
+ *  is fetched by the SPI0 interrupt into the other. `spiFlashStreamReady()`
+ *  signals data available, suitable as check function for
+ *  `tsAddConditionalTask()`. Reads served from the cache are plain `memcpy()`.
+ *
+ *  Only one program, erase or stream fetch is active at a time, and a stream
+ *  pauses while a program or erase is in progress on the same device.
+ */
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <avr/io.h>
+#include "futures.h"
+#include "rtc_timer.h"
+#include "spi_async.h"
+
+
+/*** Public Variables --------------------------------------------------------*/
+/*! \publicsection */
+
+/*! RTC ticks between polls of the status register during program and erase.
+ */
+#ifndef SPI_FLASH_POLL_PERIOD
+#define SPI_FLASH_POLL_PERIOD   1
+#endif
+
+/*! Size of the sector erased by `spiFlashErase()`.
+ */
+#define SPI_FLASH_SECTOR_SIZE   4096UL
+
+struct spiFlash_s;
+
+/*! Sequential read stream. Allocated by the caller, see `spiFlashStreamOpen()`.
+ * All members are private.
+ */
+struct spiFlashStream_s {
+    struct spiFlash_s *flash;
+    uint8_t *cache;                     // two chunks
+    uint8_t chunk;                      // chunk size
+    uint8_t half[2];                    // chunk state
+    uint8_t fetchHalf;                  // chunk fetched next
+    uint8_t readHalf;                   // chunk read next
+    uint8_t readPos;                    // read position in `readHalf`
+    uint32_t fetchAddress;              // flash address fetched next
+    uint8_t cmd[5];
+    struct spiTransaction_s txn[2];
+    future_t future;
+    promise_t promise;
+};
+
+/*! SPI NOR flash device. Allocated by the caller and initialized with
+ * `spiFlashInit()`. Members below `eraseOpcode` are private.
+ */
+struct spiFlash_s {
+    struct spiDevice_s device;          ///< Chip select
+    uint8_t jedecId[3];                 ///< Manufacturer, memory type and capacity
+    uint32_t size;                      ///< Size in bytes
+    uint16_t pageSize;                  ///< Program page size in bytes
+    uint8_t eraseOpcode;                ///< 4KB sector erase opcode
+    uint8_t state;
+    uint8_t cmd[4];
+    struct spiTransaction_s txn[3];
+    future_t bus;
+    promise_t busPromise;
+    future_t *done;
+    uint16_t doneLength;
+    rtcTimer_t pollTimer;
+    task_t task;
+    cbParam_t param;
+    struct spiFlashStream_s *stream;
+};
+
+
+/*** Public Functions --------------------------------------------------------*/
+/*! \publicsection */
+
+bool spiFlashInit(struct spiFlash_s *flash, PORT_t *csPort, uint8_t csPin);
+bool spiFlashIdle(struct spiFlash_s *flash);
+void spiFlashRead(struct spiFlash_s *flash, uint32_t address, uint8_t *buf, uint16_t length);
+enum addStatus_e spiFlashProgram(struct spiFlash_s *flash, future_t *f, promise_t *promise,
+                                 uint32_t address, const uint8_t *data, uint16_t length);
+enum addStatus_e spiFlashErase(struct spiFlash_s *flash, future_t *f, promise_t *promise,
+                               uint32_t address);
+void spiFlashStreamOpen(struct spiFlashStream_s *stream, struct spiFlash_s *flash,
+                        uint32_t address, uint8_t *cache, uint8_t chunk);
+void spiFlashStreamClose(struct spiFlashStream_s *stream);
+bool spiFlashStreamReady(cbParam_t *param);
+uint16_t spiFlashStreamRead(struct spiFlashStream_s *stream, uint8_t *buf, uint16_t length);
@@ -0,0 +1,250 @@
+/*! \file
+ *  spi_slave.c
+ *  xenon-lib-tiny
+ *  Copyright (c) 2020 Martin Clemons
+ */
+#include "spi_slave.h"
+#include <stddef.h>
+#include <avr/interrupt.h>
+#include "util/atomic.h"
+
+
+/*** Private Global Variables ------------------------------------------------*/
+/*! \privatesection */
+
+/* Buffers and frame state. The ISR receives into `rx[rxActive]` and sends
+ * from `tx[txActive]`, the application owns the other buffer of each pair. */
+static struct spiSlaveBuffers_s buf;
+static uint8_t rxActive;
+static uint8_t rxCount;                 // bytes received in the current frame
+static uint8_t rxLength;                // length of the completed frame
+static volatile bool rxReady;           // completed frame in `rx[rxActive ^ 1]`
+static uint8_t txActive;
+static uint8_t txLength[2];
+static uint8_t txIndex;                 // next byte of `tx[txActive]` to write
+static volatile bool txPending;         // `tx[txActive ^ 1]` committed
+static uint16_t dropped;
+
+
+/*** Public Global Variables -------------------------------------------------*/
+/*! \publicsection */
+
+
+/*** Private Function Prototypes ---------------------------------------------*/
+/*! \privatesection */
+static inline uint8_t nextTx(void);
+static inline volatile uint8_t *ssPinCtrl(void);
+static void receive(void);
+static void preload(void);
+static void frameEnd(void);
+
+
+/*** Interrupt Service Routines (ISR) ----------------------------------------*/
+/*! \privatesection */
+
+/*! SPI0 interrupt, receive complete in buffered mode.
+ */
+ISR(SPI0_INT_vect)
+{
+    receive();
+}
+
+/*! !SS pin interrupt on the rising edge, the master ended the frame. The SPI
+ * slave select flag is only set in host mode, so the pin is sensed by the
+ * port. Bytes received before the edge are stored first.
+ */
+ISR(SPI_SLAVE_SS_PORT_vect)
+{
+    SPI_SLAVE_SS_PORT.INTFLAGS = 1 << SPI_SLAVE_SS_PIN;
+    receive();
+    frameEnd();
+}
+
+
+/*** Private Functions -------------------------------------------------------*/
+/*! \privatesection */
+
+/*! Get the next byte to transmit, `fill` after the end of the data.
+ */
+static inline uint8_t nextTx(void)
+{
+    if (txIndex < txLength[txActive]) {
+        return buf.tx[txActive][txIndex++];
+    }
+    return buf.fill;
+}
+
+/*! Get the pin control register of the !SS pin.
+ */
+static inline volatile uint8_t *ssPinCtrl(void)
+{
+    return &SPI_SLAVE_SS_PORT.PIN0CTRL + SPI_SLAVE_SS_PIN;
+}
+
+/*! Store the received bytes. Each received byte frees one transmit slot,
+ * which is refilled first. Called from ISR.
+ */
+static void receive(void)
+{
+    while (bit_is_set(SPI0.INTFLAGS, SPI_RXCIF_bp)) {
+        uint8_t data = SPI0.DATA;
+        SPI0.DATA = nextTx();
+        if (rxCount < buf.size) {
+            buf.rx[rxActive][rxCount++] = data;
+        }
+    }
+}
+
+/*! Load the first two bytes of the active transmit buffer into the shift
+ * register and transmit buffer, which must be empty.
+ */
+static void preload(void)
+{
+    txIndex = 0;
+    SPI0.DATA = nextTx();
+    SPI0.DATA = nextTx();
+}
+
+/*! End of frame, !SS deasserted. The ISR wrote two bytes ahead of the
+ * master, they are discarded by leaving buffer mode with SPI0 disabled,
+ * which resets the transmit and receive buffers. Then the buffers are
+ * swapped and the next response preloaded.
+ */
+static void frameEnd(void)
+{
+    uint8_t ctrlb = SPI0.CTRLB;
+    SPI0.CTRLA &= ~SPI_ENABLE_bm;
+    SPI0.CTRLB = ctrlb & ~SPI_BUFEN_bm;
+    SPI0.CTRLB = ctrlb;
+    SPI0.CTRLA |= SPI_ENABLE_bm;
+    if (rxCount > 0) {
+        if (!rxReady) {
+            rxLength = rxCount;
+            rxActive ^= 1;
+            rxReady = true;
+        } else if (dropped != UINT16_MAX) {
+            dropped++;
+        }
+    }
+    rxCount = 0;
+    if (txPending) {
+        txActive ^= 1;
+        txPending = false;
+    }
+    preload();
+}
+
+
+/*** Public Functions --------------------------------------------------------*/
+/*! \publicsection */
+
+/*! Start receiving frames. Both transmit buffers start empty, so `fill` is
+ * sent until the first response is committed.
+ * @param buffers Pointer to the frame buffers, copied.
+ * Note: SPI0 must be configured with `spiConfigSlave()`.
+ */
+void spiSlaveStart(const struct spiSlaveBuffers_s *buffers)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        buf = *buffers;
+        rxActive = 0;
+        rxCount = 0;
+        rxReady = false;
+        txActive = 0;
+        txLength[0] = 0;
+        txLength[1] = 0;
+        txPending = false;
+        dropped = 0;
+        preload();
+        SPI0.INTCTRL = SPI_RXCIE_bm;
+        SPI_SLAVE_SS_PORT.INTFLAGS = 1 << SPI_SLAVE_SS_PIN;
+        *ssPinCtrl() = (*ssPinCtrl() & ~PORT_ISC_gm) | PORT_ISC_RISING_gc;
+    }
+}
+
+/*! Stop receiving frames. A frame in progress is discarded.
+ */
+void spiSlaveStop(void)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        SPI0.INTCTRL &= ~SPI_RXCIE_bm;
+        *ssPinCtrl() = (*ssPinCtrl() & ~PORT_ISC_gm) | PORT_ISC_INTDISABLE_gc;
+    }
+}
+
+/*! Check if a completed frame is available.
+ * @param param Task scheduler parameter (not used).
+ * @return Returns `true` if a frame is ready.
+ */
+bool spiSlaveFrameReady(cbParam_t *param)
+{
+    return rxReady;
+}
+
+/*! Get the completed frame, valid until `spiSlaveFrameRelease()`.
+ * @return Pointer to the frame data, `NULL` if no frame is ready.
+ */
+const uint8_t *spiSlaveFrameData(void)
+{
+    return rxReady ? buf.rx[rxActive ^ 1] : NULL;
+}
+
+/*! Get the length of the completed frame.
+ * @return The frame length, at most the buffer size (longer frames are
+ * truncated), 0 if no frame is ready.
+ */
+uint8_t spiSlaveFrameLength(void)
+{
+    return rxReady ? rxLength : 0;
+}
+
+/*! Release the completed frame, its buffer is used for the frame after the
+ * one currently being received.
+ */
+void spiSlaveFrameRelease(void)
+{
+    rxReady = false;
+}
+
+/*! Check if the next response can be written.
+ * @param param Task scheduler parameter (not used).
+ * @return Returns `true` if the transmit buffer is available.
+ */
+bool spiSlaveTxReady(cbParam_t *param)
+{
+    return !txPending;
+}
+
+/*! Get the transmit buffer for the next response. Write the response and
+ * call `spiSlaveTxCommit()`.
+ * @return Pointer to the buffer, `NULL` if a committed response has not been
+ * sent yet.
+ */
+uint8_t *spiSlaveTxBuffer(void)
+{
+    return txPending ? NULL : buf.tx[txActive ^ 1];
+}
+
+/*! Commit the response written to `spiSlaveTxBuffer()`. It is sent from the
+ * next frame on, and repeated until another response is committed.
+ * @param length Response length, limited to the buffer size.
+ */
+void spiSlaveTxCommit(uint8_t length)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        txLength[txActive ^ 1] = length < buf.size ? length : buf.size;
+        txPending = true;
+    }
+}
+
+/*! Get the number of frames dropped because the previous frame was not
+ * released, saturating at 65535.
+ */
+uint16_t spiSlaveGetDropped(void)
+{
+    uint16_t d;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        d = dropped;
+    }
+    return d;
+}
@@ -0,0 +1,74 @@
+/*! \file
+ *  spi_slave.h
+ *  xenon-lib-tiny
+ *  Copyright (c) 2020 Martin Clemons
+ *
+ *  Interrupt driven SPI0 slave with ping-pong frame buffers. A frame is
+ *  everything the master clocks while !SS is low. The receive complete
+ *  interrupt stores each byte and writes the next transmit byte. A pin
+ *  interrupt on the rising edge of !SS ends the frame, as the SPI slave
+ *  select interrupt flag is only set in host mode: the receive buffers are
+ *  swapped, a new transmit buffer committed by the application is swapped
+ *  in, and its first two bytes are preloaded into the shift register and
+ *  transmit buffer before the master can start the next frame. The
+ *  application never writes a buffer the ISR is using, so the master never
+ *  sees a partially updated response.
+ *
+ *  The ISR writes the transmit data two bytes ahead of the master. At the end
+ *  of a frame the bytes written ahead are discarded by switching buffer mode
+ *  off and on with SPI0 disabled, so every frame starts with the first byte
+ *  of the response and the master never sees stale data.
+ *
+ *  A completed frame is signalled with `spiSlaveFrameReady()`, suitable as
+ *  check function for `tsAddConditionalTask()`. If the previous frame was not
+ *  released yet, the new frame is counted as dropped.
+ *
+ *  SPI0 must be configured with `spiConfigSlave()`. The master must leave
+ *  !SS high long enough for the interrupt to run between frames. This module
+ *  and `spi_async.c` both use the SPI0 interrupt, only one of them may be
+ *  linked. This file also provides the interrupt of the !SS pin port, it
+ *  can't be used together with other pin interrupts on that port.
+ */
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <avr/io.h>
+#include "task_scheduler.h"
+
+
+/*** Public Variables --------------------------------------------------------*/
+/*! \publicsection */
+
+/*! Port, pin number and port interrupt vector of the SPI0 !SS pin, PA4 unless
+ * the SPI0 pins are remapped with `PORTMUX`.
+ */
+#ifndef SPI_SLAVE_SS_PORT
+#define SPI_SLAVE_SS_PORT           PORTA
+#define SPI_SLAVE_SS_PIN            4
+#define SPI_SLAVE_SS_PORT_vect      PORTA_PORT_vect
+#endif
+
+/*! Slave frame buffers, allocated by the caller.
+ */
+struct spiSlaveBuffers_s {
+    uint8_t *rx[2];             ///< Receive ping-pong buffers
+    uint8_t *tx[2];             ///< Transmit ping-pong buffers
+    uint8_t size;               ///< Size of each buffer
+    uint8_t fill;               ///< Byte sent after the end of the transmit data
+};
+
+
+/*** Public Functions --------------------------------------------------------*/
+/*! \publicsection */
+
+void spiSlaveStart(const struct spiSlaveBuffers_s *buffers);
+void spiSlaveStop(void);
+bool spiSlaveFrameReady(cbParam_t *param);
+const uint8_t *spiSlaveFrameData(void);
+uint8_t spiSlaveFrameLength(void);
+void spiSlaveFrameRelease(void);
+bool spiSlaveTxReady(cbParam_t *param);
+uint8_t *spiSlaveTxBuffer(void);
+void spiSlaveTxCommit(uint8_t length);
+uint16_t spiSlaveGetDropped(void);
@@ -47,6 +47,7 @@ static task_t *currentTask;
 static void addTask(struct taskList_s *list, task_t *task);
 static void removeTask(struct taskList_s *list, task_t *task, task_t *up);
 static void mergeAddList(struct taskList_s *list);
+static bool taskDue(task_t *t);
 
 
 /*** Interrupt Service Routines (ISR) ----------------------------------------*/
@@ -112,6 +113,30 @@ static void mergeAddList(struct taskList_s *list)
     list->add_list.last = NULL;
 }
 
+/*! Check if a task would be called on the next run of `tsMain()`.
+ * @param t The task to check.
+ * @return Returns `true` if task is due, `false` otherwise.
+ * Note: The conditional check callback of conditional tasks is called.
+ */
+static bool taskDue(task_t *t)
+{
+    switch (t->type) {
+        case TASK_RECURRING:
+        case TASK_SINGLE_SHOT:
+            return true;
+
+        case TASK_TIMED:
+            return rtcTimerActive(&t->state.timed.dueTimer) == 0;
+
+        case TASK_CONDITIONAL:
+        case TASK_CONDITIONAL_SH:
+            return t->state.conditional.cb(t->state.conditional.conditionalParam);
+
+        default:
+            return false;
+    }
+}
+
 
 /*** Public Functions --------------------------------------------------------*/
 /*! \publicsection */
@@ -262,6 +287,35 @@ task_t * tsGetCurrentTask(void)
     return currentTask;
 }
 
+/*! Check whether the scheduler is idle, meaning no task would be called if
+ * `tsMain()` ran now. Tasks in the master lists and tasks added since the last
+ * run of `tsMain()` are checked.
+ * This function is intended to be called with interrupts disabled right before
+ * the CPU is put to sleep, so that an interrupt which makes a task due cannot
+ * be missed. Any task which becomes due must therefore be tied to an interrupt
+ * which wakes the CPU (conditional checks polling a flag set by an ISR, timed
+ * tasks woken by the RTC overflow interrupt).
+ * @return Returns `true` if no task is due, `false` otherwise.
+ */
+bool tsIdle(void)
+{
+    const struct taskList_s *lists[] = { &timedTasks, &conditionalTasks };
+    for (uint8_t i = 0; i < sizeof(lists) / sizeof(lists[0]); i++) {
+        // add_list is NULL terminated, the first task added has `next == NULL`
+        for (task_t *t = lists[i]->add_list.first; t != NULL; t = t->next) {
+            if (taskDue(t)) {
+                return false;
+            }
+        }
+        for (task_t *t = lists[i]->first; t != NULL; t = t->next) {
+            if (taskDue(t)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
 /*! Task scheduler function. Call this function at regular intervals.
  * Function first iterates through timed tasks, followed by conditional or
  * single-shot tasks.
@@ -79,4 +79,5 @@ enum addStatus_e tsAddConditionalSingleShotTask(task_t *task, cb_t *cb, cbParam_
                                                 cbParam_t *conditionalParam);
 void tsRemoveTask(task_t *task);
 task_t * tsGetCurrentTask(void);
+bool tsIdle(void);
 void tsMain(void);
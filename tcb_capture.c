@@ -0,0 +1,394 @@
+/*! \file
+ *  tcb_capture.c
+ *  xenon-lib-tiny
+ *  Copyright (c) 2020 Martin Clemons
+ */
+#include "tcb_capture.h"
+#include <string.h>
+#include <avr/interrupt.h>
+#include "util/atomic.h"
+#include "clock.h"
+#include "rtc_isr.h"
+#include "rtc_timer.h"
+
+#if TCB_CAPTURE_RING_SIZE > 128 || (TCB_CAPTURE_RING_SIZE & (TCB_CAPTURE_RING_SIZE - 1)) != 0
+#error "TCB_CAPTURE_RING_SIZE must be a power of two, at most 128"
+#endif
+
+// capture flags
+#define CAPTURE_FALLING     0x01        // captured on the falling edge
+#define CAPTURE_GAP         0x02        // captures were dropped before this one
+
+
+/*** Private Global Variables ------------------------------------------------*/
+/*! \privatesection */
+
+struct capture_s {
+    uint16_t time;                      // TCB capture
+    uint16_t tick;                      // RTC soft counter
+    uint8_t flags;
+};
+
+/* Capture ring, written by the ISR at `ringHead`, read by the task at `ringTail`. */
+static struct capture_s ring[TCB_CAPTURE_RING_SIZE];
+static volatile uint8_t ringHead;
+static volatile uint8_t ringTail;
+static bool gap;                        // ring was full, set and cleared in ISR
+static uint16_t dropped;
+static volatile uint16_t lastTick;
+static bool bothEdges;
+
+/* Capture task state. */
+static struct tcbCaptureConfig_s cfg;
+static task_t task;
+static rtcTimer_t delayTimer;
+static struct capture_s rise;           // last rising edge
+static bool riseValid;
+static bool lastRising;                 // last capture was a rising edge
+static uint32_t lastPeriod;             // last measured period, 0 if none
+static bool running;
+static bool taskAdded;                  // task stays in the scheduler once added
+
+/* Sum of up to 65535 32-bit values, 48 bits. */
+struct sum_s {
+    uint32_t low;
+    uint16_t high;
+};
+
+/* Window being collected and the last completed window. */
+static struct {
+    uint16_t periods;
+    uint32_t periodMin;
+    uint32_t periodMax;
+    struct sum_s periodSum;
+    uint16_t widths;
+    uint32_t widthMin;
+    uint32_t widthMax;
+    struct sum_s widthSum;
+} window;
+static struct tcbCaptureStats_s lastStats;
+static bool statsReady;
+
+
+/*** Public Global Variables -------------------------------------------------*/
+/*! \publicsection */
+
+
+/*** Private Function Prototypes ---------------------------------------------*/
+/*! \privatesection */
+static uint32_t elapsed(const struct capture_s *to, const struct capture_s *from);
+static void sumAdd(struct sum_s *sum, uint32_t value);
+static uint8_t sumReduce(const struct sum_s *sum, uint32_t *value);
+static void addPeriod(uint32_t period);
+static void addWidth(uint32_t width);
+static void publish(void);
+static void handle(const struct capture_s *c);
+static bool serviceDue(cbParam_t *param);
+static void service(cbParam_t *param);
+
+
+/*** Interrupt Service Routines (ISR) ----------------------------------------*/
+/*! \privatesection */
+
+/* Capture interrupt. Reading `CCMP` clears the flag. For pulse width the
+ * capture edge is toggled after each capture and the edge is stored with the
+ * capture, so high and low time are never swapped. An edge which occurs
+ * before the toggle is missed together with the following opposite edge, the
+ * capture task discards the resulting width, see `handle()`. */
+ISR(TCB_CAPTURE_TCB_vect)
+{
+    uint16_t time = TCB_CAPTURE_TCB.CCMP;
+    uint8_t flags = TCB_CAPTURE_TCB.EVCTRL & TCB_EDGE_bm ? CAPTURE_FALLING : 0;
+    if (bothEdges) {
+        TCB_CAPTURE_TCB.EVCTRL ^= TCB_EDGE_bm;
+    }
+    uint16_t tick = rtcGetSoftCounter();
+    lastTick = tick;
+    uint8_t head = ringHead;
+    if ((uint8_t)(head - ringTail) == TCB_CAPTURE_RING_SIZE) {
+        gap = true;
+        if (dropped != UINT16_MAX) {
+            dropped++;
+        }
+        return;
+    }
+    struct capture_s *c = &ring[head & (TCB_CAPTURE_RING_SIZE - 1)];
+    c->time = time;
+    c->tick = tick;
+    c->flags = gap ? flags | CAPTURE_GAP : flags;
+    gap = false;
+    ringHead = head + 1;
+}
+
+
+/*** Private Functions -------------------------------------------------------*/
+/*! \privatesection */
+
+/*! Get the TCB clocks between two captures. The 16-bit difference is extended
+ * by the number of counter wraps nearest to the RTC tick difference.
+ */
+static uint32_t elapsed(const struct capture_s *to, const struct capture_s *from)
+{
+    uint16_t d = to->time - from->time;
+    if (cfg.clocksPerTick == 0) {
+        return d;
+    }
+    uint32_t estimate = (uint32_t)(uint16_t)(to->tick - from->tick) * cfg.clocksPerTick;
+    if (estimate <= d) {
+        return d;
+    }
+    return d + ((estimate - d + 0x8000) & 0xFFFF0000UL);
+}
+
+static void sumAdd(struct sum_s *sum, uint32_t value)
+{
+    sum->low += value;
+    if (sum->low < value) {
+        sum->high++;
+    }
+}
+
+/*! Reduce a sum to 32 bits.
+ * @param sum Pointer to the sum.
+ * @param value Set to the sum shifted right by the returned amount.
+ * @return The number of bits the sum was shifted right, at most 16.
+ */
+static uint8_t sumReduce(const struct sum_s *sum, uint32_t *value)
+{
+    uint32_t low = sum->low;
+    uint16_t high = sum->high;
+    uint8_t shift = 0;
+    while (high != 0) {
+        low = low >> 1 | (uint32_t)(high & 1) << 31;
+        high >>= 1;
+        shift++;
+    }
+    *value = low;
+    return shift;
+}
+
+static void addPeriod(uint32_t period)
+{
+    if (window.periods == 0 || period < window.periodMin) {
+        window.periodMin = period;
+    }
+    if (period > window.periodMax) {
+        window.periodMax = period;
+    }
+    sumAdd(&window.periodSum, period);
+    lastPeriod = period;
+    if (++window.periods >= cfg.window) {
+        publish();
+    }
+}
+
+static void addWidth(uint32_t width)
+{
+    if (window.widths == 0 || width < window.widthMin) {
+        window.widthMin = width;
+    }
+    if (width > window.widthMax) {
+        window.widthMax = width;
+    }
+    sumAdd(&window.widthSum, width);
+    window.widths++;
+}
+
+/*! Complete the window: compute the means and frequency and start a new
+ * window. A window not read yet is replaced. Sums above 32 bits are reduced,
+ * which only affects periods of more than 65536 clocks.
+ */
+static void publish(void)
+{
+    uint32_t sum;
+    uint8_t shift = sumReduce(&window.periodSum, &sum);
+    lastStats.periods = window.periods;
+    lastStats.periodMin = window.periodMin;
+    lastStats.periodMax = window.periodMax;
+    lastStats.periodMean = clockMulDiv(sum, 1UL << shift, window.periods);
+    lastStats.frequency = sum > 0 ?
+            clockMulDiv(cfg.clockHz, 1000UL * window.periods, sum) >> shift : 0;
+    lastStats.widths = window.widths;
+    lastStats.widthMin = window.widthMin;
+    lastStats.widthMax = window.widthMax;
+    lastStats.widthMean = 0;
+    if (window.widths > 0) {
+        shift = sumReduce(&window.widthSum, &sum);
+        lastStats.widthMean = clockMulDiv(sum, 1UL << shift, window.widths);
+    }
+    statsReady = true;
+    memset(&window, 0, sizeof(window));
+}
+
+/*! Measure the period from rising edge to rising edge and the pulse width
+ * from a rising edge to the following falling edge. Dropped captures break
+ * the sequence.
+ * If the falling edge came before the ISR toggled the capture edge, the next
+ * capture is the falling edge one period later and the next rising edge is
+ * missed. Such a width is at least one period, it is discarded and the
+ * sequence is broken.
+ */
+static void handle(const struct capture_s *c)
+{
+    if (c->flags & CAPTURE_GAP) {
+        riseValid = false;
+        lastPeriod = 0;
+    }
+    if (c->flags & CAPTURE_FALLING) {
+        if (riseValid && lastRising) {
+            uint32_t width = elapsed(c, &rise);
+            if (lastPeriod == 0 || width < lastPeriod) {
+                addWidth(width);
+            } else {
+                riseValid = false;
+                lastPeriod = 0;
+            }
+        }
+        lastRising = false;
+    } else {
+        if (riseValid) {
+            addPeriod(elapsed(c, &rise));
+        }
+        rise = *c;
+        riseValid = true;
+        lastRising = true;
+    }
+}
+
+static bool serviceDue(cbParam_t *param)
+{
+    if (!running) {
+        return false;
+    }
+    uint8_t pending = ringHead - ringTail;
+    return pending >= TCB_CAPTURE_BATCH || (pending > 0 && rtcTimerActive(&delayTimer) == 0);
+}
+
+/*! Capture task, handles all captures in the ring.
+ */
+static void service(cbParam_t *param)
+{
+    uint8_t tail = ringTail;
+    uint8_t head = ringHead;
+    while (tail != head) {
+        handle(&ring[tail & (TCB_CAPTURE_RING_SIZE - 1)]);
+        ringTail = ++tail;
+    }
+    rtcTimerInit(&delayTimer, TCB_CAPTURE_MAX_DELAY);
+}
+
+
+/*** Public Functions --------------------------------------------------------*/
+/*! \publicsection */
+
+/*! Start the capture service. The TCB is configured for input capture on
+ * event and the capture task is added to the task scheduler on the first
+ * start. A running service is restarted with the new configuration.
+ * @param config Pointer to the configuration, copied.
+ * @return Returns `TASK_INIT_OK` if the service started, `TASK_INIT_ERROR` if
+ * the window size is 0, `clocksPerTick` is above 16384 or the task could not
+ * be added.
+ * Note: The TCB clock must not be changed while the service runs, restart it
+ * after a clock change.
+ */
+enum addStatus_e tcbCaptureStart(const struct tcbCaptureConfig_s *config)
+{
+    const struct timerCounterBConfig_s tcbConfig = {
+        .clockSource = config->clockSource,
+        .mode = TCB_MODE_CAPTURE,
+    };
+    const struct timerCounterBEventConfig_s eventConfig = {
+        .inputNoiseFilterEnable = config->noiseFilter,
+        .inputCaptureEnable = true,
+        .edgeBit = 0,
+    };
+    if (config->window == 0 || config->clocksPerTick > 16384) {
+        return TASK_INIT_ERROR;
+    }
+    tcbCaptureStop();
+    cfg = *config;
+    riseValid = false;
+    lastRising = false;
+    lastPeriod = 0;
+    statsReady = false;
+    memset(&window, 0, sizeof(window));
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        ringHead = 0;
+        ringTail = 0;
+        gap = false;
+        dropped = 0;
+        lastTick = rtcGetSoftCounter();
+        bothEdges = config->pulseWidth;
+    }
+    timerCounterBConfig(&TCB_CAPTURE_TCB, &tcbConfig);
+    timerCounterBConfigEvent(&TCB_CAPTURE_TCB, &eventConfig);
+    TCB_CAPTURE_TCB.INTFLAGS = TCB_CAPT_bm;
+    timerCounterBConfigInterrupts(&TCB_CAPTURE_TCB, true);
+    timerCounterBEnable(&TCB_CAPTURE_TCB);
+    rtcTimerInit(&delayTimer, TCB_CAPTURE_MAX_DELAY);
+    running = true;
+    if (!taskAdded) {
+        // a removed task stays linked until `tsMain()` runs, so it is added once
+        if (tsAddConditionalTask(&task, service, NULL, serviceDue, NULL) != TASK_INIT_OK) {
+            tcbCaptureStop();
+            return TASK_INIT_ERROR;
+        }
+        taskAdded = true;
+    }
+    return TASK_INIT_OK;
+}
+
+/*! Stop the capture service. Captures not handled yet are discarded. The
+ * capture task stays in the scheduler and idles until the next start.
+ */
+void tcbCaptureStop(void)
+{
+    timerCounterBConfigInterrupts(&TCB_CAPTURE_TCB, false);
+    timerCounterBDisable(&TCB_CAPTURE_TCB);
+    running = false;
+}
+
+/*! Check if a completed statistics window is available.
+ * @param param Task scheduler parameter (not used).
+ * @return Returns `true` if `tcbCaptureGetStats()` has a new window.
+ */
+bool tcbCaptureStatsReady(cbParam_t *param)
+{
+    return statsReady;
+}
+
+/*! Get the last completed statistics window.
+ * @param stats Pointer where the statistics are copied.
+ * @return Returns `true` if the window was not read before.
+ */
+bool tcbCaptureGetStats(struct tcbCaptureStats_s *stats)
+{
+    bool ready = statsReady;
+    *stats = lastStats;
+    statsReady = false;
+    return ready;
+}
+
+/*! Get the RTC ticks since the last capture, for example to detect a stopped
+ * signal, which completes no window.
+ */
+uint16_t tcbCaptureIdleTicks(void)
+{
+    uint16_t t;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        t = lastTick;
+    }
+    return rtcGetSoftCounter() - t;
+}
+
+/*! Get the number of captures dropped because the ring was full, saturating
+ * at 65535.
+ */
+uint16_t tcbCaptureGetDropped(void)
+{
+    uint16_t d;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        d = dropped;
+    }
+    return d;
+}
@@ -0,0 +1,100 @@
+/*! \file
+ *  tcb_capture.h
+ *  xenon-lib-tiny
+ *  Copyright (c) 2020 Martin Clemons
+ *
+ *  Input capture service for frequency, period and pulse-width measurement
+ *  with a TCB peripheral. The TCB runs in input capture on event mode, its
+ *  interrupt pushes each capture timestamp into a ring, so no edge is lost
+ *  while the application is busy. A conditional task empties the ring in
+ *  batches and collects period and pulse-width minimum, maximum and mean over
+ *  a window of periods; completed windows are read with
+ *  `tcbCaptureGetStats()`.
+ *
+ *  Capture timestamps are 16 bits. Periods longer than 65535 TCB clocks are
+ *  measured by recording the RTC soft counter (`rtc_isr.h`) with each
+ *  capture: the RTC ticks between two captures select the number of 16-bit
+ *  counter wraps. The tick recorded with a capture can be one tick late, and
+ *  the estimate must stay within half a wrap of the true period, so at most
+ *  16384 TCB clocks per RTC tick are supported, see `tcbCaptureConfig_s`.
+ *
+ *  The capture event is routed to the TCB event user by the application
+ *  (EVSYS), typically from a port pin. Pulse width is the high time of the
+ *  signal, use the pin `INVEN` setting to measure low time.
+ *  This file provides the Interrupt Service Routine of the selected TCB, it
+ *  can't be used together with custom ISR code for that vector.
+ */
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <avr/io.h>
+#include "task_scheduler.h"
+#include "timer_counter_b.h"
+
+
+/*** Public Variables --------------------------------------------------------*/
+/*! \publicsection */
+
+/*! TCB peripheral and interrupt vector used for capture.
+ */
+#ifndef TCB_CAPTURE_TCB
+#define TCB_CAPTURE_TCB             TCB1
+#define TCB_CAPTURE_TCB_vect        TCB1_INT_vect
+#endif
+
+/*! Size of the capture ring in captures (5 bytes each). Must be a power of
+ * two, at most 128.
+ */
+#ifndef TCB_CAPTURE_RING_SIZE
+#define TCB_CAPTURE_RING_SIZE       32
+#endif
+
+/*! Captures collected before the ring is emptied by the capture task.
+ */
+#ifndef TCB_CAPTURE_BATCH
+#define TCB_CAPTURE_BATCH           (TCB_CAPTURE_RING_SIZE / 2)
+#endif
+
+/*! RTC ticks after which fewer than `TCB_CAPTURE_BATCH` captures are handled,
+ * for slow signals.
+ */
+#ifndef TCB_CAPTURE_MAX_DELAY
+#define TCB_CAPTURE_MAX_DELAY       10
+#endif
+
+/*! Capture service configuration.
+ */
+struct tcbCaptureConfig_s {
+    enum timerCounterBClockSource_e clockSource;    ///< TCB clock source selection
+    uint32_t clockHz;               ///< TCB clock frequency, for the frequency result
+    uint16_t clocksPerTick;         ///< TCB clocks per RTC soft counter tick, at most 16384, 0 if periods are below 65536 clocks
+    uint16_t window;                ///< Periods per statistics window
+    bool pulseWidth;                ///< Capture both edges and measure pulse width
+    bool noiseFilter;               ///< Enable the input capture noise filter
+};
+
+/*! Statistics of one window. Periods and pulse widths are in TCB clocks.
+ */
+struct tcbCaptureStats_s {
+    uint16_t periods;               ///< Periods measured, the window size
+    uint32_t periodMin;             ///< Shortest period
+    uint32_t periodMax;             ///< Longest period
+    uint32_t periodMean;            ///< Mean period
+    uint32_t frequency;             ///< Mean frequency in mHz
+    uint16_t widths;                ///< Pulse widths measured, 0 if not enabled
+    uint32_t widthMin;              ///< Shortest pulse width
+    uint32_t widthMax;              ///< Longest pulse width
+    uint32_t widthMean;             ///< Mean pulse width
+};
+
+
+/*** Public Functions --------------------------------------------------------*/
+/*! \publicsection */
+
+enum addStatus_e tcbCaptureStart(const struct tcbCaptureConfig_s *config);
+void tcbCaptureStop(void);
+bool tcbCaptureStatsReady(cbParam_t *param);
+bool tcbCaptureGetStats(struct tcbCaptureStats_s *stats);
+uint16_t tcbCaptureIdleTicks(void);
+uint16_t tcbCaptureGetDropped(void);
@@ -0,0 +1,108 @@
+/*! \file
+ *  telemetry.c
+ *  xenon-lib-tiny
+ *  Copyright (c) 2020 Martin Clemons
+ */
+#include "telemetry.h"
+#include <stddef.h>
+#include <avr/io.h>
+#include "util/atomic.h"
+#include "framing.h"
+
+
+/*** Private Global Variables ------------------------------------------------*/
+/*! \privatesection */
+
+/* Frame encoder and stream of the sample being transmitted, `NULL` if none. */
+static struct framingEncoder_s encoder;
+static struct telemetryStream_s * volatile activeStream;
+
+
+/*** Public Global Variables -------------------------------------------------*/
+/*! \publicsection */
+
+
+/*** Private Function Prototypes ---------------------------------------------*/
+/*! \privatesection */
+static void sendDone(uint16_t count);
+
+
+/*** Interrupt Service Routines (ISR) ----------------------------------------*/
+/*! \privatesection */
+
+
+/*** Private Functions -------------------------------------------------------*/
+/*! \privatesection */
+
+/*! Transmit job completion callback, called from DRE ISR.
+ */
+static void sendDone(uint16_t count)
+{
+    activeStream->busy = false;
+    activeStream = NULL;
+}
+
+
+/*** Public Functions --------------------------------------------------------*/
+/*! \publicsection */
+
+/*! Start encoding a sample, called by the generated encoder. Writes the
+ * header byte.
+ * @param stream Pointer to the stream.
+ * @param key Pointer where `true` is stored if this is a key sample.
+ * @return Returns `false` if the previous sample is still being transmitted,
+ * the sample is counted as dropped.
+ */
+bool telemetryBegin(struct telemetryStream_s *stream, bool *key)
+{
+    if (stream->busy) {
+        if (stream->dropped != UINT16_MAX) {
+            stream->dropped++;
+        }
+        return false;
+    }
+    *key = stream->sinceKey == 0;
+    stream->buffer[0] = stream->sequence << 1 | (*key ? 0x01 : 0x00);
+    return true;
+}
+
+/*! Finish a sample and start transmitting it, called by the generated
+ * encoder.
+ * @param stream Pointer to the stream.
+ * @param length Encoded sample length including the header byte.
+ * @return Returns `true` if transmission was started, `false` if another
+ * sample or USART0 transmit job is active. The next sample is then a key
+ * sample.
+ */
+bool telemetryEnd(struct telemetryStream_s *stream, uint8_t length)
+{
+    bool started = false;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (activeStream == NULL) {
+            stream->busy = true;
+            activeStream = stream;
+            started = true;
+        }
+    }
+    if (started) {
+        // the encoder is owned by this stream now, compute the CRC with
+        // interrupts enabled
+        framingEncoderInit(&encoder, FRAMING_COBS, stream->buffer, length);
+        started = framingUsartStart(&encoder, sendDone);
+        if (!started) {
+            ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                stream->busy = false;
+                activeStream = NULL;
+            }
+        }
+    }
+    if (!started) {
+        stream->sinceKey = 0;
+        return false;
+    }
+    stream->sequence = (stream->sequence + 1) & 0x7F;
+    if (++stream->sinceKey >= stream->keyInterval) {
+        stream->sinceKey = 0;
+    }
+    return true;
+}
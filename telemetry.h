@@ -0,0 +1,180 @@
+/*! \file
+ *  telemetry.h
+ *  xenon-lib-tiny
+ *  Copyright (c) 2020 Martin Clemons
+ *
+ *  Compact binary telemetry. The fields of a sample are listed once in an
+ *  X-macro, from which the sample struct, an encoder and a decoder are
+ *  generated:
+ *
+ *      #define SENSOR_FIELDS(X)                        \
+ *          X(uint32_t, time,    TELEMETRY_DELTA)       \
+ *          X(uint16_t, vbat,    TELEMETRY_DELTA)       \
+ *          X(int16_t,  current, TELEMETRY_ABSOLUTE)    \
+ *          X(uint8_t,  state,   TELEMETRY_ABSOLUTE)
+ *
+ *      TELEMETRY_STRUCT(sensor_s, SENSOR_FIELDS);
+ *      TELEMETRY_ENCODER(sensorEncode, sensor_s, SENSOR_FIELDS)
+ *
+ *  Each field is written as a LEB128 varint, signed values zigzag encoded.
+ *  `TELEMETRY_DELTA` fields are written as the difference to the previous
+ *  sample, except in key samples which are sent every `keyInterval` samples
+ *  so a receiver can synchronize. A sample starts with a header byte, bit 0
+ *  set in key samples and bits 7:1 a sequence number. Samples are sent as
+ *  COBS frames with CRC-16 (see `framing.h`) by the interrupt driven USART0
+ *  transmit path, encoding takes no allocation and is short enough to call
+ *  from a scheduler task every tick. Only integer field types are supported.
+ *  This header is also used by the host decoder `telemetry_decode.c`.
+ */
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+
+/*** Public Variables --------------------------------------------------------*/
+/*! \publicsection */
+
+/*! Field coding, the third argument of each X-macro entry.
+ */
+#define TELEMETRY_ABSOLUTE      0   ///< Field value is sent
+#define TELEMETRY_DELTA         1   ///< Difference to the previous sample is sent
+
+/*! Telemetry stream state, allocated by the caller. Initialize with
+ * `TELEMETRY_STREAM_INIT()`.
+ */
+struct telemetryStream_s {
+    uint8_t *buffer;            ///< Buffer for one encoded sample
+    uint8_t size;               ///< Size of `buffer`, at least `TELEMETRY_MAX_SIZE()`
+    uint8_t keyInterval;        ///< Samples between key samples, 1 for key samples only
+    uint8_t sinceKey;           ///< Samples sent since the last key sample
+    uint8_t sequence;           ///< Sequence number of the next sample
+    uint16_t dropped;           ///< Samples dropped while the last sample was sent
+    volatile bool busy;         ///< Set while a sample is being transmitted
+};
+
+/*! Initializer for a `telemetryStream_s` with a statically allocated buffer.
+ */
+#define TELEMETRY_STREAM_INIT(buf, interval) \
+    { .buffer = (buf), .size = sizeof(buf), .keyInterval = (interval) }
+
+/*! Declare the sample struct `struct sname` with one member per field.
+ */
+#define TELEMETRY_MEMBER_(type, name, coding)   type name;
+#define TELEMETRY_STRUCT(sname, FIELDS)         struct sname { FIELDS(TELEMETRY_MEMBER_) }
+
+/*! Largest encoded sample size in bytes: header byte, and a varint of at most
+ * one byte more than the field size for each field.
+ */
+#define TELEMETRY_SIZE_(type, name, coding)     + sizeof(type) + 1
+#define TELEMETRY_MAX_SIZE(FIELDS)              (1 FIELDS(TELEMETRY_SIZE_))
+
+/*! Define the encoder `bool fname(const struct sname *s, struct sname *prev,
+ * struct telemetryStream_s *stream)`. Encodes `s` and starts transmitting it,
+ * then copies `s` to `prev`, which holds the reference for delta fields.
+ * Returns `false` and counts the sample as dropped if the previous sample is
+ * still being transmitted; `prev` is not changed then.
+ */
+#define TELEMETRY_ENCODE_(type, name, coding) \
+    p = telemetryPutVarint(p, (coding) == TELEMETRY_DELTA && !key ? \
+            telemetryZigzag(telemetrySignExtend((uint32_t)s->name - (uint32_t)prev->name, sizeof(type))) : \
+            (type)-1 < 0 ? telemetryZigzag((int32_t)s->name) : (uint32_t)s->name);
+#define TELEMETRY_ENCODER(fname, sname, FIELDS) \
+    bool fname(const struct sname *s, struct sname *prev, struct telemetryStream_s *stream) \
+    { \
+        bool key; \
+        if (stream->size < TELEMETRY_MAX_SIZE(FIELDS) || !telemetryBegin(stream, &key)) { \
+            return false; \
+        } \
+        uint8_t *p = stream->buffer + 1; \
+        FIELDS(TELEMETRY_ENCODE_) \
+        *prev = *s; \
+        return telemetryEnd(stream, p - stream->buffer); \
+    }
+
+/*! Define the decoder `bool fname(struct sname *s, const uint8_t *data,
+ * const uint8_t *end, bool key)` for the fields following the header byte.
+ * `s` holds the previous sample on entry and is updated in place. Returns
+ * `false` if the data is truncated.
+ */
+#define TELEMETRY_DECODE_(type, name, coding) \
+    if ((data = telemetryGetVarint(data, end, &v)) == NULL) { \
+        return false; \
+    } \
+    if ((coding) == TELEMETRY_DELTA && !key) { \
+        s->name = (type)((uint32_t)s->name + (uint32_t)telemetryUnzigzag(v)); \
+    } else { \
+        s->name = (type)-1 < 0 ? (type)telemetryUnzigzag(v) : (type)v; \
+    }
+#define TELEMETRY_DECODER(fname, sname, FIELDS) \
+    bool fname(struct sname *s, const uint8_t *data, const uint8_t *end, bool key) \
+    { \
+        uint32_t v; \
+        FIELDS(TELEMETRY_DECODE_) \
+        return data == end; \
+    }
+
+
+/*** Public Functions --------------------------------------------------------*/
+/*! \publicsection */
+
+bool telemetryBegin(struct telemetryStream_s *stream, bool *key);
+bool telemetryEnd(struct telemetryStream_s *stream, uint8_t length);
+
+/*! Zigzag encode a signed value, so values close to zero encode short.
+ */
+static inline uint32_t telemetryZigzag(int32_t value)
+{
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+/*! Decode a zigzag encoded value.
+ */
+static inline int32_t telemetryUnzigzag(uint32_t value)
+{
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 0x01);
+}
+
+/*! Sign extend the low `size` bytes of a value, so the difference of two
+ * field values wraps at the field width.
+ */
+static inline int32_t telemetrySignExtend(uint32_t value, uint8_t size)
+{
+    uint8_t shift = 32 - 8 * size;
+    return (int32_t)(value << shift) >> shift;
+}
+
+/*! Write a LEB128 varint, 7 bits per byte, least significant group first.
+ * @return Pointer past the last byte written.
+ */
+static inline uint8_t *telemetryPutVarint(uint8_t *p, uint32_t value)
+{
+    while (value >= 0x80) {
+        *p++ = (uint8_t)value | 0x80;
+        value >>= 7;
+    }
+    *p++ = value;
+    return p;
+}
+
+/*! Read a LEB128 varint.
+ * @param p Pointer to the first byte.
+ * @param end Pointer past the end of the data.
+ * @param value Pointer where the value is stored.
+ * @return Pointer past the varint, `NULL` if the data is truncated.
+ */
+static inline const uint8_t *telemetryGetVarint(const uint8_t *p, const uint8_t *end,
+                                                uint32_t *value)
+{
+    uint32_t v = 0;
+    for (uint8_t shift = 0; p < end && shift < 35; shift += 7) {
+        uint8_t b = *p++;
+        v |= (uint32_t)(b & 0x7F) << shift;
+        if ((b & 0x80) == 0) {
+            *value = v;
+            return p;
+        }
+    }
+    return NULL;
+}
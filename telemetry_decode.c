@@ -0,0 +1,148 @@
+/*! \file
+ *  telemetry_decode.c
+ *  xenon-lib-tiny
+ *  Copyright (c) 2020 Martin Clemons
+ *
+ *  Host program which decodes a telemetry stream (see `telemetry.h`) read
+ *  from standard input, for example a serial port, and writes the samples to
+ *  standard output as CSV. The schema header and field list are selected at
+ *  build time, e.g.:
+ *
+ *      cc -DTELEMETRY_SCHEMA='"sensor.h"' -DTELEMETRY_FIELDS=SENSOR_FIELDS \
+ *         -o telemetry_decode telemetry_decode.c
+ *      stty -F /dev/ttyUSB0 raw 115200 && telemetry_decode < /dev/ttyUSB0
+ *
+ *  Frames with a CRC error are reported on standard error. After a lost
+ *  frame, delta coded samples are skipped until the next key sample.
+ *  This file is not part of the target build.
+ */
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "telemetry.h"
+#include TELEMETRY_SCHEMA
+
+// largest frame: COBS overhead is not stored, payload and CRC only
+#define FRAME_MAX   (TELEMETRY_MAX_SIZE(TELEMETRY_FIELDS) + 2)
+
+
+/*** Private Global Variables ------------------------------------------------*/
+/*! \privatesection */
+
+TELEMETRY_STRUCT(sample_s, TELEMETRY_FIELDS);
+
+static TELEMETRY_DECODER(decode, sample_s, TELEMETRY_FIELDS)
+
+
+/*** Private Functions -------------------------------------------------------*/
+/*! \privatesection */
+
+/*! CRC-16/CCITT (polynomial 0x1021), same as `_crc_xmodem_update()`.
+ */
+static uint16_t crcUpdate(uint16_t crc, uint8_t data)
+{
+    crc ^= (uint16_t)data << 8;
+    for (uint8_t i = 0; i < 8; i++) {
+        crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+
+#define CSV_HEADER_(type, name, coding)     printf(",%s", #name);
+#define CSV_ROW_(type, name, coding)        printf(",%lld", (long long)s->name);
+
+/*! Decode a frame payload and print it as CSV row.
+ * @param s The previous sample, updated in place.
+ * @param frame The payload without CRC.
+ * @param length Payload length.
+ * @param synced Set while the previous sample is valid.
+ * @return Returns `true` if the sample was decoded.
+ */
+static bool printSample(struct sample_s *s, const uint8_t *frame, uint16_t length, bool synced)
+{
+    if (length < 1) {
+        return false;
+    }
+    bool key = frame[0] & 0x01;
+    if (!key && !synced) {
+        return false;
+    }
+    if (!decode(s, frame + 1, frame + length, key)) {
+        fprintf(stderr, "malformed sample\n");
+        return false;
+    }
+    printf("%u,%u", frame[0] >> 1, key);
+    TELEMETRY_FIELDS(CSV_ROW_)
+    printf("\n");
+    return true;
+}
+
+
+/*** Public Functions --------------------------------------------------------*/
+/*! \publicsection */
+
+int main(void)
+{
+    static uint8_t frame[FRAME_MAX];
+    struct sample_s sample;
+    memset(&sample, 0, sizeof(sample));
+    uint16_t length = 0;
+    uint8_t remaining = 0;
+    bool pendingZero = false;
+    bool discard = false;
+    bool synced = false;
+    int expected = -1;
+    int c;
+
+    printf("sequence,key");
+    TELEMETRY_FIELDS(CSV_HEADER_)
+    printf("\n");
+    while ((c = getchar()) != EOF) {
+        if (c == 0) {
+            // frame delimiter, the CRC of payload and CRC is zero
+            uint16_t crc = 0xFFFF;
+            for (uint16_t i = 0; i < length; i++) {
+                crc = crcUpdate(crc, frame[i]);
+            }
+            if (!discard && remaining == 0 && length >= 2 && crc == 0) {
+                int sequence = frame[0] >> 1;
+                if (expected >= 0 && sequence != expected) {
+                    fprintf(stderr, "lost %d frames\n", (sequence - expected) & 0x7F);
+                    synced = false;
+                }
+                synced = printSample(&sample, frame, length - 2, synced);
+                expected = (sequence + 1) & 0x7F;
+            } else if (!discard && length > 0) {
+                fprintf(stderr, "frame error\n");
+                synced = false;
+            }
+            fflush(stdout);
+            length = 0;
+            remaining = 0;
+            pendingZero = false;
+            discard = false;
+            continue;
+        }
+        if (discard) {
+            continue;
+        }
+        if (remaining == 0) {
+            if (pendingZero) {
+                if (length == FRAME_MAX) {
+                    discard = true;
+                    continue;
+                }
+                frame[length++] = 0;
+            }
+            pendingZero = c != 0xFF;
+            remaining = c - 1;
+        } else if (length < FRAME_MAX) {
+            frame[length++] = c;
+            remaining--;
+        } else {
+            discard = true;
+        }
+    }
+    return 0;
+}
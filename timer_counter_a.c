@@ -4,11 +4,17 @@
  *  Copyright (c) 2020 Martin Clemons
  */
 #include "timer_counter_a.h"
+#include "sleep_manager.h"
+#include "clock.h"
 
 
 /*** Private Global Variables ------------------------------------------------*/
 /*! \privatesection */
 
+/* Split mode compare registers written last, so unchanged channels are not
+ * written again. */
+static uint8_t splitDuty[TCA_SPLIT_CHANNELS];
+
 
 /*** Public Global Variables -------------------------------------------------*/
 /*! \publicsection */
@@ -16,6 +22,9 @@
 
 /*** Private Function Prototypes ---------------------------------------------*/
 /*! \privatesection */
+static uint16_t nextTop(void);
+static inline register8_t *splitCompare(uint8_t channel);
+static uint8_t scale8(uint8_t value, uint32_t from, uint32_t to);
 
 
 /*** Interrupt Service Routines (ISR) ----------------------------------------*/
@@ -25,12 +34,45 @@
 /*** Private Functions -------------------------------------------------------*/
 /*! \privatesection */
 
+/*! Get the compare value for 100% duty cycle with the period in effect after
+ * the next UPDATE: `PER + 1` in single-slope mode, the output is set at
+ * BOTTOM and cleared at the compare match, and `PER` in dual-slope modes.
+ */
+static uint16_t nextTop(void)
+{
+    uint16_t top = TCA0.SINGLE.CTRLFSET & TCA_SINGLE_PERBV_bm ?
+            TCA0.SINGLE.PERBUF : TCA0.SINGLE.PER;
+    if ((TCA0.SINGLE.CTRLB & TCA_SINGLE_WGMODE_gm) == TCA_SINGLE_WGMODE_SINGLESLOPE_gc &&
+            top != UINT16_MAX) {
+        top++;
+    }
+    return top;
+}
+
+/*! Get the split mode compare register of a channel. Low and high compare
+ * registers are interleaved: `LCMP0`, `HCMP0`, `LCMP1`, ...
+ */
+static inline register8_t *splitCompare(uint8_t channel)
+{
+    return channel < 3 ? &(&TCA0.SPLIT.LCMP0)[channel * 2] :
+            &(&TCA0.SPLIT.HCMP0)[(channel - 3) * 2];
+}
+
+/*! Scale an 8-bit period or compare value to a new clock, limited to 255.
+ */
+static uint8_t scale8(uint8_t value, uint32_t from, uint32_t to)
+{
+    uint16_t v = clockScale16(value, from, to);
+    return v > UINT8_MAX ? UINT8_MAX : v;
+}
+
 
 /*** Public Functions --------------------------------------------------------*/
 /*! \publicsection */
 
 /*! Directly set Timer/Counter A Period register. Bypass buffer registers and
- * set `PER` registers directly. Not recommended when timer is running.
+ * set `PER` registers directly. Not recommended when timer is running, see
+ * `timerCounterASetPeriodBuffered()`.
  * @param period The value to set `PER` registers to.
  */
 void timerCounterASetPeriod(uint16_t period)
@@ -39,7 +81,8 @@ void timerCounterASetPeriod(uint16_t period)
 }
 
 /*! Directly set Timer/Counter A Compare registers. Bypass buffer registers and
- * set `CMP0`, `CMP1`, and `CMP2` registers directly. Not recommended when timer is running.
+ * set `CMP0`, `CMP1`, and `CMP2` registers directly. Not recommended when timer is running,
+ * see `timerCounterASetCompareBuffered()`.
  * @param compare Array of 3 uint16_t values to set CMP registers to. `CMP0` is
  * set to the first element in the array (compare[0]), `CMP1` is set to the second
  * element in the array, and `CMP2` is set to the third element in the array.
@@ -51,6 +94,150 @@ void timerCounterASetCompare(const uint16_t compare[3])
     TCA0.SINGLE.CMP2 = compare[2];
 }
 
+/*! Lock buffered updates. While locked, the buffer registers are not copied
+ * to `PER` and `CMPn` at UPDATE (`LUPD` bit in `CTRLE`), so values written
+ * with the buffered functions take effect together at the first UPDATE after
+ * `timerCounterAUnlockUpdate()`.
+ */
+void timerCounterALockUpdate(void)
+{
+    TCA0.SINGLE.CTRLESET = TCA_SINGLE_LUPD_bm;
+}
+
+/*! Unlock buffered updates, see `timerCounterALockUpdate()`.
+ */
+void timerCounterAUnlockUpdate(void)
+{
+    TCA0.SINGLE.CTRLECLR = TCA_SINGLE_LUPD_bm;
+}
+
+/*! Set the Timer/Counter A period through `PERBUF`. The period changes at the
+ * next UPDATE condition (counter at TOP or BOTTOM depending on the waveform
+ * mode), so the current PWM cycle is not cut short. Use
+ * `timerCounterALockUpdate()` to change period and compare values together.
+ * @param period The value for `PER`.
+ */
+void timerCounterASetPeriodBuffered(uint16_t period)
+{
+    TCA0.SINGLE.PERBUF = period;
+}
+
+/*! Set all three Timer/Counter A compare values through `CMPnBUF`. Updates
+ * are locked while the buffers are written, so all channels change at the
+ * same UPDATE condition. A lock held by the caller is kept.
+ * @param compare Array of 3 values for `CMP0`, `CMP1` and `CMP2`.
+ */
+void timerCounterASetCompareBuffered(const uint16_t compare[3])
+{
+    uint8_t locked = TCA0.SINGLE.CTRLESET & TCA_SINGLE_LUPD_bm;
+    TCA0.SINGLE.CTRLESET = TCA_SINGLE_LUPD_bm;
+    TCA0.SINGLE.CMP0BUF = compare[0];
+    TCA0.SINGLE.CMP1BUF = compare[1];
+    TCA0.SINGLE.CMP2BUF = compare[2];
+    if (!locked) {
+        TCA0.SINGLE.CTRLECLR = TCA_SINGLE_LUPD_bm;
+    }
+}
+
+/*! Set one Timer/Counter A compare value through its `CMPnBUF` register. It
+ * takes effect at the next UPDATE condition.
+ * @param channel Compare channel 0 to 2.
+ * @param compare The value for `CMPn`.
+ */
+void timerCounterASetChannelCompareBuffered(uint8_t channel, uint16_t compare)
+{
+    (&TCA0.SINGLE.CMP0BUF)[channel] = compare;
+}
+
+/*! Compute the compare value for a duty cycle from the period in effect after
+ * the next UPDATE, including a buffered period not yet applied. In
+ * dual-slope modes the duty cycle is relative to `PER`, in single-slope mode
+ * to `PER + 1`.
+ * @param duty Duty cycle, 0 to `TCA_DUTY_MAX` (100%), larger values are
+ * limited.
+ * @return The compare value.
+ */
+uint16_t timerCounterADutyToCompare(uint16_t duty)
+{
+    if (duty > TCA_DUTY_MAX) {
+        duty = TCA_DUTY_MAX;
+    }
+    return ((uint32_t)nextTop() * duty) >> 15;
+}
+
+/*! Set the duty cycles of all three Timer/Counter A channels, changed together
+ * at the next UPDATE condition. Set the period first if it changes too.
+ * @param duty Array of 3 duty cycles, see `timerCounterADutyToCompare()`.
+ */
+void timerCounterASetDuty(const uint16_t duty[3])
+{
+    uint16_t compare[3];
+    for (uint8_t i = 0; i < 3; i++) {
+        compare[i] = timerCounterADutyToCompare(duty[i]);
+    }
+    timerCounterASetCompareBuffered(compare);
+}
+
+/*! Set the duty cycle of one Timer/Counter A channel, changed at the next
+ * UPDATE condition.
+ * @param channel Compare channel 0 to 2.
+ * @param duty Duty cycle, see `timerCounterADutyToCompare()`.
+ */
+void timerCounterASetChannelDuty(uint8_t channel, uint16_t duty)
+{
+    timerCounterASetChannelCompareBuffered(channel, timerCounterADutyToCompare(duty));
+}
+
+/*! Configure Timer/Counter A in split mode with up to six 8-bit PWM
+ * outputs, see `timerCounterASplitConfig_s`. TCA is disabled and reset
+ * first, all compare values start at 0. Enable TCA with
+ * `timerCounterAEnable()` afterwards. The PORTMUX and pin direction of the
+ * outputs are set by the application.
+ * @param config Pointer to `timerCounterASplitConfig_s` with the configuration.
+ */
+void timerCounterAConfigSplit(const struct timerCounterASplitConfig_s *config)
+{
+    TCA0.SINGLE.CTRLA &= ~TCA_SINGLE_ENABLE_bm;
+    TCA0.SINGLE.CTRLESET = TCA_SINGLE_CMD_RESET_gc;
+    TCA0.SPLIT.CTRLD = TCA_SPLIT_SPLITM_bm;
+    TCA0.SPLIT.LPER = config->lowPeriod;
+    TCA0.SPLIT.HPER = config->highPeriod;
+    for (uint8_t i = 0; i < TCA_SPLIT_CHANNELS; i++) {
+        *splitCompare(i) = 0;
+        splitDuty[i] = 0;
+    }
+    // LCMPnEN in bits 0 to 2, HCMPnEN in bits 4 to 6
+    TCA0.SPLIT.CTRLB = (config->outputs & 0x07) | (config->outputs & 0x38) << 1;
+    TCA0.SPLIT.CTRLA = config->prescale;
+}
+
+/*! Set the duty cycle of one split mode channel. The output is high for about
+ * `duty` counts of each PWM cycle of `period + 1` counts of its timer. The
+ * compare register is written directly and takes effect within the current
+ * cycle.
+ * @param channel Channel 0 to 5 (WO0 to WO5).
+ * @param duty The compare value.
+ */
+void timerCounterASplitSetDuty(uint8_t channel, uint8_t duty)
+{
+    *splitCompare(channel) = duty;
+    splitDuty[channel] = duty;
+}
+
+/*! Set the duty cycles of all six split mode channels. Only channels whose
+ * value changed since the last write are written, back to back.
+ * @param duty Array of 6 compare values, see `timerCounterASplitSetDuty()`.
+ */
+void timerCounterASplitUpdate(const uint8_t duty[TCA_SPLIT_CHANNELS])
+{
+    for (uint8_t i = 0; i < TCA_SPLIT_CHANNELS; i++) {
+        if (duty[i] != splitDuty[i]) {
+            *splitCompare(i) = duty[i];
+            splitDuty[i] = duty[i];
+        }
+    }
+}
+
 /*! Get the counter value for Timer/Counter A.
  * @return The 16-bit counter value.
  */
@@ -67,8 +254,10 @@ uint16_t timerCounterAGetCounter(void)
  */
 void timerCounterAConfig(const struct timerCounterAConfig_s *config)
 {
-    // set prescale/clock select in CTRLA
+    // set prescale/clock select in CTRLA, this disables TCA
     TCA0.SINGLE.CTRLA = config->prescale;
+    // leave split mode
+    TCA0.SINGLE.CTRLD = 0;
     // set waveform mode in CTRLB
     TCA0.SINGLE.CTRLB = config->waveformMode;
 }
@@ -99,9 +288,55 @@ void timerCounterADisableEventAction(void)
 }
 
 /*! Enable Timer/Counter A. This function sets the `ENABLE` bit in
- * the `CTRLA` register.
+ * the `CTRLA` register. TCA does not run in standby, the sleep manager is kept
+ * out of modes deeper than idle until TCA is disabled.
  */
 void timerCounterAEnable(void)
 {
     TCA0.SINGLE.CTRLA |= TCA_SINGLE_ENABLE_bm;
+    sleepMgrSetLevel(SLEEP_MGR_CLIENT_TCA0, SLEEP_MGR_IDLE);
+}
+
+/*! Disable Timer/Counter A. This function clears the `ENABLE` bit in
+ * the `CTRLA` register.
+ */
+void timerCounterADisable(void)
+{
+    TCA0.SINGLE.CTRLA &= ~TCA_SINGLE_ENABLE_bm;
+    sleepMgrSetLevel(SLEEP_MGR_CLIENT_TCA0, SLEEP_MGR_POWER_DOWN);
+}
+
+/*! Recompute the Timer/Counter A period and compare values after a peripheral
+ * clock change. The function signature is compatible with `clockGovAddClient()`.
+ * Values are scaled proportionally to the clock change so the timer period and
+ * duty cycles are kept, and written to the buffer registers with updates
+ * locked so they take effect together at the next UPDATE condition.
+ * In split mode the 8-bit periods and compare values are scaled the same way
+ * and limited to 255, they are written directly.
+ * @param from The old peripheral clock frequency.
+ * @param to The new peripheral clock frequency.
+ * @param param Task scheduler parameter (not used).
+ */
+void timerCounterARescaleClock(uint32_t from, uint32_t to, cbParam_t *param)
+{
+    if (TCA0.SPLIT.CTRLD & TCA_SPLIT_SPLITM_bm) {
+        TCA0.SPLIT.LPER = scale8(TCA0.SPLIT.LPER, from, to);
+        TCA0.SPLIT.HPER = scale8(TCA0.SPLIT.HPER, from, to);
+        for (uint8_t i = 0; i < TCA_SPLIT_CHANNELS; i++) {
+            splitDuty[i] = scale8(splitDuty[i], from, to);
+            *splitCompare(i) = splitDuty[i];
+        }
+        return;
+    }
+    uint16_t compare[3];
+    compare[0] = clockScale16(TCA0.SINGLE.CMP0, from, to);
+    compare[1] = clockScale16(TCA0.SINGLE.CMP1, from, to);
+    compare[2] = clockScale16(TCA0.SINGLE.CMP2, from, to);
+    uint8_t locked = TCA0.SINGLE.CTRLESET & TCA_SINGLE_LUPD_bm;
+    TCA0.SINGLE.CTRLESET = TCA_SINGLE_LUPD_bm;
+    TCA0.SINGLE.PERBUF = clockScale16(TCA0.SINGLE.PER, from, to);
+    timerCounterASetCompareBuffered(compare);
+    if (!locked) {
+        TCA0.SINGLE.CTRLECLR = TCA_SINGLE_LUPD_bm;
+    }
 }
@@ -10,6 +10,7 @@
 #include <inttypes.h>
 #include <stdbool.h>
 #include <avr/io.h>
+#include "task_scheduler.h"
 
 
 /*** Public Variables --------------------------------------------------------*/
@@ -19,13 +20,13 @@
  */
 enum timerCounterAPrescale_e {
     TCA_PRESCALE_DIV1               = TCA_SINGLE_CLKSEL_DIV1_gc,    ///< Prescale factor 1
-    TCA_PRESCALE_DIV2               = TCA_SINGLE_CLKSEL_DIV1_gc,    ///< Prescale factor 2
-    TCA_PRESCALE_DIV4               = TCA_SINGLE_CLKSEL_DIV1_gc,    ///< Prescale factor 4
-    TCA_PRESCALE_DIV8               = TCA_SINGLE_CLKSEL_DIV1_gc,    ///< Prescale factor 8
-    TCA_PRESCALE_DIV16              = TCA_SINGLE_CLKSEL_DIV1_gc,    ///< Prescale factor 16
-    TCA_PRESCALE_DIV64              = TCA_SINGLE_CLKSEL_DIV1_gc,    ///< Prescale factor 64
-    TCA_PRESCALE_DIV256             = TCA_SINGLE_CLKSEL_DIV1_gc,    ///< Prescale factor 256
-    TCA_PRESCALE_DIV1024            = TCA_SINGLE_CLKSEL_DIV1_gc,    ///< Prescale factor 1024
+    TCA_PRESCALE_DIV2               = TCA_SINGLE_CLKSEL_DIV2_gc,    ///< Prescale factor 2
+    TCA_PRESCALE_DIV4               = TCA_SINGLE_CLKSEL_DIV4_gc,    ///< Prescale factor 4
+    TCA_PRESCALE_DIV8               = TCA_SINGLE_CLKSEL_DIV8_gc,    ///< Prescale factor 8
+    TCA_PRESCALE_DIV16              = TCA_SINGLE_CLKSEL_DIV16_gc,   ///< Prescale factor 16
+    TCA_PRESCALE_DIV64              = TCA_SINGLE_CLKSEL_DIV64_gc,   ///< Prescale factor 64
+    TCA_PRESCALE_DIV256             = TCA_SINGLE_CLKSEL_DIV256_gc,  ///< Prescale factor 256
+    TCA_PRESCALE_DIV1024            = TCA_SINGLE_CLKSEL_DIV1024_gc, ///< Prescale factor 1024
 };
 
 /*! Timer/Counter A Waveform Mode (normal, non-split)
@@ -54,6 +55,29 @@ struct timerCounterAConfig_s {
     enum timerCounterAWaveformMode_e waveformMode;
 };
 
+/*! Timer/Counter A split mode configuration. In split mode TCA is two 8-bit
+ * down-counting timers with a common prescaler, each with three single-slope
+ * PWM channels. Channels 0 to 2 (WO0 to WO2) use the low timer, channels 3 to
+ * 5 (WO3 to WO5) the high timer. Split mode registers are not buffered.
+ */
+struct timerCounterASplitConfig_s {
+    enum timerCounterAPrescale_e prescale;
+    uint8_t lowPeriod;                  ///< Low timer period, PWM cycle is `lowPeriod + 1` counts
+    uint8_t highPeriod;                 ///< High timer period
+    uint8_t outputs;                    ///< Enabled PWM outputs, bit n for channel n (WOn)
+};
+
+#define TCA_SPLIT_CHANNELS          6   ///< Number of split mode PWM channels
+
+/*! Duty cycle of 100% for `timerCounterASetDuty()`. Duty cycles are unsigned
+ * 1.15 fixed-point fractions of the period, 0 to `TCA_DUTY_MAX`.
+ */
+#define TCA_DUTY_MAX                0x8000U
+
+/*! Convert a duty cycle in percent to fixed-point, for constant values.
+ */
+#define TCA_DUTY_PERCENT(p)         ((uint16_t)((p) * (uint32_t)TCA_DUTY_MAX / 100))
+
 
 
 /*** Public Functions --------------------------------------------------------*/
@@ -61,9 +85,22 @@ struct timerCounterAConfig_s {
 
 void timerCounterASetPeriod(uint16_t period);
 void timerCounterASetCompare(const uint16_t compare[3]);
+void timerCounterALockUpdate(void);
+void timerCounterAUnlockUpdate(void);
+void timerCounterASetPeriodBuffered(uint16_t period);
+void timerCounterASetCompareBuffered(const uint16_t compare[3]);
+void timerCounterASetChannelCompareBuffered(uint8_t channel, uint16_t compare);
+uint16_t timerCounterADutyToCompare(uint16_t duty);
+void timerCounterASetDuty(const uint16_t duty[3]);
+void timerCounterASetChannelDuty(uint8_t channel, uint16_t duty);
+void timerCounterAConfigSplit(const struct timerCounterASplitConfig_s *config);
+void timerCounterASplitSetDuty(uint8_t channel, uint8_t duty);
+void timerCounterASplitUpdate(const uint8_t duty[TCA_SPLIT_CHANNELS]);
 uint16_t timerCounterAGetCounter(void);
 void timerCounterAConfig(const struct timerCounterAConfig_s *config);
 void timerCounterAConfigEventAction(const enum timerCounterAEventAction_e action);
 void timerCounterAEnableEventAction(void);
 void timerCounterADisableEventAction(void);
 void timerCounterAEnable(void);
+void timerCounterADisable(void);
+void timerCounterARescaleClock(uint32_t from, uint32_t to, cbParam_t *param);
@@ -4,6 +4,8 @@
  *  Copyright (c) 2020 Martin Clemons
  */
 #include "timer_counter_b.h"
+#include "sleep_manager.h"
+#include "clock.h"
 
 
 /*** Private Global Variables ------------------------------------------------*/
@@ -25,6 +27,15 @@
 /*** Private Functions -------------------------------------------------------*/
 /*! \privatesection */
 
+/*! Get the sleep manager client for a TCB peripheral.
+ * @param tcb Pointer to TCB peripheral.
+ * @return The sleep manager client.
+ */
+static inline enum sleepMgrClient_e sleepClient(TCB_t *tcb)
+{
+    return tcb == &TCB0 ? SLEEP_MGR_CLIENT_TCB0 : SLEEP_MGR_CLIENT_TCB1;
+}
+
 
 /*** Public Functions --------------------------------------------------------*/
 /*! \publicsection */
@@ -47,7 +58,8 @@ void timerCounterBSetCounter(TCB_t *tcb, const uint16_t cnt)
     tcb->CNT = cnt;
 }
 
-/*! Get Timer/Counter B capture/compare value.
+/*! Get Timer/Counter B capture/compare value. For continuous measurements
+ * without polling see `tcb_capture.h`.
  * @param tcb Pointer to TCB peripheral.
  * @return The capture/compare value.
  */
@@ -96,12 +108,15 @@ void timerCounterBConfig(TCB_t *tcb, const struct timerCounterBConfig_s *config)
     tcb->CTRLA = config->clockSource;
 }
 
-/*! Enable (start) Timer/Counter B.
+/*! Enable (start) Timer/Counter B. If the `RUNSTDBY` bit is set the sleep
+ * manager may enter standby, otherwise it is kept out of modes deeper than idle.
  * @param tcb Pointer to the TCB peripheral.
  */
 void timerCounterBEnable(TCB_t *tcb)
 {
     tcb->CTRLA |= TCB_ENABLE_bm;
+    sleepMgrSetLevel(sleepClient(tcb), bit_is_set(tcb->CTRLA, TCB_RUNSTDBY_bp) ?
+            SLEEP_MGR_STANDBY : SLEEP_MGR_IDLE);
 }
 
 /*! Disable (stop) Timer/Counter B.
@@ -110,4 +125,36 @@ void timerCounterBEnable(TCB_t *tcb)
 void timerCounterBDisable(TCB_t *tcb)
 {
     tcb->CTRLA &= ~TCB_ENABLE_bm;
+    sleepMgrSetLevel(sleepClient(tcb), SLEEP_MGR_POWER_DOWN);
+}
+
+/*! Recompute the Timer/Counter B compare value after a peripheral clock
+ * change. The function signature is compatible with `clockGovAddClient()`.
+ * In periodic interrupt, time-out check and single shot modes `CCMP` is scaled
+ * proportionally to the clock change. In 8-bit PWM mode period and duty cycle
+ * bytes are scaled individually. `CCMP` holds a capture value in the other
+ * modes and is not changed.
+ * @param from The old peripheral clock frequency.
+ * @param to The new peripheral clock frequency.
+ * @param param Parameter with `void_ptr` set to the TCB peripheral.
+ */
+void timerCounterBRescaleClock(uint32_t from, uint32_t to, cbParam_t *param)
+{
+    TCB_t *tcb = param->void_ptr;
+    switch (tcb->CTRLB & TCB_CNTMODE_gm) {
+        case TCB_MODE_PERIODIC_INTERRUPT:
+        case TCB_MODE_TIMEOUT_CHECK:
+        case TCB_MODE_SINGLE_SHOT:
+            tcb->CCMP = clockScale16(tcb->CCMP, from, to);
+            break;
+        case TCB_MODE_PWM: {
+            uint16_t per = clockScale16(tcb->CCMPL, from, to);
+            uint16_t duty = clockScale16(tcb->CCMPH, from, to);
+            tcb->CCMPL = per > 0xFF ? 0xFF : per;
+            tcb->CCMPH = duty > 0xFF ? 0xFF : duty;
+            break;
+        }
+        default:
+            break;
+    }
 }
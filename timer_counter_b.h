@@ -10,6 +10,7 @@
 #include <inttypes.h>
 #include <stdbool.h>
 #include <avr/io.h>
+#include "task_scheduler.h"
 
 
 /*** Public Variables --------------------------------------------------------*/
@@ -66,3 +67,4 @@ void timerCounterBConfigInterrupts(TCB_t *tcb, const bool captureInterruptEnable
 void timerCounterBConfig(TCB_t *tcb, const struct timerCounterBConfig_s *config);
 void timerCounterBEnable(TCB_t *tcb);
 void timerCounterBDisable(TCB_t *tcb);
+void timerCounterBRescaleClock(uint32_t from, uint32_t to, cbParam_t *param);
@@ -4,6 +4,7 @@
  *  Copyright (c) 2020 Martin Clemons
  */
 #include "timer_counter_d.h"
+#include "sleep_manager.h"
 
 /*
  22.3.2.1 Register Synchronization Categories
@@ -83,7 +84,8 @@ void timerCounterDConfig(struct timerCounterDConfig_s *config)
             config->syncPrescale;
 }
 
-/*! Enable Timer/Counter D.
+/*! Enable Timer/Counter D. TCD does not run in standby, the sleep manager is
+ * kept out of modes deeper than idle until TCD is disabled.
  * Note: This function blocks until the appropriate synchronization bit (`TCD_ENRDY`)
  * is set.
  */
@@ -91,6 +93,18 @@ void timerCounterDEnable(void)
 {
     loop_until_bit_is_set(TCD0.STATUS, TCD_ENRDY_bp);
     TCD0.CTRLA |= TCD_ENABLE_bm;
+    sleepMgrSetLevel(SLEEP_MGR_CLIENT_TCD0, SLEEP_MGR_IDLE);
+}
+
+/*! Disable Timer/Counter D.
+ * Note: This function blocks until the appropriate synchronization bit (`TCD_ENRDY`)
+ * is set.
+ */
+void timerCounterDDisable(void)
+{
+    loop_until_bit_is_set(TCD0.STATUS, TCD_ENRDY_bp);
+    TCD0.CTRLA &= ~TCD_ENABLE_bm;
+    sleepMgrSetLevel(SLEEP_MGR_CLIENT_TCD0, SLEEP_MGR_POWER_DOWN);
 }
 
 /*! Set Timer/Counter D compare registers.
@@ -157,6 +157,7 @@ struct timerCounterDConfig_s {
 void timerCounterDConfigEvents(struct timerCounterDEventConfig_s *config);
 void timerCounterDConfig(struct timerCounterDConfig_s *config);
 void timerCounterDEnable(void);
+void timerCounterDDisable(void);
 void timerCounterDSetCompareRegisters(struct timerCounterDCompareRegister_s *cmp);
 void timerCounterDSyncBuffers(enum timerCounterDSyncType_e type);
 uint16_t timerCounterDGetCaptureA(void);
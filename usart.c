@@ -3,8 +3,9 @@
  *  xenon-lib-tiny
  *  Copyright (c) 2020 Martin Clemons
  */
-#include <avr/sleep.h>
 #include "usart.h"
+#include "sleep_manager.h"
+#include "clock.h"
 
 
 /*** Private Global Variables ------------------------------------------------*/
@@ -62,6 +63,9 @@ void usartConfigInterrupts(struct usartInterruptConfig_s *config)
 /*! Configure the USART peripheral in asynchronous serial mode
  * @param config Pointer to `usartAsyncSerialConfig_s` with the desired USART
  * configuration options.
+ * The sleep manager is kept out of modes deeper than idle while the receiver or
+ * transmitter is enabled. A receiver with start frame detection can wake the
+ * CPU from standby, so standby is permitted if it is the only enabled function.
  */
 void usartConfigAsyncSerial(struct usartAsyncSerialConfig_s *config)
 {
@@ -80,6 +84,143 @@ void usartConfigAsyncSerial(struct usartAsyncSerialConfig_s *config)
             (config->txEnable ? USART_TXEN_bm : 0)                      |
             (config->startFrameDetectionEnable ? USART_SFDEN_bm : 0 )   |
             config->baudMode;
+    if (config->txEnable || (config->rxEnable && !config->startFrameDetectionEnable)) {
+        sleepMgrSetLevel(SLEEP_MGR_CLIENT_USART0, SLEEP_MGR_IDLE);
+    } else if (config->rxEnable) {
+        sleepMgrSetLevel(SLEEP_MGR_CLIENT_USART0, SLEEP_MGR_STANDBY);
+    } else {
+        sleepMgrSetLevel(SLEEP_MGR_CLIENT_USART0, SLEEP_MGR_POWER_DOWN);
+    }
+}
+
+/*! Configure and enable the USART in master SPI mode (MSPI), as a second SPI
+ * bus independent of SPI0. The transmit data register and the shift register
+ * give the same two byte transmit buffering as the SPI peripheral in buffered
+ * mode, so the transfer functions `usartSpiIo()` etc. keep SCK running
+ * between bytes.
+ * @param config Pointer to `usartMasterSpiConfig_s` with the desired
+ * configuration.
+ * Note: function does not set the data direction of the TXD (MOSI) and XCK
+ * (SCK) pins or the XCK pin `INVEN` bit, and there is no hardware chip select.
+ * The sleep manager is kept out of modes deeper than idle until
+ * `usartDisable()` is called.
+ */
+void usartConfigMasterSpi(struct usartMasterSpiConfig_s *config)
+{
+    // clear interrupt status bits and RS485 mode bits
+    USART0.STATUS = USART_TXCIF_bm | USART_RXSIF_bm | USART_ISFIF_bm | USART_BDF_bm;
+    USART0.CTRLA &= ~0x03;
+    USART0.CTRLC = USART_CMODE_MSPI_gc | config->dataOrder | config->transferMode;
+    USART0.BAUD = config->baudPrescale < (1 << 6) ? (1 << 6) : config->baudPrescale;
+    USART0.CTRLB = USART_RXEN_bm | USART_TXEN_bm;
+    usartFlush();
+    sleepMgrSetLevel(SLEEP_MGR_CLIENT_USART0, SLEEP_MGR_IDLE);
+}
+
+/*! Disable the USART receiver and transmitter, permitting the sleep manager
+ * to enter power-down.
+ * Note: A byte still being transmitted is aborted, check `TXCIF` first.
+ */
+void usartDisable(void)
+{
+    USART0.CTRLB &= ~(USART_RXEN_bm | USART_TXEN_bm);
+    sleepMgrSetLevel(SLEEP_MGR_CLIENT_USART0, SLEEP_MGR_POWER_DOWN);
+}
+
+/*! Recompute the USART baud register after a peripheral clock change. The
+ * function signature is compatible with `clockGovAddClient()`.
+ * The `BAUD` register is scaled proportionally to the clock change so the baud
+ * rate is kept. The register is limited to its minimum value of 64, so a
+ * baud rate too fast for the new clock is not maintained.
+ * @param from The old peripheral clock frequency.
+ * @param to The new peripheral clock frequency.
+ * @param param Task scheduler parameter (not used).
+ */
+void usartRescaleClock(uint32_t from, uint32_t to, cbParam_t *param)
+{
+    uint16_t baud = clockScale16(USART0.BAUD, from, to);
+    USART0.BAUD = baud < 64 ? 64 : baud;
+}
+
+/*! Select a new SCK divisor in master SPI mode after a peripheral clock
+ * change. The function signature is compatible with `clockGovAddClient()`.
+ * Unlike `usartRescaleClock()` the divisor is rounded up, so SPI devices are
+ * never clocked faster than before the clock change.
+ * @param from The old peripheral clock frequency, if 0 the divisor is kept.
+ * @param to The new peripheral clock frequency.
+ * @param param Task scheduler parameter (not used).
+ */
+void usartSpiRescaleClock(uint32_t from, uint32_t to, cbParam_t *param)
+{
+    if (from == 0) {
+        return;
+    }
+    // SCK = f / (2 * BAUD[15:6]), divisor scaled exactly and rounded up
+    const uint16_t old = USART0.BAUD >> 6;
+    uint32_t div;
+    if ((to >> 22) >= from) {
+        // ratio of 2^22 or more, the quotient would not fit 32 bits
+        div = old == 0 ? 0 : 0x3FF;
+    } else {
+        div = clockMulDiv(old, to, from);
+        if ((uint32_t)old * to - div * from != 0) {
+            div++;
+        }
+    }
+    if (div < 1) {
+        div = 1;
+    } else if (div > 0x3FF) {
+        div = 0x3FF;
+    }
+    USART0.BAUD = (uint16_t)div << 6;
+}
+
+/*! Compute the `BAUD` register value and baud rate mode for a baud rate at
+ * the current peripheral clock. This is the run-time equivalent of
+ * `USART_BAUD_PRESCALE()` and `USART_BAUD_MODE()`. If the system clock is the
+ * internal 16/20MHz oscillator, the factory measured oscillator error stored
+ * in the signature row (`OSC16ERR`/`OSC20ERR`) is compensated, which is more
+ * accurate than a value computed from the nominal clock frequency.
+ * @param baud The desired baud rate.
+ * @param mode Pointer where the baud rate mode is stored, `USART_BAUD_DOUBLE`
+ * if it has a smaller error than `USART_BAUD_NORMAL`.
+ * @return The `BAUD` register value, limited to the valid range 64 - 65535.
+ */
+uint16_t usartBaudCalibrated(uint32_t baud, enum usartBaudMode_e *mode)
+{
+    uint32_t f = clockGetSysClockFrequency();
+    if ((CLKCTRL.MCLKCTRLA & CLKCTRL_CLKSEL_gm) == SYS_CLOCK_INT_OSC) {
+        // signed oscillator error in units of 1/1024
+        int8_t err;
+        if ((FUSE.OSCCFG & FUSE_FREQSEL_gm) == FUSE_FREQSEL_16MHZ_gc) {
+            err = USART_BAUD_CALIBRATION_5V ? SIGROW.OSC16ERR5V : SIGROW.OSC16ERR3V;
+        } else {
+            err = USART_BAUD_CALIBRATION_5V ? SIGROW.OSC20ERR5V : SIGROW.OSC20ERR3V;
+        }
+        f += (int32_t)(f >> 10) * err + ((int32_t)(f & 0x3FF) * err + 512) / 1024;
+    }
+    uint32_t best = 0;
+    uint32_t bestErr = UINT32_MAX;
+    *mode = USART_BAUD_NORMAL;
+    for (uint8_t s = 16; s >= 8; s -= 8) {
+        // BAUD = 64 * f / (S * baud) rounded, 128 / S is 8 or 16
+        uint32_t reg = ((uint32_t)(128 / s) * f / baud + 1) / 2;
+        if (reg < 64) {
+            reg = 64;
+        } else if (reg > 0xFFFF) {
+            reg = 0xFFFF;
+        }
+        // error relative to 8 * f, compare both modes on the same scale
+        uint32_t actual = reg * baud;
+        uint32_t target = 64 / s * f;
+        uint32_t e = (actual > target ? actual - target : target - actual) * (s / 8);
+        if (e < bestErr) {
+            bestErr = e;
+            best = reg;
+            *mode = s == 16 ? USART_BAUD_NORMAL : USART_BAUD_DOUBLE;
+        }
+    }
+    return best;
 }
 
 /*! Flush the USART receive buffer and clear several interrupt flags.
@@ -129,7 +270,7 @@ int usartGetChar(FILE *file)
  * will block until the last byte is written to the USART transmit buffer.
  * @param buffer Pointer to the buffer from which to send.
  * @param length Number of bytes to send (0 to 255).
- * @param sleep Boolean indicating whether to call `sleep_mode()` while waiting
+ * @param sleep Boolean indicating whether to call `sleepMgrSleep()` while waiting
  * for USART transmit buffer. Note: If `sleep` is `true` a wakeup source must be
  * enabled (such as Data Register Empty Interrupt) which will wake the processor
  * to send the next byte.
@@ -142,7 +283,7 @@ void usartSendFromBuffer(const uint8_t *buffer, uint8_t length, bool sleep)
     while (index < length) {
         while(bit_is_clear(USART0.STATUS, USART_DREIF_bp)) {
             if (sleep) {
-                sleep_mode();
+                sleepMgrSleep();
             }
         }
         USART0.TXDATAL = buffer[index];
@@ -157,7 +298,7 @@ void usartSendFromBuffer(const uint8_t *buffer, uint8_t length, bool sleep)
  * function will block until the last byte is read from the USART receive buffer.
  * @param buffer Pointer to the buffer into which to receive.
  * @param length Number of bytes to receive (0 to 255).
- * @param sleep Boolean indicating whether to call `sleep_mode()` while waiting
+ * @param sleep Boolean indicating whether to call `sleepMgrSleep()` while waiting
  * for USART to receive data. Note: If `sleep` is `true` a wakeup source must be
  * enabled (such as Receive Complete Interrupt) which will wake the processor
  * to receive the next byte.
@@ -168,10 +309,90 @@ void usartReceiveToBuffer(uint8_t *buffer, uint8_t length, bool sleep)
     while (index < length) {
         while (bit_is_clear(USART0.STATUS, USART_RXCIF_bp)) {
             if (sleep) {
-                sleep_mode();
+                sleepMgrSleep();
             }
         }
         buffer[index] = USART0.RXDATAL;
         index++;
     }
-}
\ No newline at end of file
+}
+
+/*! Send and receive data through the USART in master SPI mode, the
+ * equivalent of `spiIo()`.
+ * This is a blocking send/receive, and the CS line must be asserted and released
+ * externally. The function will not return until `len` bytes have been transmitted
+ * and received. The received bytes are written into `buf`.
+ * @param buf Buffer to send and receive from.
+ * @param len Number of bytes to send and receive.
+ * Note: The USART must be configured with `usartConfigMasterSpi()`.
+ */
+void usartSpiIo(uint8_t buf[], uint8_t len)
+{
+    uint8_t tx_i = 0;       // transmit index
+    uint8_t rx_i = 0;       // receive index
+    while (tx_i < len || rx_i < len) {
+        // never more than two bytes in flight, the receive buffer holds two
+        if (bit_is_set(USART0.STATUS, USART_DREIF_bp) && tx_i < len && tx_i - rx_i < 2) {
+            USART0.TXDATAL = buf[tx_i];
+            tx_i++;
+        }
+        if (bit_is_set(USART0.STATUS, USART_RXCIF_bp) && rx_i < len) {
+            buf[rx_i] = USART0.RXDATAL;
+            rx_i++;
+        }
+    }
+}
+
+/*! Efficiently send and receive exactly 3 bytes (24 bits) through the USART
+ * in master SPI mode, the equivalent of `spiIo_24()`. The second byte is
+ * written while the first is shifted out, so SCK runs without gaps at fast
+ * clock settings.
+ * @param buf Buffer to send and receive from (exactly 3 bytes).
+ */
+void usartSpiIo_24(uint8_t buf[3])
+{
+    USART0.TXDATAL = buf[0];
+    loop_until_bit_is_set(USART0.STATUS, USART_DREIF_bp);
+    USART0.TXDATAL = buf[1];
+    loop_until_bit_is_set(USART0.STATUS, USART_RXCIF_bp);
+    buf[0] = USART0.RXDATAL;
+    loop_until_bit_is_set(USART0.STATUS, USART_DREIF_bp);
+    USART0.TXDATAL = buf[2];
+    loop_until_bit_is_set(USART0.STATUS, USART_RXCIF_bp);
+    buf[1] = USART0.RXDATAL;
+    loop_until_bit_is_set(USART0.STATUS, USART_RXCIF_bp);
+    buf[2] = USART0.RXDATAL;
+}
+
+/*! Same as `usartSpiIo_24()` except bytes are sent and received reversed.
+ * @param buf Buffer to send and receive from (exactly 3 bytes).
+ */
+void usartSpiIo_24_r(uint8_t buf[3])
+{
+    USART0.TXDATAL = buf[2];
+    loop_until_bit_is_set(USART0.STATUS, USART_DREIF_bp);
+    USART0.TXDATAL = buf[1];
+    loop_until_bit_is_set(USART0.STATUS, USART_RXCIF_bp);
+    buf[2] = USART0.RXDATAL;
+    loop_until_bit_is_set(USART0.STATUS, USART_DREIF_bp);
+    USART0.TXDATAL = buf[0];
+    loop_until_bit_is_set(USART0.STATUS, USART_RXCIF_bp);
+    buf[1] = USART0.RXDATAL;
+    loop_until_bit_is_set(USART0.STATUS, USART_RXCIF_bp);
+    buf[0] = USART0.RXDATAL;
+}
+
+/*! Efficiently send and receive exactly 2 bytes (16 bits) through the USART
+ * in master SPI mode, the equivalent of `spiIo_16()`.
+ * @param buf Buffer to send and receive from (exactly 2 bytes).
+ */
+void usartSpiIo_16(uint8_t buf[2])
+{
+    USART0.TXDATAL = buf[0];
+    loop_until_bit_is_set(USART0.STATUS, USART_DREIF_bp);
+    USART0.TXDATAL = buf[1];
+    loop_until_bit_is_set(USART0.STATUS, USART_RXCIF_bp);
+    buf[0] = USART0.RXDATAL;
+    loop_until_bit_is_set(USART0.STATUS, USART_RXCIF_bp);
+    buf[1] = USART0.RXDATAL;
+}
@@ -11,6 +11,7 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <avr/io.h>
+#include "task_scheduler.h"
 
 
 /*** Public Variables --------------------------------------------------------*/
@@ -39,6 +40,87 @@ enum usartBaudMode_e {
     USART_BAUD_AUTO         = USART_RXMODE_GENAUTO_gc,  ///< Generic auto-baud mode
 };
 
+/*! Maximum baud rate error accepted by `USART_BAUD_ASSERT()`, in permille
+ * (0.1%). The receiver tolerates a few percent total error between both ends.
+ */
+#ifndef USART_BAUD_TOLERANCE
+#define USART_BAUD_TOLERANCE    20
+#endif
+
+/*! Select the factory oscillator error measured at 5V instead of 3V for
+ * `usartBaudCalibrated()`.
+ */
+#ifndef USART_BAUD_CALIBRATION_5V
+#define USART_BAUD_CALIBRATION_5V   0
+#endif
+
+/*! Compile-time baud rate calculation. All arguments must be constants so the
+ * expressions are folded by the compiler, `f` is the peripheral clock in Hz,
+ * `b` the baud rate and `s` the number of samples per bit (16 in normal, 8 in
+ * double speed mode). The error is in permille, 1000 if the `BAUD` register
+ * value is out of range.
+ */
+#define USART_BAUD_REGISTER(f, b, s)    ((uint32_t)((128ULL * (f) / ((uint64_t)(s) * (b)) + 1) / 2))
+#define USART_BAUD_ERROR_S(f, b, s) \
+    ((USART_BAUD_REGISTER(f, b, s) < 64 || USART_BAUD_REGISTER(f, b, s) > 0xFFFF) ? 1000 : \
+     (64ULL * (f) > (uint64_t)(s) * USART_BAUD_REGISTER(f, b, s) * (b) ? \
+      64ULL * (f) - (uint64_t)(s) * USART_BAUD_REGISTER(f, b, s) * (b) : \
+      (uint64_t)(s) * USART_BAUD_REGISTER(f, b, s) * (b) - 64ULL * (f)) * 1000 / \
+     ((uint64_t)(s) * USART_BAUD_REGISTER(f, b, s) * (b)))
+
+/*! Use double speed mode if it has a smaller baud rate error than normal mode. */
+#define USART_BAUD_USE_CLK2X(f, b)      (USART_BAUD_ERROR_S(f, b, 8) < USART_BAUD_ERROR_S(f, b, 16))
+/*! The baud rate mode, `USART_BAUD_NORMAL` or `USART_BAUD_DOUBLE`. */
+#define USART_BAUD_MODE(f, b)           (USART_BAUD_USE_CLK2X(f, b) ? USART_BAUD_DOUBLE : USART_BAUD_NORMAL)
+/*! The `BAUD` register value for `USART_BAUD_MODE()`. */
+#define USART_BAUD_PRESCALE(f, b)       ((uint16_t)USART_BAUD_REGISTER(f, b, USART_BAUD_USE_CLK2X(f, b) ? 8 : 16))
+/*! The baud rate error of `USART_BAUD_MODE()` in permille. */
+#define USART_BAUD_ERROR(f, b) \
+    (USART_BAUD_USE_CLK2X(f, b) ? USART_BAUD_ERROR_S(f, b, 8) : USART_BAUD_ERROR_S(f, b, 16))
+
+/*! Fail the build if the baud rate error at `F_CPU` exceeds `USART_BAUD_TOLERANCE`.
+ * May be used at file scope or in a function.
+ */
+#define USART_BAUD_ASSERT(b) \
+    _Static_assert(USART_BAUD_ERROR(F_CPU, b) <= USART_BAUD_TOLERANCE, \
+                   "USART baud rate error exceeds USART_BAUD_TOLERANCE")
+
+/*! Initializers for the `baudMode` and `baudPrescale` members of
+ * `usartAsyncSerialConfig_s` for a baud rate at `F_CPU`, e.g.
+ * `struct usartAsyncSerialConfig_s c = { .txEnable = true, USART_BAUD_CONFIG(115200) };`
+ */
+#define USART_BAUD_CONFIG(b) \
+    .baudMode = USART_BAUD_MODE(F_CPU, b), .baudPrescale = USART_BAUD_PRESCALE(F_CPU, b)
+
+/*! Data order in master SPI mode.
+ */
+enum usartSpiDataOrder_e {
+    USART_SPI_DO_MSB_FIRST  = 0,                        ///< MSB first
+    USART_SPI_DO_LSB_FIRST  = USART_UDORD_bm,           ///< LSB first
+};
+
+/*! Transfer mode in master SPI mode. The clock phase is selected here, the
+ * clock polarity by the `INVEN` bit of the XCK pin control register: set
+ * `INVEN` for modes 2 and 3.
+ */
+enum usartSpiTransferMode_e {
+    USART_SPI_XFER_MODE_0   = 0,                        ///< Sample on leading edge (mode 2 with INVEN)
+    USART_SPI_XFER_MODE_1   = USART_UCPHA_bm,           ///< Sample on trailing edge (mode 3 with INVEN)
+};
+
+/*! Compile-time `BAUD` register value for master SPI mode, `f` is the
+ * peripheral clock and `sck` the highest permitted SCK frequency in Hz. The
+ * divisor is rounded up so SCK does not exceed `sck`, the fastest SCK is
+ * `f` / 2. The divisor is limited to its 10-bit field, so an `sck` below
+ * `f` / 2046 gives the slowest SCK, `f` / 2046, instead of overflowing into
+ * the other bits.
+ */
+#define USART_SPI_BAUD(f, sck) \
+    ((uint16_t)(USART_SPI_DIV_(f, sck) < 1 ? 1 : \
+     USART_SPI_DIV_(f, sck) > 0x3FF ? 0x3FF : USART_SPI_DIV_(f, sck)) << 6)
+#define USART_SPI_DIV_(f, sck) \
+    (((f) + 2UL * (sck) - 1) / (2UL * (sck)))
+
 /*! USART Interrupts.
  */
 struct usartInterruptConfig_s {
@@ -68,6 +150,15 @@ struct usartAsyncSerialConfig_s {
     uint16_t baudPrescale;              ///< 16-bit baud pre-scale register
 };
 
+/*! Configuration for USART in master SPI mode, e.g. with `USART_SPI_BAUD()`:
+ * `struct usartMasterSpiConfig_s c = { .baudPrescale = USART_SPI_BAUD(F_CPU, 4000000) };`
+ */
+struct usartMasterSpiConfig_s {
+    enum usartSpiDataOrder_e dataOrder;         ///< Data order
+    enum usartSpiTransferMode_e transferMode;   ///< Transfer mode (clock phase)
+    uint16_t baudPrescale;                      ///< 16-bit baud pre-scale register, bits 5:0 are ignored
+};
+
 
 
 /*** Public Functions --------------------------------------------------------*/
@@ -76,8 +167,17 @@ struct usartAsyncSerialConfig_s {
 void usartConfigPins(struct usartPinConfig_s *config);
 void usartConfigInterrupts(struct usartInterruptConfig_s *config);
 void usartConfigAsyncSerial(struct usartAsyncSerialConfig_s *config);
+void usartConfigMasterSpi(struct usartMasterSpiConfig_s *config);
+void usartDisable(void);
+void usartRescaleClock(uint32_t from, uint32_t to, cbParam_t *param);
+void usartSpiRescaleClock(uint32_t from, uint32_t to, cbParam_t *param);
+uint16_t usartBaudCalibrated(uint32_t baud, enum usartBaudMode_e *mode);
 void usartFlush(void);
 int usartPutChar(char c, FILE *file);
 int usartGetChar(FILE *file);
 void usartSendFromBuffer(const uint8_t *buffer, uint8_t length, bool sleep);
 void usartReceiveToBuffer(uint8_t *buffer, uint8_t length, bool sleep);
+void usartSpiIo(uint8_t buf[], uint8_t len);
+void usartSpiIo_24(uint8_t buf[3]);
+void usartSpiIo_24_r(uint8_t buf[3]);
+void usartSpiIo_16(uint8_t buf[2]);
@@ -6,14 +6,20 @@
 #include "usart_async.h"
 #include <stdbool.h>
 #include <stdio.h>
+#include "util/atomic.h"
 #include "task_scheduler.h"
 #include "futures.h"
+#include "usart_buffered.h"
 
 
 
 /*** Private Global Variables ------------------------------------------------*/
 /*! \privatesection */
 
+// Futures of the active send and receive, `NULL` if none is active
+static future_t * volatile sendFuture;
+static future_t * volatile receiveFuture;
+
 
 /*** Public Global Variables -------------------------------------------------*/
 /*! \publicsection */
@@ -21,6 +27,11 @@
 
 /*** Private Function Prototypes ---------------------------------------------*/
 /*! \privatesection */
+static inline void init(future_t *f, promise_t *promise);
+static void resolve(future_t *f, uint16_t count);
+static void sendDone(uint16_t count);
+static void receiveDone(uint16_t count);
+static void timeoutTask(cbParam_t *param);
 
 
 /*** Interrupt Service Routines (ISR) ----------------------------------------*/
@@ -29,34 +40,49 @@
 
 /*** Private Functions -------------------------------------------------------*/
 /*! \privatesection */
-static inline void init(future_t *f)
+static inline void init(future_t *f, promise_t *promise)
 {
+    f->promise = promise;
     f->resolved = false;
-    f->promise->uint8 = 0;
+    f->promise->uint16 = 0;
 }
 
-static void sendBytes(cbParam_t *param)
+/*! Resolve a future and remove its timeout task. May be called from ISR.
+ * @param f The future to resolve.
+ * @param count The number of bytes transferred.
+ */
+static void resolve(future_t *f, uint16_t count)
 {
-    uint8_t *buff = param->buffer.buff;
-    uint8_t index = param->buffer.iter;
-    const uint8_t length = param->buffer.length;
-    while (bit_is_set(USART0.STATUS, USART_DREIF_bp) &&
-            index < length) {
-        USART0.TXDATAL = buff[index];
-        (index)++;
-    }
-    param->buffer.iter = index;
-    if (index == length) {
-        // transmission complete
-        task_t *task = tsGetCurrentTask();
-        tsRemoveTask(task);
-        // resolve future
-        future_t *f = (future_t *)task; // task is first member of future_s
-        f->promise->uint8 = param->buffer.length;
-        f->resolved = true;
-    }
+    tsRemoveTask(&f->task);
+    f->promise->uint16 = count;
+    f->resolved = true;
+}
+
+/*! Transmit job completion callback, called from DRE ISR.
+ */
+static void sendDone(uint16_t count)
+{
+    resolve(sendFuture, count);
+    sendFuture = NULL;
+}
+
+/*! Receive job completion callback, called from RXC ISR.
+ */
+static void receiveDone(uint16_t count)
+{
+    resolve(receiveFuture, count);
+    receiveFuture = NULL;
 }
 
+/*! Timeout task, cancels the transfer of the future the task belongs to.
+ * @param param Task scheduler parameter (not used).
+ */
+static void timeoutTask(cbParam_t *param)
+{
+    usartAsyncCancel((future_t *)tsGetCurrentTask()); // task is first member of future_s
+}
+
+
 /*** Public Functions --------------------------------------------------------*/
 /*! \publicsection */
 
@@ -69,13 +95,167 @@ bool usartHasData(cbParam_t *param)
     return USART0.STATUS & USART_RXCIF_bm ? true : false;
 }
 
+/*! Check if USART0 transmit buffer can accept data.
+ * @param param Task scheduler parameter (not used).
+ * @return Returns `true` if transmit buffer is ready for data, `false` otherwise.
+ */
 bool usartReadyForData(cbParam_t *param)
 {
     return USART0.STATUS & USART_DREIF_bm ? true : false;
 }
-/*
+
+/*! Asynchronously send `length` bytes from `buffer`. Only one send may be
+ * active at a time. The buffer must not be modified until the future resolves.
+ * The future resolves once the last byte is written to the USART.
+ * @param f Pointer to the future for this send.
+ * @param promise Pointer to the promise receiving the number of bytes sent.
+ * @param buffer Pointer to the buffer from which to send.
+ * @param length Number of bytes to send.
+ * @param timeout Timeout in RTC ticks (overflows), 0 for no timeout, maximum
+ * 0x7FFF. The future's task is used as the timeout task, so like any removed
+ * task the future must not be reused until `tsMain()` has run once after it
+ * resolved.
+ * @return returns `TASK_INIT_OK` if send started, `TASK_INIT_ERROR` if a send
+ * or another transmit job (`usartTxJobStart()`) is already active.
+ */
 enum addStatus_e usartAsyncSend(future_t *f, promise_t *promise,
-        uint8_t *buffer, uint8_t length)
+                                const uint8_t *buffer, uint16_t length, uint16_t timeout)
 {
+    if (f == NULL || promise == NULL || sendFuture != NULL) {
+        return TASK_INIT_ERROR;
+    }
+    init(f, promise);
+    if (length == 0) {
+        f->resolved = true;
+        return TASK_INIT_OK;
+    }
+    // the timeout task is only added once the job started, a task which was
+    // added and removed stays linked until `tsMain()` runs
+    enum addStatus_e status = TASK_INIT_OK;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (!usartTxJobStart(buffer, length, sendDone)) {
+            // another transmit job is active
+            status = TASK_INIT_ERROR;
+        } else {
+            sendFuture = f;
+            if (timeout > 0 &&
+                    tsAddTimedSingleShotTask(&f->task, timeoutTask, NULL, timeout) != TASK_INIT_OK) {
+                usartTxJobCancel();
+                sendFuture = NULL;
+                status = TASK_INIT_ERROR;
+            }
+        }
+    }
+    return status;
+}
+
+/*! Asynchronously send a list of segments back-to-back, without copying them
+ * into a contiguous buffer. Segments may be in RAM or flash, see
+ * `usartTxSegment_s`. Only one send may be active at a time. The segment list
+ * and data must not be modified until the future resolves.
+ * @param f Pointer to the future for this send.
+ * @param promise Pointer to the promise receiving the number of bytes sent.
+ * @param segments Pointer to the first of `count` segments.
+ * @param count Number of segments.
+ * @param timeout Timeout in RTC ticks (overflows), see `usartAsyncSend()`.
+ * @return returns `TASK_INIT_OK` if send started or all segments are empty
+ * (the future resolves with 0), `TASK_INIT_ERROR` if a send or another
+ * transmit job is already active.
+ */
+enum addStatus_e usartAsyncSendGather(future_t *f, promise_t *promise,
+                                      const struct usartTxSegment_s *segments, uint8_t count,
+                                      uint16_t timeout)
+{
+    if (f == NULL || promise == NULL || sendFuture != NULL) {
+        return TASK_INIT_ERROR;
+    }
+    init(f, promise);
+    uint16_t length = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        length += segments[i].length;
+    }
+    if (length == 0) {
+        f->resolved = true;
+        return TASK_INIT_OK;
+    }
+    // see `usartAsyncSend()`
+    enum addStatus_e status = TASK_INIT_OK;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (!usartTxGatherStart(segments, count, sendDone)) {
+            // another transmit job is active
+            status = TASK_INIT_ERROR;
+        } else {
+            sendFuture = f;
+            if (timeout > 0 &&
+                    tsAddTimedSingleShotTask(&f->task, timeoutTask, NULL, timeout) != TASK_INIT_OK) {
+                usartTxJobCancel();
+                sendFuture = NULL;
+                status = TASK_INIT_ERROR;
+            }
+        }
+    }
+    return status;
+}
 
-}*/
\ No newline at end of file
+/*! Asynchronously receive `length` bytes into `buffer`. Only one receive may
+ * be active at a time. While the receive is active, received bytes bypass the
+ * receive ring.
+ * @param f Pointer to the future for this receive.
+ * @param promise Pointer to the promise receiving the number of bytes received.
+ * @param buffer Pointer to the buffer into which to receive.
+ * @param length Number of bytes to receive.
+ * @param timeout Timeout in RTC ticks (overflows), 0 for no timeout, maximum
+ * 0x7FFF. The future's task is used as the timeout task, so like any removed
+ * task the future must not be reused until `tsMain()` has run once after it
+ * resolved.
+ * @return returns `TASK_INIT_OK` if receive started, `TASK_INIT_ERROR` if a
+ * receive or another receive job (`usartRxJobStart()`) is already active.
+ */
+enum addStatus_e usartAsyncReceive(future_t *f, promise_t *promise,
+                                   uint8_t *buffer, uint16_t length, uint16_t timeout)
+{
+    if (f == NULL || promise == NULL || receiveFuture != NULL) {
+        return TASK_INIT_ERROR;
+    }
+    init(f, promise);
+    if (length == 0) {
+        f->resolved = true;
+        return TASK_INIT_OK;
+    }
+    // the timeout task is only added once the job started, a task which was
+    // added and removed stays linked until `tsMain()` runs
+    enum addStatus_e status = TASK_INIT_OK;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (!usartRxJobStart(buffer, length, receiveDone)) {
+            // another receive job is active
+            status = TASK_INIT_ERROR;
+        } else {
+            receiveFuture = f;
+            if (timeout > 0 &&
+                    tsAddTimedSingleShotTask(&f->task, timeoutTask, NULL, timeout) != TASK_INIT_OK) {
+                usartRxJobCancel();
+                receiveFuture = NULL;
+                status = TASK_INIT_ERROR;
+            }
+        }
+    }
+    return status;
+}
+
+/*! Cancel an active send or receive. The future resolves immediately with
+ * the number of bytes transferred so far. Has no effect if the future is
+ * already resolved.
+ * @param f Pointer to the future of the transfer to cancel.
+ */
+void usartAsyncCancel(future_t *f)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (f == sendFuture) {
+            resolve(f, usartTxJobCancel());
+            sendFuture = NULL;
+        } else if (f == receiveFuture) {
+            resolve(f, usartRxJobCancel());
+            receiveFuture = NULL;
+        }
+    }
+}
@@ -5,6 +5,10 @@
  *
  *  A collection of small utility functions for using the task scheduler to
  *  asynchronously transmit and receive from the USART.
+ *  Transfers are driven by the USART0 DRE and RXC interrupts (see
+ *  `usart_buffered.h`), the CPU is free between bytes. A transfer resolves its
+ *  future with the number of bytes transferred in `promise->uint16`, which is
+ *  less than the requested length if the transfer timed out or was cancelled.
  */
 #pragma once
 
@@ -12,6 +16,7 @@
 #include <stdbool.h>
 #include <avr/io.h>
 #include "futures.h"
+#include "usart_buffered.h"
 
 
 /*** Public Variables --------------------------------------------------------*/
@@ -20,3 +25,14 @@
 
 /*** Public Functions --------------------------------------------------------*/
 /*! \publicsection */
+
+bool usartHasData(cbParam_t *param);
+bool usartReadyForData(cbParam_t *param);
+enum addStatus_e usartAsyncSend(future_t *f, promise_t *promise,
+                                const uint8_t *buffer, uint16_t length, uint16_t timeout);
+enum addStatus_e usartAsyncSendGather(future_t *f, promise_t *promise,
+                                      const struct usartTxSegment_s *segments, uint8_t count,
+                                      uint16_t timeout);
+enum addStatus_e usartAsyncReceive(future_t *f, promise_t *promise,
+                                   uint8_t *buffer, uint16_t length, uint16_t timeout);
+void usartAsyncCancel(future_t *f);
@@ -0,0 +1,855 @@
+/*! \file
+ *  usart_buffered.c
+ *  xenon-lib-tiny
+ *  Copyright (c) 2020 Martin Clemons
+ */
+#include "usart_buffered.h"
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include "util/atomic.h"
+#include "sleep_manager.h"
+
+#if USART_TX_BUFFER_SIZE > 128 || (USART_TX_BUFFER_SIZE & (USART_TX_BUFFER_SIZE - 1)) != 0
+#error "USART_TX_BUFFER_SIZE must be a power of two, at most 128"
+#endif
+#if USART_RX_BUFFER_SIZE > 128 || (USART_RX_BUFFER_SIZE & (USART_RX_BUFFER_SIZE - 1)) != 0
+#error "USART_RX_BUFFER_SIZE must be a power of two, at most 128"
+#endif
+
+
+/*** Private Global Variables ------------------------------------------------*/
+/*! \privatesection */
+
+/* Transmit ring buffer. `txHead` and `txTail` are free-running counters, the
+ * number of bytes in the ring is `txHead - txTail`. `txHead` is only written
+ * by the main thread, `txTail` only by the DRE ISR. */
+static uint8_t txBuffer[USART_TX_BUFFER_SIZE];
+static volatile uint8_t txHead;
+static volatile uint8_t txTail;
+
+/* Set by the TXC ISR once the last byte is shifted out, cleared on write. */
+static volatile bool txDrained = true;
+
+/* Called when transmission starts after the transmitter was drained, and when
+ * it is drained again. */
+static usartTxDirectionCb_t *txDirectionCb;
+
+/* Set while the direction callback holds back the first byte, until
+ * `usartTxResume()`. */
+static volatile bool txHeld;
+
+/* Receive ring buffer, same scheme as the transmit ring. `rxHead` is only
+ * written by the RXC ISR, `rxTail` only by the main thread. */
+static uint8_t rxBuffer[USART_RX_BUFFER_SIZE];
+static volatile uint8_t rxHead;
+static volatile uint8_t rxTail;
+
+/* Receive delimiter and the number of delimiters currently in the ring. */
+static bool rxDelimiterEnable;
+static uint8_t rxDelimiter;
+static volatile uint8_t rxDelimiterCount;
+
+/* Receive error counters, written by the RXC ISR. */
+static struct usartRxErrors_s rxErrors;
+
+/* Set while the receive ring is started with `usartRxStart()`. */
+static bool rxRingEnable;
+
+/* Multi-processor communication mode. An address frame matches if the bits
+ * set in `mpcmMask` are equal to those of `mpcmAddress`. `mpcmAddressed` is
+ * set by the RXC ISR when an address frame matches and cleared when another
+ * address frame doesn't. */
+static bool mpcmEnable;
+static uint8_t mpcmAddress;
+static uint8_t mpcmMask;
+static volatile bool mpcmAddressed;
+
+/* Transfer jobs. A job is active while `remaining` is non-zero, or for a
+ * transmit generator job while `generator` is set. While a transmit job is
+ * active bytes in the transmit ring are held back, while a receive job is
+ * active received bytes bypass the receive sink and ring. */
+static struct {
+    const uint8_t *data;        // next byte to transmit
+    uint16_t remaining;         // bytes left to transmit in current segment
+    bool progmem;               // current segment is in flash
+    const struct usartTxSegment_s *next;    // next segment
+    uint8_t segments;           // segments left after the current one
+    uint16_t length;            // job length, sum of all segment lengths
+    usartJobCb_t *done;         // completion callback
+    struct usartTxSegment_s single;         // segment used by `usartTxJobStart()`
+    usartTxGenerator_t *generator;          // generator of a generator job
+    void *ctx;                  // generator context
+} txJob;
+
+static struct {
+    uint8_t *data;              // next byte to receive
+    uint16_t remaining;         // bytes left to receive
+    uint16_t length;            // job length
+    usartJobCb_t *done;         // completion callback
+} rxJob;
+
+/* Receive sink, received bytes are passed to `rxSink` instead of the ring
+ * while it is set. */
+static usartRxSink_t *rxSink;
+static void *rxSinkCtx;
+
+/* Called on each received character, for example to restart an idle timer. */
+static usartRxActivityCb_t *rxActivityCb;
+
+
+/*** Public Global Variables -------------------------------------------------*/
+/*! \publicsection */
+
+
+/*** Private Function Prototypes ---------------------------------------------*/
+/*! \privatesection */
+static void startTransmit(void);
+static void releaseTransmit(void);
+static bool nextSegment(void);
+static inline bool txJobActive(void);
+static inline void updateRxInterrupt(void);
+static inline void countError(uint16_t *counter);
+
+
+/*** Interrupt Service Routines (ISR) ----------------------------------------*/
+/*! \privatesection */
+
+/* Move the next byte from the transmit job or the ring to the USART. Once
+ * both are empty the DRE interrupt is disabled and the TXC interrupt enabled
+ * to detect the end of transmission. */
+ISR(USART0_DRE_vect)
+{
+    if (txJob.remaining > 0) {
+        USART0.TXDATAL = txJob.progmem ? pgm_read_byte(txJob.data) : *txJob.data;
+        txJob.data++;
+        if (--txJob.remaining == 0 && !nextSegment() && txJob.done != NULL) {
+            // callback may start a new job
+            txJob.done(txJob.length);
+        }
+    } else if (txJob.generator != NULL) {
+        int16_t c = txJob.generator(txJob.ctx);
+        if (c == USART_TX_YIELD) {
+            // DREIF is still set, the interrupt fires again
+            return;
+        }
+        if (c < 0) {
+            txJob.generator = NULL;
+            if (txJob.done != NULL) {
+                txJob.done(txJob.length);
+            }
+            // no byte written, DRE fires again if there is more to send
+            if (!txJobActive() && txHead == txTail) {
+                USART0.CTRLA = (USART0.CTRLA & ~USART_DREIE_bm) | USART_TXCIE_bm;
+            }
+            return;
+        }
+        USART0.TXDATAL = c;
+        txJob.length++;
+    } else if (txHead != txTail) {
+        uint8_t tail = txTail;
+        USART0.TXDATAL = txBuffer[tail & (USART_TX_BUFFER_SIZE - 1)];
+        txTail = tail + 1;
+    } else {
+        return;
+    }
+    // clear TXCIF so it's only set after the last byte is shifted out
+    USART0.STATUS = USART_TXCIF_bm;
+    if (!txJobActive() && txHead == txTail) {
+        USART0.CTRLA = (USART0.CTRLA & ~USART_DREIE_bm) | USART_TXCIE_bm;
+    }
+}
+
+ISR(USART0_TXC_vect)
+{
+    USART0.STATUS = USART_TXCIF_bm;
+    USART0.CTRLA &= ~USART_TXCIE_bm;
+    txDrained = true;
+    if (txDirectionCb != NULL) {
+        txDirectionCb(false);
+    }
+}
+
+/* Move a received byte into the receive job, the sink or the ring. Bytes with framing
+ * or parity errors are discarded, the overflow flag refers to a byte lost
+ * before this one. */
+ISR(USART0_RXC_vect)
+{
+    // RXDATAH must be read before RXDATAL pops the receive buffer
+    uint8_t status = USART0.RXDATAH;
+    uint8_t data = USART0.RXDATAL;
+    if (rxActivityCb != NULL) {
+        rxActivityCb();
+    }
+    if (status & USART_BUFOVF_bm) {
+        countError(&rxErrors.overrun);
+    }
+    if (status & USART_FERR_bm) {
+        countError(&rxErrors.framing);
+        return;
+    }
+    if (status & USART_PERR_bm) {
+        countError(&rxErrors.parity);
+        return;
+    }
+    if (mpcmEnable && (status & USART_DATA8_bm)) {
+        // address frame, receive the following data frames only on a match
+        if (((data ^ mpcmAddress) & mpcmMask) == 0) {
+            USART0.CTRLB &= ~USART_MPCM_bm;
+            mpcmAddressed = true;
+        } else {
+            USART0.CTRLB |= USART_MPCM_bm;
+            mpcmAddressed = false;
+        }
+        return;
+    }
+    if (rxJob.remaining > 0) {
+        *rxJob.data++ = data;
+        if (--rxJob.remaining == 0) {
+            updateRxInterrupt();
+            if (rxJob.done != NULL) {
+                rxJob.done(rxJob.length);
+            }
+        }
+        return;
+    }
+    if (rxSink != NULL) {
+        rxSink(data, rxSinkCtx);
+        return;
+    }
+    uint8_t head = rxHead;
+    if ((uint8_t)(head - rxTail) == USART_RX_BUFFER_SIZE) {
+        countError(&rxErrors.ringOverflow);
+        return;
+    }
+    rxBuffer[head & (USART_RX_BUFFER_SIZE - 1)] = data;
+    rxHead = head + 1;
+    if (rxDelimiterEnable && data == rxDelimiter) {
+        rxDelimiterCount++;
+    }
+}
+
+
+/*** Private Functions -------------------------------------------------------*/
+/*! \privatesection */
+
+/*! Enable the DRE interrupt so the ISR starts moving bytes from the ring.
+ * If the transmitter was drained the direction callback is called first, it
+ * may hold the transmission back until `usartTxResume()`.
+ */
+static void startTransmit(void)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (txDrained && txDirectionCb != NULL) {
+            txHeld = txDirectionCb(true);
+        }
+        txDrained = false;
+        if (!txHeld) {
+            USART0.CTRLA = (USART0.CTRLA & ~USART_TXCIE_bm) | USART_DREIE_bm;
+        }
+    }
+}
+
+/*! Release a transmission held by the direction callback. Called from ISR or
+ * with interrupts disabled.
+ */
+static void releaseTransmit(void)
+{
+    if (txHeld) {
+        txHeld = false;
+        if (txJobActive() || txHead != txTail) {
+            USART0.CTRLA = (USART0.CTRLA & ~USART_TXCIE_bm) | USART_DREIE_bm;
+        }
+    }
+}
+
+/*! Load the next non-empty segment of the transmit job. Called from ISR or
+ * with interrupts disabled.
+ * @return Returns `true` if a segment was loaded, `false` if the job is done.
+ */
+static bool nextSegment(void)
+{
+    while (txJob.segments > 0) {
+        const struct usartTxSegment_s *s = txJob.next++;
+        txJob.segments--;
+        if (s->length > 0) {
+            txJob.data = s->data;
+            txJob.progmem = s->progmem;
+            txJob.remaining = s->length;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*! Check if a transmit job is active.
+ * @return Returns `true` if a segment or generator job is active.
+ */
+static inline bool txJobActive(void)
+{
+    return txJob.remaining > 0 || txJob.generator != NULL;
+}
+
+/*! Enable the RXC interrupt if the receive ring, a receive job or a receive
+ * sink is active, disable it otherwise. Called from ISR or with interrupts
+ * disabled.
+ */
+static inline void updateRxInterrupt(void)
+{
+    if (rxRingEnable || rxJob.remaining > 0 || rxSink != NULL) {
+        USART0.CTRLA |= USART_RXCIE_bm;
+    } else {
+        USART0.CTRLA &= ~USART_RXCIE_bm;
+    }
+}
+
+/*! Increment an error counter, saturating at its maximum value.
+ * @param counter Pointer to the counter.
+ */
+static inline void countError(uint16_t *counter)
+{
+    if (*counter != UINT16_MAX) {
+        (*counter)++;
+    }
+}
+
+
+/*** Public Functions --------------------------------------------------------*/
+/*! \publicsection */
+
+/*! Write up to `length` bytes into the transmit ring buffer. Non-blocking,
+ * only as many bytes as fit into the ring are accepted.
+ * @param buffer Pointer to the bytes to transmit.
+ * @param length Number of bytes to transmit.
+ * @return The number of bytes accepted, may be less than `length`.
+ */
+uint8_t usartWrite(const uint8_t *buffer, uint8_t length)
+{
+    uint8_t head = txHead;
+    uint8_t space = USART_TX_BUFFER_SIZE - (uint8_t)(head - txTail);
+    if (length > space) {
+        length = space;
+    }
+    for (uint8_t i = 0; i < length; i++) {
+        txBuffer[head & (USART_TX_BUFFER_SIZE - 1)] = buffer[i];
+        head++;
+    }
+    txHead = head;
+    if (length > 0) {
+        startTransmit();
+    }
+    return length;
+}
+
+/*! Get the free space in the transmit ring buffer.
+ * @return The number of bytes which can be written without blocking.
+ */
+uint8_t usartTxSpace(void)
+{
+    return USART_TX_BUFFER_SIZE - (uint8_t)(txHead - txTail);
+}
+
+/*! Transmit a single character through the transmit ring buffer. Blocks only
+ * while the ring is full, sleeping with `sleepMgrSleep()` until the DRE
+ * interrupt frees space. Function signature is compatible with `fdevopen()`
+ * and can thus be used with `fdev_setup_stream()` or `FDEV_SETUP_STREAM()`.
+ * @param c Char to transmit.
+ * @param file Pointer to FILE (ignored).
+ * @return Return 0 if transmit is successful, nonzero otherwise.
+ * Note: Must not be called with interrupts disabled.
+ */
+int usartPutCharBuffered(char c, FILE *file)
+{
+    while (usartWrite((const uint8_t *)&c, 1) == 0) {
+        sleepMgrSleep();
+    }
+    return 0;
+}
+
+/*! Check if the transmit ring buffer is empty and the last byte has been
+ * shifted out (TXC interrupt has occurred). Function signature is compatible
+ * with `tsAddConditionalTask()`.
+ * @param param Task scheduler parameter (not used).
+ * @return Returns `true` if transmission is complete, `false` otherwise.
+ */
+bool usartTxDrained(cbParam_t *param)
+{
+    return txDrained;
+}
+
+/*! Block until the transmit ring buffer is empty and the last byte has been
+ * shifted out, sleeping with `sleepMgrSleep()` while waiting.
+ * Note: Must not be called with interrupts disabled.
+ */
+void usartTxWaitDrained(void)
+{
+    while (!txDrained) {
+        sleepMgrSleep();
+    }
+}
+
+/*! Start interrupt driven receive. Flushes the USART receive buffer, empties
+ * the receive ring and enables the RXC interrupt. The receiver must be enabled
+ * with `usartConfigAsyncSerial()`.
+ */
+void usartRxStart(void)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        USART0.RXDATAL;
+        USART0.RXDATAL;
+        USART0.RXDATAL;
+        rxTail = rxHead;
+        rxDelimiterCount = 0;
+        rxRingEnable = true;
+        USART0.CTRLA |= USART_RXCIE_bm;
+    }
+}
+
+/*! Stop interrupt driven receive into the ring. The RXC interrupt is disabled
+ * unless a receive job or sink is active. Bytes already in the receive ring remain
+ * available.
+ */
+void usartRxStop(void)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        rxRingEnable = false;
+        updateRxInterrupt();
+    }
+}
+
+/*! Configure the receive delimiter. Each received delimiter byte is counted
+ * while it is in the ring, see `usartRxDelimiterAvailable()`.
+ * @param enable Set to `true` to enable delimiter detection.
+ * @param delimiter The delimiter byte, for example '\n'.
+ */
+void usartRxSetDelimiter(bool enable, uint8_t delimiter)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        rxDelimiterEnable = enable;
+        rxDelimiter = delimiter;
+        // recount delimiters already in the ring
+        uint8_t count = 0;
+        for (uint8_t i = rxTail; enable && i != rxHead; i++) {
+            if (rxBuffer[i & (USART_RX_BUFFER_SIZE - 1)] == delimiter) {
+                count++;
+            }
+        }
+        rxDelimiterCount = count;
+    }
+}
+
+/*! Get the longest contiguous span of received bytes, without copying. The
+ * bytes remain in the ring until released with `usartRxConsume()`. If the
+ * data wraps around the end of the ring, a second call after consuming the
+ * first span returns the remainder.
+ * @param data Pointer set to the first received byte.
+ * @return The number of contiguous bytes at `data`, 0 if the ring is empty.
+ */
+uint8_t usartRxPeek(const uint8_t **data)
+{
+    uint8_t tail = rxTail;
+    uint8_t count = rxHead - tail;
+    uint8_t index = tail & (USART_RX_BUFFER_SIZE - 1);
+    uint8_t toEnd = USART_RX_BUFFER_SIZE - index;
+    *data = &rxBuffer[index];
+    return count < toEnd ? count : toEnd;
+}
+
+/*! Release `n` bytes from the start of the receive ring.
+ * @param n The number of bytes to release, limited to the bytes in the ring.
+ */
+void usartRxConsume(uint8_t n)
+{
+    uint8_t tail = rxTail;
+    uint8_t count = rxHead - tail;
+    if (n > count) {
+        n = count;
+    }
+    if (rxDelimiterEnable) {
+        uint8_t found = 0;
+        for (uint8_t i = 0; i < n; i++) {
+            if (rxBuffer[(uint8_t)(tail + i) & (USART_RX_BUFFER_SIZE - 1)] == rxDelimiter) {
+                found++;
+            }
+        }
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            rxDelimiterCount -= found;
+        }
+    }
+    rxTail = tail + n;
+}
+
+/*! Copy up to `length` received bytes into `buffer`. Non-blocking.
+ * @param buffer Pointer to the buffer into which to receive.
+ * @param length Maximum number of bytes to copy.
+ * @return The number of bytes copied.
+ */
+uint8_t usartRead(uint8_t *buffer, uint8_t length)
+{
+    uint8_t total = 0;
+    const uint8_t *data;
+    uint8_t n;
+    while (total < length && (n = usartRxPeek(&data)) > 0) {
+        if (n > length - total) {
+            n = length - total;
+        }
+        for (uint8_t i = 0; i < n; i++) {
+            buffer[total++] = data[i];
+        }
+        usartRxConsume(n);
+    }
+    return total;
+}
+
+/*! Receive a single character from the receive ring. Blocks while the ring
+ * is empty, sleeping with `sleepMgrSleep()` until the RXC interrupt occurs.
+ * Function signature is compatible with `fdevopen()` and can thus be used with
+ * `fdev_setup_stream()` or `FDEV_SETUP_STREAM()`.
+ * @param file Pointer to FILE (ignored).
+ * @return Return the received char.
+ * Note: Must not be called with interrupts disabled.
+ */
+int usartGetCharBuffered(FILE *file)
+{
+    uint8_t c;
+    while (usartRead(&c, 1) == 0) {
+        sleepMgrSleep();
+    }
+    return (int)c;
+}
+
+/*! Check if the receive ring contains data. Function signature is compatible
+ * with `tsAddConditionalTask()`, so a task can be woken when data arrives.
+ * @param param Task scheduler parameter (not used).
+ * @return Returns `true` if the receive ring is not empty, `false` otherwise.
+ */
+bool usartRxAvailable(cbParam_t *param)
+{
+    return rxHead != rxTail;
+}
+
+/*! Check if the receive ring contains at least one delimiter byte. Function
+ * signature is compatible with `tsAddConditionalTask()`, so a task can be
+ * woken when a complete line or frame has arrived.
+ * @param param Task scheduler parameter (not used).
+ * @return Returns `true` if a delimiter is in the receive ring, `false` otherwise.
+ */
+bool usartRxDelimiterAvailable(cbParam_t *param)
+{
+    return rxDelimiterCount > 0;
+}
+
+/*! Get the receive error counters.
+ * @param errors Pointer to `usartRxErrors_s` into which to copy the counters.
+ * @param clear Set to `true` to reset the counters to 0.
+ */
+void usartRxGetErrors(struct usartRxErrors_s *errors, bool clear)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        *errors = rxErrors;
+        if (clear) {
+            rxErrors = (struct usartRxErrors_s){ 0 };
+        }
+    }
+}
+
+/*! Start a transmit job which sends `length` bytes directly from `data`,
+ * without copying. The buffer must not be modified until the job completes.
+ * While the job is active, bytes written to the transmit ring are held back.
+ * @param data Pointer to the bytes to transmit.
+ * @param length Number of bytes to transmit, must not be 0.
+ * @param done Callback called from ISR once the last byte is written to the
+ * USART, or `NULL`.
+ * @return Returns `true` if the job was started, `false` if a transmit job is
+ * already active or `length` is 0.
+ */
+bool usartTxJobStart(const uint8_t *data, uint16_t length, usartJobCb_t *done)
+{
+    bool started = false;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (!txJobActive()) {
+            txJob.single = (struct usartTxSegment_s){ data, length, false };
+            started = usartTxGatherStart(&txJob.single, 1, done);
+        }
+    }
+    return started;
+}
+
+/*! Start a transmit job which sends a list of segments back-to-back, without
+ * copying them into a contiguous buffer. Segments may be in RAM or flash. The
+ * segment list and the segment data must not be modified until the job
+ * completes. While the job is active, bytes written to the transmit ring are
+ * held back.
+ * @param segments Pointer to the first of `count` segments.
+ * @param count Number of segments.
+ * @param done Callback called from ISR once the last byte is written to the
+ * USART, or `NULL`.
+ * @return Returns `true` if the job was started, `false` if a transmit job is
+ * already active or all segments are empty.
+ */
+bool usartTxGatherStart(const struct usartTxSegment_s *segments, uint8_t count,
+                        usartJobCb_t *done)
+{
+    bool started = false;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (!txJobActive()) {
+            txJob.length = 0;
+            for (uint8_t i = 0; i < count; i++) {
+                txJob.length += segments[i].length;
+            }
+            txJob.next = segments;
+            txJob.segments = count;
+            txJob.done = done;
+            started = nextSegment();
+        }
+    }
+    if (started) {
+        startTransmit();
+    }
+    return started;
+}
+
+/*! Start a transmit job which pulls each byte from a generator function,
+ * called from the DRE ISR. This lets an encoder produce its output byte by
+ * byte as the USART needs it, without an output buffer. The generator should
+ * return quickly since it runs in ISR.
+ * While the job is active, bytes written to the transmit ring are held back.
+ * @param generator Function returning the next byte, `USART_TX_YIELD` to be
+ * called again, or another negative value when the job is done.
+ * @param ctx Context passed to `generator`.
+ * @param done Callback called from ISR once the generator is done, or `NULL`.
+ * @return Returns `true` if the job was started, `false` if a transmit job is
+ * already active.
+ */
+bool usartTxGeneratorStart(usartTxGenerator_t *generator, void *ctx, usartJobCb_t *done)
+{
+    bool started = false;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (!txJobActive() && generator != NULL) {
+            txJob.length = 0;
+            txJob.ctx = ctx;
+            txJob.done = done;
+            txJob.generator = generator;
+            started = true;
+        }
+    }
+    if (started) {
+        startTransmit();
+    }
+    return started;
+}
+
+/*! Cancel the active transmit job. The completion callback is not called.
+ * Bytes already written to the USART are still transmitted.
+ * @return The number of bytes transmitted before the job was cancelled.
+ */
+uint16_t usartTxJobCancel(void)
+{
+    uint16_t count;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        count = txJob.length - txJob.remaining;
+        while (txJob.segments > 0) {
+            count -= txJob.next->length;
+            txJob.next++;
+            txJob.segments--;
+        }
+        txJob.remaining = 0;
+        txJob.generator = NULL;
+    }
+    return count;
+}
+
+/*! Start a receive job which stores the next `length` received bytes directly
+ * into `data`. While the job is active received bytes bypass the receive ring.
+ * Enables the RXC interrupt, the receiver must be enabled with
+ * `usartConfigAsyncSerial()`.
+ * @param data Pointer to the buffer into which to receive.
+ * @param length Number of bytes to receive, must not be 0.
+ * @param done Callback called from ISR once the last byte is received, or `NULL`.
+ * @return Returns `true` if the job was started, `false` if a receive job is
+ * already active or `length` is 0.
+ */
+bool usartRxJobStart(uint8_t *data, uint16_t length, usartJobCb_t *done)
+{
+    bool started = false;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (rxJob.remaining == 0 && length > 0) {
+            rxJob.data = data;
+            rxJob.length = length;
+            rxJob.done = done;
+            rxJob.remaining = length;
+            updateRxInterrupt();
+            started = true;
+        }
+    }
+    return started;
+}
+
+/*! Cancel the active receive job. The completion callback is not called.
+ * @return The number of bytes received before the job was cancelled.
+ */
+uint16_t usartRxJobCancel(void)
+{
+    uint16_t count;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        count = rxJob.length - rxJob.remaining;
+        rxJob.remaining = 0;
+        updateRxInterrupt();
+    }
+    return count;
+}
+
+/*! Pass each received byte to a sink function, called from the RXC ISR,
+ * instead of storing it in the receive ring. This lets a decoder consume the
+ * input byte by byte as it arrives. The sink should return quickly since it
+ * runs in ISR. A receive job takes precedence over the sink.
+ * @param sink Function called with each received byte.
+ * @param ctx Context passed to `sink`.
+ */
+void usartRxSinkStart(usartRxSink_t *sink, void *ctx)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        rxSinkCtx = ctx;
+        rxSink = sink;
+        updateRxInterrupt();
+    }
+}
+
+/*! Stop passing received bytes to the sink. Received bytes are stored in the
+ * receive ring again if it is started.
+ */
+void usartRxSinkStop(void)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        rxSink = NULL;
+        updateRxInterrupt();
+    }
+}
+
+/*! Set a function which is called from the RXC ISR for each received
+ * character, before the character is processed. Characters with framing or
+ * parity errors are included, since they still show activity on the line.
+ * @param cb The callback function, or `NULL` to remove the callback.
+ */
+void usartRxSetActivityCallback(usartRxActivityCb_t *cb)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        rxActivityCb = cb;
+    }
+}
+
+/*! Set a function which is called when transmission starts and when the
+ * transmitter is drained, see `usartTxDirectionCb_t`. The start call is made
+ * with interrupts disabled, the drained call from the TXC ISR. Only transmit
+ * through this file's functions is covered, not the blocking functions in
+ * `usart.c`. A transmission held by the previous callback is released.
+ * @param cb The callback function, or `NULL` to remove the callback.
+ */
+void usartTxSetDirectionCallback(usartTxDirectionCb_t *cb)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        txDirectionCb = cb;
+        releaseTransmit();
+    }
+}
+
+/*! Start a transmission held back by the direction callback, for example
+ * once a line driver guard time has elapsed. May be called from ISR.
+ */
+void usartTxResume(void)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        releaseTransmit();
+    }
+}
+
+/*! Start multi-processor communication mode (MPCM). The USART is switched to
+ * 9-bit frames, where the ninth bit marks address frames. The receiver
+ * hardware ignores data frames until an address frame arrives, so the CPU is
+ * only interrupted by traffic addressed to this node. When an address
+ * matches, the following data frames are received into the ring, a receive
+ * job or sink as usual and `usartMpcmAddressed()` returns `true`. A
+ * non-matching address frame disables data reception again.
+ * Call after `usartConfigAsyncSerial()`, which selects 8-bit frames.
+ * @param address The address of this node.
+ * @param mask Address bits which must match, 0xFF for an exact match. Clear
+ * low bits to also accept group addresses.
+ */
+void usartMpcmStart(uint8_t address, uint8_t mask)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        mpcmAddress = address;
+        mpcmMask = mask;
+        mpcmAddressed = false;
+        mpcmEnable = true;
+        USART0.CTRLC = (USART0.CTRLC & ~USART_CHSIZE_gm) | USART_CHSIZE_9BITL_gc;
+        USART0.TXDATAH = 0;
+        USART0.CTRLB |= USART_MPCM_bm;
+    }
+}
+
+/*! Stop multi-processor communication mode and return to 8-bit frames.
+ */
+void usartMpcmStop(void)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        mpcmEnable = false;
+        mpcmAddressed = false;
+        USART0.CTRLB &= ~USART_MPCM_bm;
+        USART0.CTRLC = (USART0.CTRLC & ~USART_CHSIZE_gm) | USART_CHSIZE_8BIT_gc;
+    }
+}
+
+/*! Check if an address frame matching this node was received. Function
+ * signature is compatible with `tsAddConditionalTask()`, use it to start
+ * processing a message addressed to this node.
+ * @param param Task scheduler parameter (not used).
+ * @return Returns `true` if this node is addressed.
+ */
+bool usartMpcmAddressed(cbParam_t *param)
+{
+    return mpcmAddressed;
+}
+
+/*! Release the bus after a message addressed to this node was processed.
+ * The receiver ignores data frames again until the next matching address.
+ */
+void usartMpcmRelease(void)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        mpcmAddressed = false;
+        USART0.CTRLB |= USART_MPCM_bm;
+    }
+}
+
+/*! Transmit an address frame, which selects the receiving nodes. Waits until
+ * the transmitter is drained, so the address is never mixed into pending data,
+ * and until the address is moved into the shift register. Like other
+ * transmissions the direction callback is called and the transmitter is not
+ * drained until the address frame is shifted out.
+ * Note: Must not be called with interrupts disabled.
+ * @param address The address to send.
+ */
+void usartMpcmSendAddress(uint8_t address)
+{
+    usartTxWaitDrained();
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (txDirectionCb != NULL) {
+            txHeld = txDirectionCb(true);
+        }
+        txDrained = false;
+    }
+    while (txHeld) {
+        // guard time of the direction callback
+        sleepMgrSleep();
+    }
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        USART0.TXDATAH = USART_DATA8_bm;
+        USART0.TXDATAL = address;
+        // the TXC interrupt sets `txDrained` once the address is shifted out
+        USART0.STATUS = USART_TXCIF_bm;
+        USART0.CTRLA |= USART_TXCIE_bm;
+        loop_until_bit_is_set(USART0.STATUS, USART_DREIF_bp);
+        // following frames are data frames
+        USART0.TXDATAH = 0;
+    }
+}
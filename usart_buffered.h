@@ -0,0 +1,138 @@
+/*! \file
+ *  usart_buffered.h
+ *  xenon-lib-tiny
+ *  Copyright (c) 2020 Martin Clemons
+ *
+ *  Interrupt driven, buffered USART0 transmit and receive. Bytes are written
+ *  into a transmit ring buffer which is emptied by the USART0 Data Register
+ *  Empty (DRE) interrupt, so writing never waits for the USART unless the ring
+ *  is full. Received bytes are moved into a receive ring buffer by the Receive
+ *  Complete (RXC) interrupt, where they can be parsed in place.
+ *  Transfer jobs transmit from or receive into a caller supplied buffer
+ *  without copying through the rings, and call a completion callback from the
+ *  ISR once the last byte is transferred. A transmit job may gather several
+ *  segments in RAM or flash which are sent back-to-back, or pull each byte
+ *  from a generator function (for example a frame encoder). Likewise received
+ *  bytes can be pushed into a sink function instead of the receive ring.
+ *  In multi-processor communication mode (MPCM) the receiver hardware drops
+ *  9-bit data frames not addressed to this node.
+ *  This file provides the USART0 DRE, TXC and RXC Interrupt Service Routines,
+ *  it can't be used together with custom ISR code for these vectors.
+ */
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <avr/io.h>
+#include "task_scheduler.h"
+
+
+/*** Public Variables --------------------------------------------------------*/
+/*! \publicsection */
+
+/*! Size of the transmit ring buffer in bytes. Must be a power of two, at most
+ * 128 bytes.
+ */
+#ifndef USART_TX_BUFFER_SIZE
+#define USART_TX_BUFFER_SIZE    64
+#endif
+
+/*! Size of the receive ring buffer in bytes. Must be a power of two, at most
+ * 128 bytes.
+ */
+#ifndef USART_RX_BUFFER_SIZE
+#define USART_RX_BUFFER_SIZE    64
+#endif
+
+/*! Receive error counters. Counters saturate at their maximum value.
+ */
+struct usartRxErrors_s {
+    uint16_t framing;           ///< Bytes discarded due to a framing error (`FERR`)
+    uint16_t parity;            ///< Bytes discarded due to a parity error (`PERR`)
+    uint16_t overrun;           ///< Hardware receive buffer overflows (`BUFOVF`)
+    uint16_t ringOverflow;      ///< Bytes discarded because the receive ring was full
+};
+
+
+/*! A transmit segment: a buffer in RAM, or in flash (`PROGMEM`) if `progmem`
+ * is set.
+ */
+struct usartTxSegment_s {
+    const uint8_t *data;        ///< Pointer to the segment data
+    uint16_t length;            ///< Segment length in bytes
+    bool progmem;               ///< Set to `true` if `data` points to flash
+};
+
+/*! Transfer job completion callback, called from ISR. The parameter is the
+ * number of bytes transferred.
+ */
+typedef void (usartJobCb_t)(uint16_t);
+
+/*! Transmit generator function, called from ISR with the generator context.
+ * Returns the next byte to transmit, `USART_TX_YIELD` if no byte is ready
+ * yet, or another negative value when done.
+ */
+typedef int16_t (usartTxGenerator_t)(void *);
+
+/*! Generator return value: no byte yet, call again from the next DRE
+ * interrupt. Lets a generator split long work, pending interrupts with higher
+ * priority (RXC) run in between.
+ */
+#define USART_TX_YIELD          (-2)
+
+/*! Receive sink function, called from ISR with each received byte and the
+ * sink context.
+ */
+typedef void (usartRxSink_t)(uint8_t, void *);
+
+/*! Receive activity callback, called from ISR for each received character
+ * including characters with errors.
+ */
+typedef void (usartRxActivityCb_t)(void);
+
+/*! Transmit direction callback, called with `true` before the first byte of a
+ * transmission is written and with `false` from ISR once the last stop bit is
+ * shifted out. Used to control a half-duplex line driver.
+ * Return `true` from the start call to hold the first byte back until
+ * `usartTxResume()` is called, the return value of the drained call is
+ * ignored.
+ */
+typedef bool (usartTxDirectionCb_t)(bool);
+
+
+/*** Public Functions --------------------------------------------------------*/
+/*! \publicsection */
+
+uint8_t usartWrite(const uint8_t *buffer, uint8_t length);
+uint8_t usartTxSpace(void);
+int usartPutCharBuffered(char c, FILE *file);
+bool usartTxDrained(cbParam_t *param);
+void usartTxWaitDrained(void);
+void usartRxStart(void);
+void usartRxStop(void);
+void usartRxSetDelimiter(bool enable, uint8_t delimiter);
+uint8_t usartRxPeek(const uint8_t **data);
+void usartRxConsume(uint8_t n);
+uint8_t usartRead(uint8_t *buffer, uint8_t length);
+int usartGetCharBuffered(FILE *file);
+bool usartRxAvailable(cbParam_t *param);
+bool usartRxDelimiterAvailable(cbParam_t *param);
+void usartRxGetErrors(struct usartRxErrors_s *errors, bool clear);
+bool usartTxJobStart(const uint8_t *data, uint16_t length, usartJobCb_t *done);
+bool usartTxGatherStart(const struct usartTxSegment_s *segments, uint8_t count,
+                        usartJobCb_t *done);
+bool usartTxGeneratorStart(usartTxGenerator_t *generator, void *ctx, usartJobCb_t *done);
+uint16_t usartTxJobCancel(void);
+bool usartRxJobStart(uint8_t *data, uint16_t length, usartJobCb_t *done);
+uint16_t usartRxJobCancel(void);
+void usartRxSinkStart(usartRxSink_t *sink, void *ctx);
+void usartRxSinkStop(void);
+void usartRxSetActivityCallback(usartRxActivityCb_t *cb);
+void usartTxSetDirectionCallback(usartTxDirectionCb_t *cb);
+void usartTxResume(void);
+void usartMpcmStart(uint8_t address, uint8_t mask);
+void usartMpcmStop(void);
+bool usartMpcmAddressed(cbParam_t *param);
+void usartMpcmRelease(void);
+void usartMpcmSendAddress(uint8_t address);
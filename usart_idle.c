@@ -0,0 +1,163 @@
+/*! \file
+ *  usart_idle.c
+ *  xenon-lib-tiny
+ *  Copyright (c) 2020 Martin Clemons
+ */
+#include "usart_idle.h"
+#include <stddef.h>
+#include <avr/interrupt.h>
+#include "util/atomic.h"
+#include "sleep_manager.h"
+#include "timer_counter_b.h"
+#include "usart_buffered.h"
+
+
+/*** Private Global Variables ------------------------------------------------*/
+/*! \privatesection */
+
+/* Set by the TCB ISR when the line went idle after a received character. */
+static volatile bool idleDetected;
+
+/* Called from the TCB ISR when the line went idle. */
+static usartIdleCb_t *idleCb;
+
+
+/*** Public Global Variables -------------------------------------------------*/
+/*! \publicsection */
+
+
+/*** Private Function Prototypes ---------------------------------------------*/
+/*! \privatesection */
+static uint8_t bitsPerChar(void);
+
+
+/*** Interrupt Service Routines (ISR) ----------------------------------------*/
+/*! \privatesection */
+
+/* Timeout elapsed without a received character. The TCB is stopped until the
+ * next character restarts it. */
+ISR(USART_IDLE_TCB_vect)
+{
+    USART_IDLE_TCB.INTFLAGS = TCB_CAPT_bm;
+    USART_IDLE_TCB.CTRLA &= ~TCB_ENABLE_bm;
+    idleDetected = true;
+    if (idleCb != NULL) {
+        idleCb();
+    }
+}
+
+
+/*** Private Functions -------------------------------------------------------*/
+/*! \privatesection */
+
+/*! Get the number of bits in a character frame from the USART0 settings:
+ * start bit, data bits, parity bit and stop bits.
+ * @return Number of bits per character.
+ */
+static uint8_t bitsPerChar(void)
+{
+    uint8_t ctrlc = USART0.CTRLC;
+    uint8_t chsize = ctrlc & USART_CHSIZE_gm;
+    // CHSIZE 0-3 select 5-8 data bits, the 9-bit modes are 6 and 7
+    uint8_t bits = 1 + (chsize <= 3 ? 5 + chsize : 9);
+    if ((ctrlc & USART_PMODE_gm) != USART_PMODE_DISABLED_gc) {
+        bits++;
+    }
+    bits += (ctrlc & USART_SBMODE_bm) ? 2 : 1;
+    return bits;
+}
+
+
+/*** Public Functions --------------------------------------------------------*/
+/*! \publicsection */
+
+/*! Start idle-line detection. The USART must be configured first, the timeout
+ * is computed from the current baud and frame settings.
+ * The TCB runs in periodic interrupt mode and is stopped in its ISR, so it
+ * times out once per received burst. If the timeout exceeds the 16-bit range
+ * at the peripheral clock the TCB runs from the peripheral clock divided by 2,
+ * longer timeouts are limited to the maximum period.
+ * Call again after a clock or baud change.
+ * @param halfChars Timeout in half character times, see `USART_IDLE_CHARS()`.
+ * @param cb Function called from ISR when the line goes idle, or `NULL`.
+ */
+void usartIdleStart(uint8_t halfChars, usartIdleCb_t *cb)
+{
+    // a bit lasts BAUD * S / 64 clocks, S = 16 in normal and 8 in double
+    // speed mode, so a half character lasts bits * BAUD / 8 (or 16) clocks
+    uint8_t shift = (USART0.CTRLB & USART_RXMODE_gm) == USART_RXMODE_CLK2X_gc ? 4 : 3;
+    uint32_t clocks = ((uint32_t)halfChars * bitsPerChar() * USART0.BAUD) >> shift;
+    struct timerCounterBConfig_s config = {
+        .clockSource = TCB_CLOCK_SOURCE_PER,
+        .mode = TCB_MODE_PERIODIC_INTERRUPT,
+    };
+    if (clocks > UINT16_MAX) {
+        config.clockSource = TCB_CLOCK_SOURCE_PER_DIV2;
+        clocks >>= 1;
+    }
+    if (clocks > UINT16_MAX) {
+        clocks = UINT16_MAX;
+    }
+    usartRxSetActivityCallback(NULL);
+    timerCounterBDisable(&USART_IDLE_TCB);
+    timerCounterBConfig(&USART_IDLE_TCB, &config);
+    timerCounterBSetCompare(&USART_IDLE_TCB, clocks > 0 ? clocks - 1 : 0);
+    timerCounterBConfigInterrupts(&USART_IDLE_TCB, true);
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        idleCb = cb;
+        idleDetected = false;
+    }
+    // the TCB is enabled from ISR on each received character, keep the sleep
+    // manager out of standby so it keeps running once started
+    sleepMgrSetLevel(&USART_IDLE_TCB == &TCB0 ? SLEEP_MGR_CLIENT_TCB0 : SLEEP_MGR_CLIENT_TCB1,
+                     SLEEP_MGR_IDLE);
+    usartRxSetActivityCallback(usartIdleRestart);
+}
+
+/*! Restart the idle timeout. Called from the RXC ISR for each character, may
+ * also be called from the idle callback to time several consecutive periods.
+ */
+void usartIdleRestart(void)
+{
+    USART_IDLE_TCB.CNT = 0;
+    USART_IDLE_TCB.INTFLAGS = TCB_CAPT_bm;
+    USART_IDLE_TCB.CTRLA |= TCB_ENABLE_bm;
+}
+
+/*! Stop idle-line detection and the TCB.
+ */
+void usartIdleStop(void)
+{
+    usartRxSetActivityCallback(NULL);
+    timerCounterBConfigInterrupts(&USART_IDLE_TCB, false);
+    timerCounterBDisable(&USART_IDLE_TCB);
+    idleDetected = false;
+}
+
+/*! Get the idle timeout as programmed into the TCB.
+ * @return The TCB compare value, the timeout is this value plus one in TCB
+ * clocks.
+ */
+uint16_t usartIdleGetTimeout(void)
+{
+    return timerCounterBGetCapture(&USART_IDLE_TCB);
+}
+
+/*! Check if the line went idle after a received character.
+ * Use as a conditional task check to process a received frame, then call
+ * `usartIdleClear()`.
+ * @param param Not used.
+ * @return Returns `true` if the line went idle.
+ */
+bool usartIdleDetected(cbParam_t *param)
+{
+    (void)param;
+    return idleDetected;
+}
+
+/*! Clear the idle detected flag.
+ */
+void usartIdleClear(void)
+{
+    idleDetected = false;
+}
@@ -0,0 +1,54 @@
+/*! \file
+ *  usart_idle.h
+ *  xenon-lib-tiny
+ *  Copyright (c) 2020 Martin Clemons
+ *
+ *  Idle-line (inter-frame gap) detection for USART0 receive, for protocols
+ *  which mark frame boundaries with a pause instead of a delimiter. A TCB
+ *  peripheral is restarted on each received character, if no further
+ *  character arrives within the timeout the TCB interrupt sets an end-of-frame
+ *  flag which a conditional task can wait on.
+ *  The timeout is given in character times and converted to TCB clocks from
+ *  the USART0 baud, character size, parity and stop bit settings.
+ *  Requires `usart_buffered.c`, received characters are only seen while the
+ *  receive ring, a receive job or a receive sink is active.
+ *  This file provides the Interrupt Service Routine of the selected TCB, it
+ *  can't be used together with custom ISR code for that vector.
+ */
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <avr/io.h>
+#include "task_scheduler.h"
+
+
+/*** Public Variables --------------------------------------------------------*/
+/*! \publicsection */
+
+/*! TCB peripheral and interrupt vector used for idle detection.
+ */
+#ifndef USART_IDLE_TCB
+#define USART_IDLE_TCB          TCB0
+#define USART_IDLE_TCB_vect     TCB0_INT_vect
+#endif
+
+/*! Convert a number of character times, which may be fractional (e.g. 3.5),
+ * to the half character times expected by `usartIdleStart()`.
+ */
+#define USART_IDLE_CHARS(n)     ((uint8_t)((n) * 2 + 0.5))
+
+/*! Idle detected callback, called from ISR.
+ */
+typedef void (usartIdleCb_t)(void);
+
+
+/*** Public Functions --------------------------------------------------------*/
+/*! \publicsection */
+
+void usartIdleStart(uint8_t halfChars, usartIdleCb_t *cb);
+void usartIdleStop(void);
+void usartIdleRestart(void);
+uint16_t usartIdleGetTimeout(void);
+bool usartIdleDetected(cbParam_t *param);
+void usartIdleClear(void);
@@ -0,0 +1,196 @@
+/*! \file
+ *  usart_rs485.c
+ *  xenon-lib-tiny
+ *  Copyright (c) 2020 Martin Clemons
+ */
+#include "usart_rs485.h"
+#include <stddef.h>
+#include <avr/interrupt.h>
+#include "usart_buffered.h"
+#ifdef USART_RS485_TCB
+#include "sleep_manager.h"
+#include "timer_counter_b.h"
+#endif
+
+
+/*** Private Global Variables ------------------------------------------------*/
+/*! \privatesection */
+
+/* Active RS485 configuration. */
+static struct usartRs485Config_s rs485;
+
+/* Set if the guard time is timed by the TCB before the first byte. */
+static bool guardEnable;
+
+/* Receiver enable state before it was disabled for echo suppression. */
+static bool rxEnabled;
+
+
+/*** Public Global Variables -------------------------------------------------*/
+/*! \publicsection */
+
+
+/*** Private Function Prototypes ---------------------------------------------*/
+/*! \privatesection */
+static void setDriver(bool enable);
+static bool direction(bool transmit);
+
+
+/*** Interrupt Service Routines (ISR) ----------------------------------------*/
+/*! \privatesection */
+
+#ifdef USART_RS485_TCB
+/* Guard time elapsed after the driver was enabled, the TCB is stopped until
+ * the next transmission starts it. */
+ISR(USART_RS485_TCB_vect)
+{
+    USART_RS485_TCB.INTFLAGS = TCB_CAPT_bm;
+    USART_RS485_TCB.CTRLA &= ~TCB_ENABLE_bm;
+    usartTxResume();
+}
+#endif
+
+
+/*** Private Functions -------------------------------------------------------*/
+/*! \privatesection */
+
+/*! Set the GPIO driver enable pin.
+ * @param enable Set to `true` to enable the line driver.
+ */
+static void setDriver(bool enable)
+{
+    if (enable != rs485.deInvert) {
+        rs485.dePort->OUTSET = rs485.dePin;
+    } else {
+        rs485.dePort->OUTCLR = rs485.dePin;
+    }
+}
+
+/*! Transmit direction callback. Called with interrupts disabled before the
+ * first byte of a transmission, and from the TXC ISR once the last stop bit
+ * is shifted out.
+ * @param transmit Set to `true` when transmission starts.
+ * @return Returns `true` to hold the first byte until the guard time has
+ * elapsed, the TCB ISR resumes the transmission.
+ */
+static bool direction(bool transmit)
+{
+    if (transmit) {
+        if (rs485.echoSuppress) {
+            rxEnabled = bit_is_set(USART0.CTRLB, USART_RXEN_bp);
+            USART0.CTRLB &= ~USART_RXEN_bm;
+        }
+        if (rs485.mode == USART_RS485_MODE_GPIO) {
+            setDriver(true);
+        }
+#ifdef USART_RS485_TCB
+        if (guardEnable) {
+            USART_RS485_TCB.CNT = 0;
+            USART_RS485_TCB.INTFLAGS = TCB_CAPT_bm;
+            USART_RS485_TCB.CTRLA |= TCB_ENABLE_bm;
+            return true;
+        }
+#endif
+    } else {
+        if (rs485.mode == USART_RS485_MODE_GPIO) {
+            setDriver(false);
+        }
+        if (rs485.echoSuppress && rxEnabled) {
+            USART0.CTRLB |= USART_RXEN_bm;
+        }
+    }
+    return false;
+}
+
+
+/*** Public Functions --------------------------------------------------------*/
+/*! \publicsection */
+
+/*! Enable RS485 half-duplex mode. Call after `usartConfigAsyncSerial()`,
+ * which clears the USART RS485 bits, and again after a baud rate change.
+ * In XDIR mode the USART drives the XDIR pin high from one bit time before
+ * the start bit until the last stop bit is shifted out, the pin must be
+ * configured as output by the application. In GPIO mode the pin is set as
+ * output and driven inactive.
+ * In GPIO mode the guard time delays the first start bit after the driver is
+ * enabled. It is timed by the `USART_RS485_TCB` one-shot while interrupts
+ * stay enabled. In XDIR mode the hardware enables the driver one bit time
+ * before the start bit, which is the only guard time available.
+ * The driver is released as soon as the last stop bit is shifted out, there
+ * is no guard time after transmission.
+ * Note: Only transmission through `usart_buffered.h` controls the driver.
+ * @param config Pointer to the RS485 configuration, copied.
+ * @return Returns `false` if `guardBits` is not 0 and can't be timed (XDIR
+ * mode, or `USART_RS485_TCB` not defined), the configuration is unchanged.
+ */
+bool usartRs485Config(const struct usartRs485Config_s *config)
+{
+#ifdef USART_RS485_TCB
+    if (config->guardBits > 0 && config->mode != USART_RS485_MODE_GPIO) {
+        return false;
+    }
+#else
+    if (config->guardBits > 0) {
+        return false;
+    }
+#endif
+    usartTxSetDirectionCallback(NULL);
+    rs485 = *config;
+    guardEnable = false;
+#ifdef USART_RS485_TCB
+    timerCounterBDisable(&USART_RS485_TCB);
+    if (config->mode == USART_RS485_MODE_GPIO && config->guardBits > 0) {
+        // a bit lasts BAUD * S / 64 clocks, S = 16 in normal and 8 in double
+        // speed mode
+        uint8_t shift = (USART0.CTRLB & USART_RXMODE_gm) == USART_RXMODE_CLK2X_gc ? 3 : 2;
+        uint32_t clocks = ((uint32_t)config->guardBits * USART0.BAUD) >> shift;
+        struct timerCounterBConfig_s tcbConfig = {
+            .clockSource = TCB_CLOCK_SOURCE_PER,
+            .mode = TCB_MODE_PERIODIC_INTERRUPT,
+        };
+        if (clocks > UINT16_MAX) {
+            tcbConfig.clockSource = TCB_CLOCK_SOURCE_PER_DIV2;
+            clocks >>= 1;
+        }
+        if (clocks > UINT16_MAX) {
+            clocks = UINT16_MAX;
+        }
+        timerCounterBConfig(&USART_RS485_TCB, &tcbConfig);
+        timerCounterBSetCompare(&USART_RS485_TCB, clocks > 0 ? clocks - 1 : 0);
+        timerCounterBConfigInterrupts(&USART_RS485_TCB, true);
+        // the TCB is started from the direction callback, keep the sleep
+        // manager out of standby so it runs while the sender sleeps
+        sleepMgrSetLevel(&USART_RS485_TCB == &TCB0 ? SLEEP_MGR_CLIENT_TCB0 : SLEEP_MGR_CLIENT_TCB1,
+                         SLEEP_MGR_IDLE);
+        guardEnable = true;
+    }
+#endif
+    if (config->mode == USART_RS485_MODE_GPIO) {
+        setDriver(false);
+        config->dePort->DIRSET = config->dePin;
+        USART0.CTRLA = (USART0.CTRLA & ~USART_RS485_gm) | USART_RS485_OFF_gc;
+    } else {
+        USART0.CTRLA = (USART0.CTRLA & ~USART_RS485_gm) | USART_RS485_EXT_gc;
+    }
+    usartTxSetDirectionCallback(direction);
+    return true;
+}
+
+/*! Disable RS485 mode. Wait for the transmitter to drain first, see
+ * `usartTxWaitDrained()`.
+ */
+void usartRs485Disable(void)
+{
+    usartTxSetDirectionCallback(NULL);
+#ifdef USART_RS485_TCB
+    timerCounterBConfigInterrupts(&USART_RS485_TCB, false);
+    timerCounterBDisable(&USART_RS485_TCB);
+#endif
+    USART0.CTRLA = (USART0.CTRLA & ~USART_RS485_gm) | USART_RS485_OFF_gc;
+    if (rs485.mode == USART_RS485_MODE_GPIO) {
+        setDriver(false);
+    }
+    if (rs485.echoSuppress && rxEnabled) {
+        USART0.CTRLB |= USART_RXEN_bm;
+    }
+}
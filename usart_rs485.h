@@ -0,0 +1,53 @@
+/*! \file
+ *  usart_rs485.h
+ *  xenon-lib-tiny
+ *  Copyright (c) 2020 Martin Clemons
+ *
+ *  RS485 half-duplex mode for USART0. The line driver is enabled while the
+ *  buffered transmit path (`usart_buffered.h`) is transmitting and released
+ *  as soon as the last stop bit is shifted out, either by the USART hardware
+ *  through the XDIR pin or by a GPIO pin switched from the TXC interrupt.
+ *  No busy-waiting is needed for the turnaround to receive.
+ */
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <avr/io.h>
+
+
+/*** Public Variables --------------------------------------------------------*/
+/*! \publicsection */
+
+/*! Define `USART_RS485_TCB` and `USART_RS485_TCB_vect`, e.g. as `TCB1` and
+ * `TCB1_INT_vect`, to time the GPIO mode guard time with that TCB, see
+ * `usartRs485Config()`. Not defined by default, because `usart_idle.h` and
+ * `tcb_capture.h` use the TCBs, `usartRs485Config()` then rejects a non-zero
+ * guard time. If defined, this file provides the Interrupt Service Routine of
+ * that TCB.
+ */
+
+/*! RS485 driver enable control.
+ */
+enum usartRs485Mode_e {
+    USART_RS485_MODE_XDIR   = 0,    ///< Hardware control through the USART XDIR pin
+    USART_RS485_MODE_GPIO,          ///< Software control of a GPIO pin, released from TXC ISR
+};
+
+/*! RS485 configuration.
+ */
+struct usartRs485Config_s {
+    enum usartRs485Mode_e mode;     ///< Driver enable control
+    PORT_t *dePort;                 ///< Driver enable pin port (GPIO mode only)
+    uint8_t dePin;                  ///< Driver enable pin bit mask (GPIO mode only)
+    bool deInvert;                  ///< Driver enable is active low (GPIO mode only)
+    uint8_t guardBits;              ///< Bit times between driver enable and the first start bit, must be 0 unless GPIO mode with `USART_RS485_TCB`
+    bool echoSuppress;              ///< Disable the receiver while transmitting
+};
+
+
+/*** Public Functions --------------------------------------------------------*/
+/*! \publicsection */
+
+bool usartRs485Config(const struct usartRs485Config_s *config);
+void usartRs485Disable(void);